@@ -9,17 +9,67 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
-#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
 
 using namespace std;
 
 /*
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex()
+template <class KeyT>
+BTreeIndexT<KeyT>::BTreeIndexT()
 {
 	rootPid = 1;
 	treeHeight = 0;
+	stats = IndexStatsT<KeyT>();
+	statsValid = true;
+	compressLeaves = false;
+	nodePages = 1;
+	backLinks = true;
+	cursorLeafPid = 0;
+	cursorPostingPid = 0;
+	headerDirty = false;
+	counters = IndexCounters();
+	useModel = leafModelDefault;
+	upperDebt = 0;
+	insertBuffer = 0;
+	batching = false;
+	batchBytes = 0;
+	batchEnd = 0;
+	messagesSorted = true;
+	insertRuns = false;
+	runCount = 0;
+	aioPages = NULL;
+}
+
+template <class KeyT>
+bool BTreeIndexT<KeyT>::leafModelDefault = false;
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::setLeafCompression(bool compress)
+{
+	compressLeaves = compress;
+	headerDirty = true;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::setNodeSize(int size)
+{
+	if(treeHeight != 0 || !messages.empty() || runCount != 0 || size % PageFile::PAGE_SIZE != 0 ||
+	   size < PageFile::PAGE_SIZE || size > MAX_NODE_SIZE)
+		return RC_INVALID_ATTRIBUTE;
+
+	nodePages = size / PageFile::PAGE_SIZE;
+	cursorLeaf = BTLeafNodeT<KeyT>(nodeSize());
+	cursorLeafPid = 0;
+	upper.clear();
+	model.clear();
+	upperDebt = 0;
+	headerDirty = true;
+	return 0;
 }
 
 /*
@@ -29,39 +79,263 @@ BTreeIndex::BTreeIndex()
  * @param mode[IN] 'r' for read, 'w' for write
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+template <class KeyT>
+RC BTreeIndexT<KeyT>::open(const string& indexname, char mode)
 {
-	int pfResult = pf.open(indexname, mode);	
+	RC rc = pf.open(indexname, mode);
+	if(rc < 0)
+		return rc;
+	cursorLeafPid = 0;
+	cursorPostingPid = 0;
+	headerDirty = false;
+	upper.clear();
+	model.clear();
+	useModel = leafModelDefault;
+	upperDebt = 0;
+	indexName = indexname;
+	runCount = 0;
 
-	pf.open(indexname, 'w');
-	char buf[1024];
-	if(!pf.endPid()){
-    	rootPid = 1;
-    	treeHeight = 0;
-    	memcpy(buf, (void*)&rootPid, sizeof(rootPid));
-    	memcpy(buf + 4, (void*)&treeHeight, sizeof(treeHeight));
-    	pfResult = pf.write(0, buf);
-    }
-    else{
-    	pf.read(0, buf);
-    	memcpy(&rootPid, (void*)buf, sizeof(rootPid));
-    	memcpy(&treeHeight, (void*)(buf + 4), sizeof(treeHeight));
-    }
+	if(pf.endPid() == 0){
+		//empty index: start with a fresh header
+		rootPid = 1;
+		treeHeight = 0;
+		stats = IndexStatsT<KeyT>();
+		statsValid = true;
+		compressLeaves = false;
+		nodePages = 1;
+		backLinks = true;
+		rc = (mode == 'w') ? writeHeader() : 0;
+	}
+	else if((rc = readHeader()) < 0){
+		pf.close();
+		return rc;
+	}
+
+	//the sorted runs listed in the header are read with the tree
+	for(int i = 0; i < runCount && rc == 0; i++){
+		if((rc = runs[i].open(runName(indexName, i))) < 0){
+			while(--i >= 0)
+				runs[i].close();
+			pf.close();
+			runCount = 0;
+		}
+	}
 
-    return pfResult;
+	//nodes are read with the node size of this index
+	cursorLeaf = BTLeafNodeT<KeyT>(nodeSize());
+	return rc;
 }
 
 /*
  * Close the index file.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::close()
+template <class KeyT>
+RC BTreeIndexT<KeyT>::close()
+{
+	RC rc = flushInserts();
+
+	//an index that was only read keeps its header as it is
+	if(headerDirty){
+		//rebuild the histogram whenever the index doubled in size
+		if(statsValid && stats.keyCount > 0 &&
+		   (stats.histBuckets == 0 || stats.keyCount >= 2 * stats.histBuiltAt))
+			buildHistogram();
+
+		RC hrc = writeHeader();
+		if(rc == 0)
+			rc = hrc;
+		headerDirty = false;
+	}
+	upper.clear();
+	model.clear();
+	for(int i = 0; i < runCount; i++)
+		runs[i].close();
+	if(aio.isOpen())
+		aio.close();
+	free(aioPages);
+	aioPages = NULL;
+	if(pf.close() < 0 && rc == 0)
+		rc = RC_FILE_CLOSE_FAILED;
+	return rc;
+}
+
+/*
+ * Read rootPid, treeHeight and the statistics from page 0.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readHeader()
+{
+	char buf[PageFile::PAGE_SIZE];
+	int  magic;
+	RC   rc;
+
+	if((rc = pf.read(0, buf)) < 0)
+		return rc;
+	memcpy(&rootPid, buf, sizeof(rootPid));
+	memcpy(&treeHeight, buf + 4, sizeof(treeHeight));
+	memcpy(&magic, buf + 8, sizeof(magic));
+
+	//index files from before the statistics have garbage here
+	statsValid = (magic == STATS_MAGIC);
+	compressLeaves = false;
+	nodePages = 1;
+	backLinks = false;
+	runCount = 0;
+	if(statsValid){
+		//the index options follow the statistics
+		const char* options = buf + 12 + sizeof(stats);
+		int keyType;
+		memcpy(&keyType, options + 8, sizeof(keyType));
+		if(keyType != KeyTraits<KeyT>::TYPE_ID)
+			return RC_INVALID_FILE_FORMAT;
+		memcpy(&stats, buf + 12, sizeof(stats));
+		memcpy(&compressLeaves, options, sizeof(compressLeaves));
+		memcpy(&nodePages, options + 4, sizeof(nodePages));
+		memcpy(&backLinks, options + 12, sizeof(backLinks));
+		memcpy(&runCount, options + 16, sizeof(runCount));
+		if(nodePages < 1 || nodePages > MAX_NODE_PAGES)
+			nodePages = 1;
+		if(runCount < 0 || runCount > MAX_INDEX_RUNS)
+			return RC_INVALID_FILE_FORMAT;
+	}
+	else if(KeyTraits<KeyT>::TYPE_ID != KeyTraits<int>::TYPE_ID)
+		return RC_INVALID_FILE_FORMAT;
+	else
+		stats = IndexStatsT<KeyT>();
+	return 0;
+}
+
+/*
+ * Write rootPid, treeHeight and the statistics to page 0.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::writeHeader()
+{
+	char buf[PageFile::PAGE_SIZE];
+	int  magic = statsValid ? STATS_MAGIC : 0;
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, &rootPid, sizeof(rootPid));
+	memcpy(buf + 4, &treeHeight, sizeof(treeHeight));
+	memcpy(buf + 8, &magic, sizeof(magic));
+	memcpy(buf + 12, &stats, sizeof(stats));
+
+	//the index options follow the statistics
+	char* options = buf + 12 + sizeof(stats);
+	memcpy(options, &compressLeaves, sizeof(compressLeaves));
+	memcpy(options + 4, &nodePages, sizeof(nodePages));
+	int keyType = KeyTraits<KeyT>::TYPE_ID;
+	memcpy(options + 8, &keyType, sizeof(keyType));
+	memcpy(options + 12, &backLinks, sizeof(backLinks));
+	memcpy(options + 16, &runCount, sizeof(runCount));
+	return pf.write(0, buf);
+}
+
+/*
+ * add delta to the per-level counter, ignoring levels beyond MAX_LEVELS
+ */
+static void addToLevel(int* counts, int level, int delta)
+{
+	if(level >= 0 && level < IndexStats::MAX_LEVELS)
+		counts[level] += delta;
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::countKey(const KeyT& key)
+{
+	if(stats.keyCount == 0 || key < stats.minKey)
+		stats.minKey = key;
+	if(stats.keyCount == 0 || key > stats.maxKey)
+		stats.maxKey = key;
+	stats.keyCount++;
+
+	if(stats.histBuckets == 0)
+		return;
+
+	//find the first bucket whose bound is >= key
+	int lo = 0, hi = stats.histBuckets - 1;
+	while(lo < hi){
+		int mid = (lo + hi) / 2;
+		if(stats.histBound[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(stats.histBound[lo] < key)
+		stats.histBound[lo] = key;
+	stats.histCount[lo]++;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::buildHistogram()
+{
+	IndexCursor cursor;
+	BTLeafNodeT<KeyT> leaf(nodeSize());
+	RecordId    rid;
+	KeyT        key;
+	int         b = 0;
+	int         depth = (stats.keyCount + IndexStats::HIST_BUCKETS - 1) / IndexStats::HIST_BUCKETS;
+
+	for(int i = 0; i < IndexStats::HIST_BUCKETS; i++){
+		stats.histBound[i] = KeyT();
+		stats.histCount[i] = 0;
+	}
+	stats.histBuckets = 0;
+
+	//walk the leaf level from the leftmost leaf
+	locate(KeyTraits<KeyT>::minValue(), cursor);
+	for(PageId pid = cursor.pid; pid != 0; pid = leaf.getNextNodePtr()){
+		if(leaf.read(pid, pf))
+			return RC_FILE_READ_FAILED;
+		for(int eid = 0; eid < leaf.getKeyCount(); eid++){
+			leaf.readEntry(eid, key, rid);
+			if(stats.histCount[b] >= depth && b < IndexStats::HIST_BUCKETS - 1)
+				b++;
+			stats.histBound[b] = key;
+			stats.histCount[b] += isPostingRef(rid) ? postingCount(-rid.pid) : 1;
+		}
+	}
+
+	stats.histBuckets = (stats.histCount[b] > 0) ? b + 1 : b;
+	stats.histBuiltAt = stats.keyCount;
+	return 0;
+}
+
+template <class KeyT>
+int BTreeIndexT<KeyT>::estimateCount(const KeyT& lowKey, const KeyT& highKey) const
+{
+	if(!statsValid)
+		return -1;
+	if(stats.keyCount == 0 || lowKey > highKey)
+		return 0;
+	if(stats.histBuckets == 0)
+		return -1;
+
+	//assume the keys are spread uniformly inside each bucket
+	double count = 0;
+	double low = KeyTraits<KeyT>::toDouble(lowKey);
+	double high = KeyTraits<KeyT>::toDouble(highKey);
+	double prev = KeyTraits<KeyT>::toDouble(stats.minKey) - 1;
+	for(int i = 0; i < stats.histBuckets; i++){
+		double bound = KeyTraits<KeyT>::toDouble(stats.histBound[i]);
+		double lo = (low > prev + 1) ? low : prev + 1;
+		double hi = (high < bound) ? high : bound;
+		if(hi >= lo && bound > prev)
+			count += stats.histCount[i] * (hi - lo + 1) / (bound - prev);
+		prev = bound;
+	}
+	return (int)(count + 0.5);
+}
+
+template <class KeyT>
+IndexCounters BTreeIndexT<KeyT>::getCounters() const
 {
-	char buf[1024];
-	memcpy(buf, (void*)&rootPid, sizeof(rootPid));
-    memcpy(buf + 4, (void*)&treeHeight, sizeof(treeHeight));
-	pf.write(0, buf);
-    return pf.close();
+	//the runs count the pages they read
+	IndexCounters c = counters;
+	for(int i = 0; i < MAX_INDEX_RUNS; i++)
+		c.runReads += runs[i].getPageReads();
+	return c;
 }
 
 /*
@@ -70,145 +344,708 @@ RC BTreeIndex::close()
  * @param rid[IN] the RecordId for the record being inserted into the index
  * @return error code. 0 if no error
  */
-RC BTreeIndex::insert(int key, const RecordId& rid)
+template <class KeyT>
+RC BTreeIndexT<KeyT>::insert(const KeyT& key, const RecordId& rid)
+{
+	counters.inserts++;
+	if(insertBuffer == 0)
+		return applyInsert(key, rid);
+
+	Message m;
+	m.key = key;
+	m.rid = rid;
+	messages.push_back(m);
+	messagesSorted = false;
+	headerDirty = true;
+	if((int)messages.size() >= insertBuffer)
+		return flushInserts();
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::setInsertBuffer(int entries)
+{
+	if(entries < 0)
+		return RC_INVALID_ATTRIBUTE;
+	insertBuffer = entries;
+	return (int)messages.size() >= entries ? flushInserts() : 0;
+}
+
+/*
+ * Apply the buffered inserts in key order. The nodes they change are
+ * kept in batchPages until the batch is done (or batchPages has grown
+ * to MAX_BATCH_BYTES), so each of them is written once.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::flushInserts()
+{
+	RC rc = 0;
+
+	if(messages.empty())
+		return 0;
+	if(insertRuns)
+		return writeRun();
+
+	sortMessages();
+	batching = true;
+	for(unsigned i = 0; i < messages.size() && rc == 0; i++){
+		rc = applyInsert(messages[i].key, messages[i].rid);
+		if(rc == 0 && batchBytes >= MAX_BATCH_BYTES)
+			rc = writeBatch();
+	}
+	batching = false;
+	RC wrc = writeBatch();
+	messages.clear();
+	return rc < 0 ? rc : wrc;
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::sortMessages()
+{
+	//equal keys keep the order of their inserts
+	if(!messagesSorted)
+		std::stable_sort(messages.begin(), messages.end(), messageOrder);
+	messagesSorted = true;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::setInsertRuns(bool on)
+{
+	//the run list is kept with the statistics in the header
+	if(on && !statsValid)
+		return RC_INVALID_FILE_FORMAT;
+	insertRuns = on;
+	return 0;
+}
+
+template <class KeyT>
+string BTreeIndexT<KeyT>::runName(const string& indexname, int i)
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), ".run%d", i);
+	return indexname + buf;
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::dropRuns(const string& indexname)
+{
+	for(int i = 0; i < MAX_INDEX_RUNS; i++)
+		SortedRunT<KeyT>::drop(runName(indexname, i));
+}
+
+/*
+ * Write the buffered inserts to the next sorted run in one sequential
+ * pass. The inserts stay buffered if the run cannot be written.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::writeRun()
+{
+	SortedRunT<KeyT>& run = runs[runCount];
+	RC rc;
+
+	sortMessages();
+	rc = run.create(runName(indexName, runCount));
+	for(unsigned i = 0; i < messages.size() && rc == 0; i++)
+		rc = run.append(messages[i].key, messages[i].rid);
+	if(rc == 0)
+		rc = run.finish();
+	if(rc < 0){
+		run.close();
+		SortedRunT<KeyT>::drop(runName(indexName, runCount));
+		return rc;
+	}
+
+	runCount++;
+	messages.clear();
+	headerDirty = true;
+	return runCount == MAX_INDEX_RUNS ? mergeRuns() : 0;
+}
+
+/*
+ * Merge the runs and the buffered inserts in key order and apply them to
+ * the tree as one batch (see flushInserts()), or build the tree from
+ * them if it is empty. Equal keys keep the order of their inserts.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::mergeRuns()
+{
+	IndexCursor cursor;
+	KeyT        key;
+	RecordId    rid;
+	RC          rc;
+
+	if(runCount == 0 && messages.empty())
+		return 0;
+
+	//read the merge of the runs and the buffered inserts without the tree
+	sortMessages();
+	cursor.pid = 0;
+	cursor.eid = 0;
+	cursor.ppid = 0;
+	cursor.pidx = 0;
+	for(int i = 0; i < runCount; i++)
+		cursor.run[i] = 0;
+	cursor.mem = 0;
+
+	batching = true;
+	if(treeHeight == 0)
+		rc = bulkBuild(cursor);
+	else{
+		while((rc = readForward(cursor, key, rid)) == 0){
+			if((rc = applyInsert(key, rid)) < 0)
+				break;
+			if(batchBytes >= MAX_BATCH_BYTES && (rc = writeBatch()) < 0)
+				break;
+		}
+		if(rc == RC_INVALID_CURSOR)
+			rc = 0;
+	}
+	batching = false;
+	RC wrc = writeBatch();
+	if(rc == 0)
+		rc = wrc;
+	if(rc < 0)
+		return rc;
+
+	//the tree has the entries now; the header must not list the runs
+	int count = runCount;
+	runCount = 0;
+	messages.clear();
+	if((rc = writeHeader()) < 0)
+		return rc;
+	for(int i = 0; i < count; i++){
+		runs[i].close();
+		SortedRunT<KeyT>::drop(runName(indexName, i));
+	}
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::bulkBuild(IndexCursor& cursor)
+{
+	std::vector<PageId>   pids;     //the nodes of the level built last
+	std::vector<KeyT>     minKeys;  //the smallest key under each of them
+	std::vector<RecordId> group;    //the RecordIds of one key
+	BTLeafNodeT<KeyT> leaf(nodeSize()), saved(nodeSize());
+	int      plainCapacity = BTLeafNodeT<KeyT>::capacity(nodeSize());
+	KeyT     key, next;
+	RecordId rid;
+	RC       rc;
+
+	cursorLeafPid = 0;
+	cursorPostingPid = 0;
+	headerDirty = true;
+	leaf.setCompressed(compressLeaves);
+	if((rc = readForward(cursor, next, rid)) < 0)
+		return rc == RC_INVALID_CURSOR ? 0 : rc;
+
+	//a leaf keeps its pages from when it is started, before the posting
+	//lists of its keys are written behind it
+	PageId leafPid = endPid();
+	if((rc = writeNode(leaf, leafPid)) < 0)
+		return rc;
+	pids.push_back(leafPid);
+
+	while(rc == 0){
+		key = next;
+		group.clear();
+		do{
+			group.push_back(rid);
+			countKey(key);
+		}while((rc = readForward(cursor, next, rid)) == 0 && next == key);
+		if(rc < 0 && rc != RC_INVALID_CURSOR)
+			return rc;
+
+		//a long run of the key goes to a posting list
+		if((int)group.size() > inlineLimit()){
+			PageId head;
+			RC prc = writePostingList(group, head);
+			if(prc < 0)
+				return prc;
+			group.clear();
+			RecordId ref;
+			ref.pid = -head;
+			ref.sid = 0;
+			group.push_back(ref);
+		}
+
+		//the run goes to the next leaf if it does not fit in this one
+		bool restore = group.size() > 1 && leaf.getKeyCount() + (int)group.size() > plainCapacity;
+		if(restore)
+			saved = leaf;
+		unsigned i = 0;
+		while(i < group.size() && leaf.insert(key, group[i]) == 0)
+			i++;
+		if(i < group.size()){
+			if(restore)
+				leaf = saved;
+			PageId nextPid = endPid();
+			leaf.setNextNodePtr(nextPid);
+			RC wrc = writeNode(leaf, leafPid);
+			leaf = BTLeafNodeT<KeyT>(nodeSize());
+			leaf.setCompressed(compressLeaves);
+			leaf.setPrevNodePtr(leafPid);
+			leafPid = nextPid;
+			if(wrc < 0 || (wrc = writeNode(leaf, leafPid)) < 0)
+				return wrc;
+			pids.push_back(leafPid);
+			for(i = 0; i < group.size(); i++)
+				leaf.insert(key, group[i]);
+		}
+		if(leaf.getKeyCount() == (int)group.size())
+			minKeys.push_back(key);
+		addToLevel(stats.entryCount, 0, group.size());
+
+		if(batchBytes >= MAX_BATCH_BYTES){
+			RC wrc = writeBatch();
+			if(wrc < 0)
+				return wrc;
+		}
+	}
+
+	//the root needs two children: an empty leaf goes before a single one
+	if(pids.size() == 1){
+		BTLeafNodeT<KeyT> first(nodeSize());
+		first.setCompressed(compressLeaves);
+		first.setNextNodePtr(leafPid);
+		PageId firstPid = endPid();
+		if((rc = writeNode(first, firstPid)) < 0)
+			return rc;
+		leaf.setPrevNodePtr(firstPid);
+		pids.insert(pids.begin(), firstPid);
+		minKeys.insert(minKeys.begin(), minKeys[0]);
+	}
+	if((rc = writeNode(leaf, leafPid)) < 0)
+		return rc;
+	addToLevel(stats.nodeCount, 0, pids.size());
+
+	//each level spreads the nodes below it evenly over as few nodes as hold them
+	int fanout = BTNonLeafNodeT<KeyT>::capacity(nodeSize()) + 1;
+	int level = 1;
+	while(pids.size() > 1){
+		std::vector<PageId> upperPids;
+		std::vector<KeyT>   upperKeys;
+		int count = (pids.size() + fanout - 1) / fanout;
+		unsigned first = 0;
+		for(int n = 0; n < count; n++){
+			unsigned last = first + (pids.size() - first) / (count - n);
+			BTNonLeafNodeT<KeyT> node(nodeSize());
+			RecordId left, right;
+			left.pid = pids[first];
+			left.sid = 0;
+			right.pid = pids[first + 1];
+			right.sid = 0;
+			node.initializeRoot(left, minKeys[first + 1], right);
+			for(unsigned i = first + 2; i < last; i++){
+				right.pid = pids[i];
+				node.insert(minKeys[i], right);
+			}
+			PageId pid = endPid();
+			if((rc = writeNode(node, pid)) < 0)
+				return rc;
+			upperPids.push_back(pid);
+			upperKeys.push_back(minKeys[first]);
+			addToLevel(stats.nodeCount, level, 1);
+			addToLevel(stats.entryCount, level, last - first - 1);
+			first = last;
+		}
+		pids.swap(upperPids);
+		minKeys.swap(upperKeys);
+		level++;
+	}
+	rootPid = pids[0];
+	treeHeight = level;
+	return 0;
+}
+
+/*
+ * Write the RecordIds of one key to a posting list laid out the way
+ * appendPosting() grows one: full pages behind the head page, the newest
+ * first, and the last RecordIds in the head page.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::writePostingList(const std::vector<RecordId>& rids, PageId& head)
+{
+	BTPostingPage page;
+	PageId behind = 0;
+	RC rc;
+
+	for(unsigned i = 0; i < rids.size(); i += BTPostingPage::CAPACITY){
+		page.clear();
+		page.setNextPagePtr(behind);
+		for(unsigned j = i; j < rids.size() && j < i + BTPostingPage::CAPACITY; j++)
+			page.insert(rids[j]);
+		behind = endPid();
+		if((rc = writeNode(page, behind)) < 0)
+			return rc;
+	}
+	head = behind;
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::writeBatch()
+{
+	RC rc = 0;
+
+	//in PageId order, so that the file grows without holes
+	typename std::map<PageId, std::vector<char> >::iterator it;
+	for(it = batchPages.begin(); it != batchPages.end() && rc == 0; ++it){
+		for(unsigned i = 0; i < it->second.size() / PageFile::PAGE_SIZE && rc == 0; i++)
+			rc = pf.write(it->first + i, &it->second[i * PageFile::PAGE_SIZE]);
+	}
+	batchPages.clear();
+	batchBytes = 0;
+	batchEnd = 0;
+	return rc;
+}
+
+//the size of the page image of a node or posting page
+template <class NodeT>
+static int imageSize(const NodeT& node, int nodeSize) { return nodeSize; }
+static int imageSize(const BTPostingPage& page, int nodeSize) { return PageFile::PAGE_SIZE; }
+
+template <class KeyT>
+template <class NodeT>
+RC BTreeIndexT<KeyT>::readNode(NodeT& node, PageId pid)
 {
-	BTNonLeafNode root;
+	if(batching){
+		typename std::map<PageId, std::vector<char> >::iterator it = batchPages.find(pid);
+		if(it != batchPages.end()){
+			node.fromPage(&it->second[0]);
+			return 0;
+		}
+	}
+	return node.read(pid, pf);
+}
+
+template <class KeyT>
+template <class NodeT>
+RC BTreeIndexT<KeyT>::writeNode(NodeT& node, PageId pid)
+{
+	if(!batching)
+		return node.write(pid, pf);
+
+	int size = imageSize(node, nodeSize());
+	std::vector<char> page(size);
+	RC rc = node.toPage(&page[0]);
+	if(rc < 0)
+		return rc;
+
+	std::vector<char>& image = batchPages[pid];
+	if(image.empty()){
+		image.resize(size);
+		batchBytes += size;
+	}
+	memcpy(&image[0], &page[0], size);
+	if(pid + size / PageFile::PAGE_SIZE > batchEnd)
+		batchEnd = pid + size / PageFile::PAGE_SIZE;
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::applyInsert(const KeyT& key, const RecordId& rid)
+{
+	BTNonLeafNodeT<KeyT> root(nodeSize());
+	cursorLeafPid = 0;
+	cursorPostingPid = 0;
+	headerDirty = true;
+	long splits = counters.splits;
 	if(treeHeight == 0){
 		RecordId rid1, rid2;
-		rid1.pid = pf.endPid() + 1;
-		rid2.pid = pf.endPid() + 2;
+		rid1.pid = rootPid + nodePages;
+		rid2.pid = rootPid + 2 * nodePages;
 		root.initializeRoot(rid1, key, rid2);
 		treeHeight += 2;
+		countKey(key);
+		stats.nodeCount[0] = 2;
+		stats.entryCount[0] = 1;
+		stats.nodeCount[1] = 1;
+		stats.entryCount[1] = 1;
 
 		//write root and 2 leaves
-		root.write(rootPid, pf);
-		BTLeafNode leaf1, leaf2;
+		BTLeafNodeT<KeyT> leaf1(nodeSize()), leaf2(nodeSize());
+		leaf1.setCompressed(compressLeaves);
+		leaf2.setCompressed(compressLeaves);
 		leaf2.insert(key, rid);
 		leaf1.setNextNodePtr(rid2.pid);
-		leaf1.write(rid1.pid, pf);
-		leaf2.write(rid2.pid, pf);
+		leaf2.setPrevNodePtr(rid1.pid);
+		RC rc;
+		if((rc = writeNode(root, rootPid)) < 0 ||
+		   (rc = writeNode(leaf1, rid1.pid)) < 0 ||
+		   (rc = writeNode(leaf2, rid2.pid)) < 0)
+			return rc;
 
 		return 0;
 	}
-	else{
-		root.read(rootPid, pf);
+	else if(readNode(root, rootPid)){
+		return RC_FILE_READ_FAILED;
 	}
 	RecordId rid3;
-	root.locateChildPtr(key, rid3);
-	int prevResult = insertHelper(key, rid, rid3.pid);
+	KeyT parentKey = key;
+	int rootLevel = treeHeight - 1;
+	root.locateChildPtr(key, rid3, true);
+	int prevResult = insertHelper(parentKey, rid, rid3.pid, rootLevel - 1);
+	RC rc = prevResult < 0 ? prevResult : 0;
+	if(rc == 0)
+		countKey(key);
 
 	if(prevResult == OVF){
 		//ovf from level below, insert to root
-		int currentResult = root.insert(key, rid3);
+		int currentResult = root.insert(parentKey, rid3);
 		int originalRootPid = rootPid;
+		addToLevel(stats.entryCount, rootLevel, 1);
 		if(currentResult == RC_NODE_FULL){
 			//root is full, so we must create a sibling and a new root
-			BTNonLeafNode sibling;
-			int midKey;
-			root.insertAndSplit(key, rid3, sibling, midKey);
+			BTNonLeafNodeT<KeyT> sibling(nodeSize());
+			KeyT midKey;
+			PageId siblingPid = endPid();
+			if((rc = root.insertAndSplit(parentKey, rid3, sibling, midKey)) == 0){
+				counters.splits++;
 
-			//write nodes to disk
-			PageId siblingPid = pf.endPid();
-			sibling.write(siblingPid, pf);
+				//write nodes to disk
+				rc = writeNode(sibling, siblingPid);
+			}
 
-			//create new root
-			BTNonLeafNode newRoot;
-			RecordId tempR1, tempR2;
-			tempR1.pid = rootPid;
-			tempR2.pid = siblingPid;
-			newRoot.initializeRoot(tempR1, midKey, tempR2);
-			treeHeight++;
+			if(rc == 0){
+				//create new root
+				BTNonLeafNodeT<KeyT> newRoot(nodeSize());
+				RecordId tempR1, tempR2;
+				tempR1.pid = rootPid;
+				tempR2.pid = siblingPid;
+				newRoot.initializeRoot(tempR1, midKey, tempR2);
+				treeHeight++;
+				addToLevel(stats.nodeCount, rootLevel, 1);
+				addToLevel(stats.entryCount, rootLevel, -1);
+				addToLevel(stats.nodeCount, rootLevel + 1, 1);
+				addToLevel(stats.entryCount, rootLevel + 1, 1);
 
-			//write new root to disk
-			PageId newRootPid = pf.endPid();
-			rootPid = newRootPid;
-			newRoot.write(newRootPid, pf);
+				//write new root to disk
+				PageId newRootPid = endPid();
+				rootPid = newRootPid;
+				rc = writeNode(newRoot, newRootPid);
+			}
 		}
-		root.write(originalRootPid, pf);
+		if(rc == 0)
+			rc = writeNode(root, originalRootPid);
 	}
 
-    if(prevResult == RC_FILE_READ_FAILED || 
-    	prevResult == RC_INVALID_CURSOR)
-    	return prevResult;
-    return 0;
+	//the separators in memory are stale once a node split
+	if(counters.splits != splits){
+		upper.clear();
+		upperDebt = 0;
+	}
+
+    return rc;
 }
 
-RC BTreeIndex::insertHelper(int& key, const RecordId& rid, PageId& pid){
+template <class KeyT>
+RC BTreeIndexT<KeyT>::insertHelper(KeyT& key, const RecordId& rid, PageId& pid, int level){
 	//read current pid into node
 	PageId originalPid = pid;
-	BTNonLeafNode node;
-	if(node.read(originalPid, pf))
+	BTNonLeafNodeT<KeyT> node(nodeSize());
+	if(readNode(node, originalPid))
 		return RC_FILE_READ_FAILED;
 
 	//if leaf
-	if(node.getBufferChar(1015) == 'L'){
-		BTLeafNode leaf;
-		if(leaf.read(originalPid, pf))
+	if(node.isLeaf()){
+		BTLeafNodeT<KeyT> leaf(nodeSize());
+		if(readNode(leaf, originalPid))
 			return RC_FILE_READ_FAILED;
-		int inputKey = key;
-		int leafResult = leaf.insert(key, rid);
+		//plain leaves are converted as they are rewritten
+		if(compressLeaves)
+			leaf.setCompressed(true);
+
+		//a key that is in the leaf already may go to its posting list
+		int eid;
+		bool done = false, leafChanged = false;
+		if(leaf.locate(key, eid) == 0){
+			RC rc = insertDuplicate(leaf, eid, rid, done, leafChanged);
+			if(rc < 0 || (done && !leafChanged))
+				return rc;
+		}
+
+		int leafResult;
+		if(done)
+			leafResult = leaf.fits() ? 0 : RC_NODE_FULL;
+		else
+			leafResult = leaf.insert(key, rid);
 
 		//handle ovf
 		if(leafResult == RC_NODE_FULL){
-			BTLeafNode sibling;
-			int sibkey;
-			leaf.insertAndSplit(key, rid, sibling, sibkey);
+			BTLeafNodeT<KeyT> sibling(nodeSize());
+			KeyT sibkey;
+			RC rc;
+			if(done)
+				rc = leaf.split(sibling, sibkey);
+			else
+				rc = leaf.insertAndSplit(key, rid, sibling, sibkey);
+			if(rc < 0)
+				return rc;
+			counters.splits++;
 			
-			//set next ptr
-			PageId siblingPid = pf.endPid();
+			//set next and prev ptrs
+			PageId siblingPid = endPid();
 			sibling.setNextNodePtr(leaf.getNextNodePtr());
+			sibling.setPrevNodePtr(originalPid);
 			leaf.setNextNodePtr(siblingPid);
 			
 			//write sibling to disk			
-			sibling.write(siblingPid, pf);
+			if((rc = writeNode(sibling, siblingPid)) < 0)
+				return rc;
+
+			//the leaf after the sibling now links back to it
+			if(backLinks && sibling.getNextNodePtr() != 0){
+				BTLeafNodeT<KeyT> after(nodeSize());
+				if(readNode(after, sibling.getNextNodePtr()))
+					return RC_FILE_READ_FAILED;
+				after.setPrevNodePtr(siblingPid);
+				if((rc = writeNode(after, sibling.getNextNodePtr())) < 0)
+					return rc;
+			}
+
+			//the leaf model gets the new separator
+			if(model.isValid() && model.splitLeaf(key, originalPid, sibkey, siblingPid) < 0)
+				model.clear();
 
 			//change parameters for parent
 			key = sibkey;
 			pid = siblingPid;
 			leafResult = OVF;
+			addToLevel(stats.nodeCount, 0, 1);
 		}
-		leaf.write(originalPid, pf);
-		return leafResult;
+		if(!done)
+			addToLevel(stats.entryCount, 0, 1);
+		RC rc = writeNode(leaf, originalPid);
+		return rc < 0 ? rc : leafResult;
 	}
 	//if nonleaf
 	else{
-		//find the child ptr to follow
+		//find the child ptr to follow: the one holding the entries of key
 		RecordId r;
-		if(node.locateChildPtr(key, r))
+		if(node.locateChildPtr(key, r, true))
 			return RC_INVALID_CURSOR;
 
 		//insert recursively
-		int prevResult = insertHelper(key, rid, r.pid);
-		if(prevResult == RC_INVALID_CURSOR)
-			return RC_INVALID_CURSOR;
+		int prevResult = insertHelper(key, rid, r.pid, level - 1);
+		if(prevResult < 0)
+			return prevResult;
 
 		//handle ovf
 		int currentResult = prevResult;
 		if(prevResult == OVF){
 			//child level overflowed, so try inserting into this level
 			currentResult = node.insert(key, r);
+			addToLevel(stats.entryCount, level, 1);
 
 			if(currentResult == RC_NODE_FULL){
-				BTNonLeafNode sibling;
-				int midKey;
-				node.insertAndSplit(key, r, sibling, midKey);
+				BTNonLeafNodeT<KeyT> sibling(nodeSize());
+				KeyT midKey;
+				RC rc;
+				if((rc = node.insertAndSplit(key, r, sibling, midKey)) < 0)
+					return rc;
+				counters.splits++;
 
 				//write nodes to disk
-				PageId siblingPid = pf.endPid();
-				sibling.write(siblingPid, pf);
+				PageId siblingPid = endPid();
+				if((rc = writeNode(sibling, siblingPid)) < 0)
+					return rc;
 
 				//change parameters for parent
 				key = midKey;
 				pid = siblingPid;
 				currentResult = OVF;
+				addToLevel(stats.nodeCount, level, 1);
+				addToLevel(stats.entryCount, level, -1);
 			}
+			//the node is unchanged unless a child split
+			RC rc = writeNode(node, originalPid);
+			if(rc < 0)
+				return rc;
 		}
-		node.write(originalPid, pf);
 		return currentResult;
 	}
 	return 0;
 }
 
+template <class KeyT>
+RC BTreeIndexT<KeyT>::insertDuplicate(BTLeafNodeT<KeyT>& leaf, int eid, const RecordId& rid, bool& done, bool& leafChanged)
+{
+	KeyT key, k;
+	RecordId r;
+	done = false;
+	leafChanged = false;
+
+	leaf.readEntry(eid, key, r);
+	if(isPostingRef(r)){
+		done = true;
+		return appendPosting(-r.pid, rid);
+	}
+
+	//the entries of a key are next to each other
+	int run = 1;
+	while(leaf.readEntry(eid + run, k, r) == 0 && k == key)
+		run++;
+	if(run < inlineLimit())
+		return 0;
+
+	//move the run and rid to a new posting list
+	BTPostingPage posting;
+	for(int i = 0; i < run; i++){
+		leaf.readEntry(eid + i, k, r);
+		posting.insert(r);
+	}
+	posting.insert(rid);
+
+	PageId head = endPid();
+	RC rc;
+	if((rc = writeNode(posting, head)) < 0)
+		return rc;
+
+	RecordId ref;
+	ref.pid = -head;
+	ref.sid = 0;
+	leaf.replaceRun(eid, run, ref);
+	addToLevel(stats.entryCount, 0, 1 - run);
+	done = leafChanged = true;
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::appendPosting(PageId head, const RecordId& rid)
+{
+	BTPostingPage page;
+	RC rc;
+
+	if((rc = readNode(page, head)) < 0)
+		return rc;
+
+	//the head page is full: move its RecordIds to a new page behind it
+	if(page.insert(rid) == RC_NODE_FULL){
+		PageId pid = endPid();
+		if((rc = writeNode(page, pid)) < 0)
+			return rc;
+		page.clear();
+		page.setNextPagePtr(pid);
+		page.insert(rid);
+	}
+	return writeNode(page, head);
+}
+
+template <class KeyT>
+int BTreeIndexT<KeyT>::postingCount(PageId head)
+{
+	BTPostingPage page;
+	int count = 0;
+
+	for(PageId pid = head; pid != 0; pid = page.getNextPagePtr()){
+		if(page.read(pid, pf) < 0)
+			break;
+		count += page.getCount();
+	}
+	return count;
+}
+
 /**
  * Run the standard B+Tree key search algorithm and identify the
  * leaf node where searchKey may exist. If an index entry with
@@ -227,26 +1064,309 @@ RC BTreeIndex::insertHelper(int& key, const RecordId& rid, PageId& pid){
  *                    smaller than searchKey.
  * @return 0 if searchKey is found. Othewise an error code
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locate(const KeyT& searchKey, IndexCursor& cursor)
 {
-	BTNonLeafNode node;
-	node.read(rootPid, pf);
+	//buffered inserts must be found: in the tree, or searched in memory
+	if(!insertRuns && !messages.empty())
+		flushInserts();
+
+	counters.locates++;
+	return locateInRuns(searchKey, cursor, locateInTree(searchKey, cursor));
+}
+
+/*
+ * Set the run and mem positions of a cursor that locateInTree() set to
+ * the first entry >= searchKey of every run and of the buffer.
+ * @param result[IN] what locateInTree() returned
+ * @return what locate() returns
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locateInRuns(const KeyT& searchKey, IndexCursor& cursor, RC result)
+{
+	if(result < 0 && result != RC_NO_SUCH_RECORD)
+		return result;
+
+	KeyT key;
 	RecordId rid;
-	while(1){
-		if(node.getBufferChar(1015) == 'L')
-			break;
-		node.locateChildPtr(searchKey, rid);
-		node.read(rid.pid, pf);
+	for(int i = 0; i < runCount; i++){
+		int pos = runs[i].findPosition(searchKey, false);
+		if(pos < 0)
+			return pos;
+		cursor.run[i] = pos;
+		if(runs[i].read(pos, key, rid) == 0 && key == searchKey)
+			result = 0;
 	}
-	BTLeafNode leaf;
+	sortMessages();
+	Message m;
+	m.key = searchKey;
+	cursor.mem = std::lower_bound(messages.begin(), messages.end(), m, messageOrder) - messages.begin();
+	if(cursor.mem < (int)messages.size() && messages[cursor.mem].key == searchKey)
+		result = 0;
+	return result;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locateInTree(const KeyT& searchKey, IndexCursor& cursor)
+{
+	//nothing has been inserted yet
+	cursor.ppid = 0;
+	cursor.pidx = 0;
+	if(treeHeight == 0){
+		cursor.pid = 0;
+		cursor.eid = 0;
+		return RC_NO_SUCH_RECORD;
+	}
+
+	RecordId rid;
+	RC rc = findLeaf(searchKey, false, rid.pid);
+	if(rc < 0)
+		return rc;
+	BTLeafNodeT<KeyT> leaf(nodeSize());
+	counters.leafReads++;
 	leaf.read(rid.pid, pf);
 	int eid;
 	int result = leaf.locate(searchKey, eid);
+
+	//all keys of the leaf are smaller: the first entry >= searchKey,
+	//if any, starts the next non-empty leaf
+	while(eid == leaf.getKeyCount() && leaf.getNextNodePtr() != 0){
+		rid.pid = leaf.getNextNodePtr();
+		counters.leafReads++;
+		leaf.read(rid.pid, pf);
+		result = leaf.locate(searchKey, eid);
+	}
 	cursor.pid = rid.pid;
 	cursor.eid = eid;
     return result;
 }
 
+template <class KeyT>
+RC BTreeIndexT<KeyT>::findLeaf(const KeyT& searchKey, bool last, PageId& pid)
+{
+	if(findLeafInMemory(searchKey, last, pid))
+		return 0;
+
+	BTNonLeafNodeT<KeyT> node(nodeSize());
+	RecordId rid;
+	rid.pid = rootPid;
+	while(1){
+		counters.nodeReads++;
+		if(node.read(rid.pid, pf) < 0)
+			return RC_FILE_READ_FAILED;
+		if(node.isLeaf())
+			break;
+		upperDebt++;
+		node.locateChildPtr(searchKey, rid, last);
+	}
+	pid = rid.pid;
+	return 0;
+}
+
+template <class KeyT>
+bool BTreeIndexT<KeyT>::findLeafInMemory(const KeyT& searchKey, bool last, PageId& pid)
+{
+	//building the copy or the model reads every non-leaf node once; do
+	//so when the descents have paid for it
+	if(!upper.isValid() && !model.isValid()){
+		int innerNodes = 0;
+		for(int level = 1; statsValid && level < treeHeight && level < IndexStatsT<KeyT>::MAX_LEVELS; level++)
+			innerNodes += stats.nodeCount[level];
+		if(!statsValid)
+			innerNodes = pf.endPid() / nodePages;
+		if(upperDebt >= innerNodes){
+			std::vector<KeyT> keys;
+			std::vector<PageId> leaves;
+			int reads;
+			if(InnerCacheT<KeyT>::readSeparators(pf, rootPid, treeHeight, nodeSize(), reads, keys, leaves) == 0){
+				if(useModel)
+					model.build(keys, leaves);
+				else
+					upper.build(keys, leaves);
+			}
+			counters.nodeReads += reads;
+			upperDebt = 0;
+		}
+	}
+	if(model.isValid()){
+		pid = model.findLeaf(searchKey, last);
+		return true;
+	}
+	if(upper.isValid()){
+		pid = upper.findLeaf(searchKey, last);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * The state of a descent of locateBatch(): the key it looks for and the
+ * node it waits for. A descent moves on when its node is read, to the
+ * next node or, at the leaf level, to the next leaf until the first
+ * entry >= key; the descents of the non-leaf levels are skipped if the
+ * leaf is found in memory.
+ */
+template <class KeyT>
+struct BTreeIndexT<KeyT>::Descent {
+	enum Stage { INNER, LEAF };
+
+	int    index;   //the key of the batch; -1 if the descent is idle
+	Stage  stage;
+	PageId pid;     //the node being read
+	int    waiting; //the pages of the node not read yet
+	RC     rc;      //the first error reading them
+};
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::descentRead(void* arg, PageId pid, RC rc)
+{
+	Descent* d = (Descent*)arg;
+	d->waiting--;
+	if(rc < 0 && d->rc == 0)
+		d->rc = rc;
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::readDescent(Descent& d, PageId pid, char* page)
+{
+	d.pid = pid;
+	d.waiting = nodePages;
+	d.rc = 0;
+	for(int i = 0; i < nodePages; i++){
+		RC rc = aio.read(pid + i, page + i * PageFile::PAGE_SIZE, descentRead, &d);
+		if(rc < 0){
+			//the pages not queued are not waited for
+			d.waiting -= nodePages - i;
+			d.rc = rc;
+			break;
+		}
+	}
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locateBatch(const KeyT* keys, int n, IndexCursor* cursors, RC* results, int width)
+{
+	if(width < 1 || width > MAX_INTERLEAVE)
+		return RC_INVALID_ATTRIBUTE;
+	if(!insertRuns && !messages.empty())
+		flushInserts();
+
+	//the nodes are read through their own queue, opened on first use;
+	//without it, the keys are located one by one
+	if(treeHeight > 0 && !aio.isOpen()){
+		void* p;
+		if(posix_memalign(&p, PageFile::PAGE_SIZE, MAX_INTERLEAVE * nodeSize()) == 0){
+			aioPages = (char*)p;
+			if(aio.open(indexName, 'r', MAX_INTERLEAVE * nodePages) == 0)
+				aio.registerBuffer(aioPages, MAX_INTERLEAVE * nodePages);
+			else{
+				free(aioPages);
+				aioPages = NULL;
+			}
+		}
+	}
+	if(treeHeight == 0 || !aio.isOpen()){
+		for(int i = 0; i < n; i++)
+			results[i] = locate(keys[i], cursors[i]);
+		return 0;
+	}
+
+	Descent descents[MAX_INTERLEAVE];
+	BTNonLeafNodeT<KeyT> node(nodeSize());
+	BTLeafNodeT<KeyT> leaf(nodeSize());
+	int next = 0;    //the next key to start
+	int active = 0;  //the descents not idle
+	for(int s = 0; s < width; s++)
+		descents[s].index = -1;
+
+	while(next < n || active > 0){
+		for(int s = 0; s < width; s++){
+			Descent& d = descents[s];
+			char* page = aioPages + s * nodeSize();
+
+			//an idle descent starts the next key, at the leaf if the
+			//non-leaf levels are in memory
+			if(d.index < 0){
+				if(next == n)
+					continue;
+				d.index = next++;
+				active++;
+				counters.locates++;
+				PageId pid;
+				if(findLeafInMemory(keys[d.index], false, pid)){
+					d.stage = Descent::LEAF;
+					readDescent(d, pid, page);
+				}
+				else{
+					d.stage = Descent::INNER;
+					readDescent(d, rootPid, page);
+				}
+				continue;
+			}
+			if(d.waiting > 0)
+				continue;
+
+			const KeyT& key = keys[d.index];
+			IndexCursor& cursor = cursors[d.index];
+			if(d.rc < 0){
+				results[d.index] = d.rc;
+				d.index = -1;
+				active--;
+				continue;
+			}
+
+			//the node arrived: descend further, or find the entry
+			if(d.stage == Descent::INNER){
+				counters.nodeReads++;
+				node.fromPage(page);
+				if(!node.isLeaf()){
+					RecordId rid;
+					upperDebt++;
+					node.locateChildPtr(key, rid, false);
+					readDescent(d, rid.pid, page);
+					continue;
+				}
+				d.stage = Descent::LEAF;
+			}
+			counters.leafReads++;
+			leaf.fromPage(page);
+			int eid;
+			RC result = leaf.locate(key, eid);
+
+			//as locateInTree(): the first entry >= key may start the
+			//next non-empty leaf
+			if(eid == leaf.getKeyCount() && leaf.getNextNodePtr() != 0){
+				readDescent(d, leaf.getNextNodePtr(), page);
+				continue;
+			}
+			cursor.pid = d.pid;
+			cursor.eid = eid;
+			cursor.ppid = 0;
+			cursor.pidx = 0;
+			results[d.index] = locateInRuns(key, cursor, result);
+			d.index = -1;
+			active--;
+		}
+
+		//the reads queued by this round start now; wait for a node if
+		//every descent waits for one
+		RC rc = aio.submit();
+		bool ready = next < n && active < width;
+		for(int s = 0; s < width && !ready; s++)
+			ready = descents[s].index >= 0 && descents[s].waiting == 0;
+		if(rc == 0 && !ready && active > 0)
+			rc = aio.wait(1);
+		if(rc < 0){
+			//no read may complete into the descents from now on
+			aio.close();
+			free(aioPages);
+			aioPages = NULL;
+			return rc;
+		}
+	}
+	return 0;
+}
+
 /*
  * Read the (key, rid) pair at the location specified by the index cursor,
  * and move foward the cursor to the next entry.
@@ -255,18 +1375,85 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  * @param rid[OUT] the RecordId stored at the index cursor location.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readForward(IndexCursor& cursor, KeyT& key, RecordId& rid)
 {
-	if(cursor.pid == 0)
+	if(!readsMerge())
+		return readForwardInTree(cursor, key, rid);
+
+	//the next entry of the tree is read with a copy of the cursor, which
+	//replaces the cursor if the entry is the smallest
+	IndexCursor next = cursor;
+	int from = -1;  //0: the tree, i + 1: run i, runCount + 1: the buffer
+	RC rc = readForwardInTree(next, key, rid);
+	if(rc == 0)
+		from = 0;
+	else if(rc != RC_INVALID_CURSOR)
+		return rc;
+
+	//on equal keys, the tree comes first, then the runs from the oldest,
+	//then the buffer: the order of the inserts
+	KeyT k;
+	RecordId r;
+	for(int i = 0; i < runCount; i++){
+		if(cursor.run[i] >= runs[i].size())
+			continue;
+		if((rc = runs[i].read(cursor.run[i], k, r)) < 0)
+			return rc;
+		if(from < 0 || k < key){
+			key = k;
+			rid = r;
+			from = i + 1;
+		}
+	}
+	if(cursor.mem < (int)messages.size() && (from < 0 || messages[cursor.mem].key < key)){
+		key = messages[cursor.mem].key;
+		rid = messages[cursor.mem].rid;
+		from = runCount + 1;
+	}
+
+	if(from < 0)
 		return RC_INVALID_CURSOR;
+	if(from == 0)
+		cursor = next;
+	else if(from <= runCount)
+		cursor.run[from - 1]++;
+	else
+		cursor.mem++;
+	return 0;
+}
 
-	BTLeafNode node;
-	node.read(cursor.pid, pf);
-	int result = node.readEntry(cursor.eid, key, rid);
-	int keyCount = node.getKeyCount();
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readForwardInTree(IndexCursor& cursor, KeyT& key, RecordId& rid)
+{
+	//the cursor may point behind the last entry of a leaf
+	while(1){
+		if(cursor.pid == 0)
+			return RC_INVALID_CURSOR;
+
+		//keep the current leaf so that a scan reads (and decodes) it once
+		if(cursor.pid != cursorLeafPid){
+			counters.leafReads++;
+			if(cursorLeaf.read(cursor.pid, pf))
+				return RC_FILE_READ_FAILED;
+			cursorLeafPid = cursor.pid;
+		}
+		if(cursor.eid < cursorLeaf.getKeyCount())
+			break;
+		cursor.pid = cursorLeaf.getNextNodePtr();
+		cursor.eid = 0;
+	}
+
+	int result = cursorLeaf.readEntry(cursor.eid, key, rid);
+	if(!result && isPostingRef(rid)){
+		bool done;
+		result = readPosting(cursor, rid, rid, done);
+		if(!done)
+			return result;
+	}
 	if(!result){
-		if(cursor.eid == keyCount - 1){
-			cursor.pid = node.getNextNodePtr();
+		if(cursor.eid == cursorLeaf.getKeyCount() - 1){
+			cursor.pid = cursorLeaf.getNextNodePtr();
 			cursor.eid = 0;
 		}
 		else{
@@ -276,15 +1463,542 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
     return result;
 }
 
-void BTreeIndex::printTree(){
-	BTNonLeafNode node;
-	node.read(rootPid, pf);
+/*
+ * Stream the posting list ref, one RecordId per call.
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readPosting(IndexCursor& cursor, const RecordId& ref, RecordId& rid, bool& done)
+{
+	done = true;
+	if(cursor.ppid == 0){
+		cursor.ppid = -ref.pid;
+		cursor.pidx = 0;
+	}
+	if(cursor.ppid != cursorPostingPid){
+		counters.postingReads++;
+		if(cursorPosting.read(cursor.ppid, pf))
+			return RC_FILE_READ_FAILED;
+		cursorPostingPid = cursor.ppid;
+	}
+	RC result = cursorPosting.readEntry(cursor.pidx++, rid);
+	if(cursor.pidx < cursorPosting.getCount()){
+		done = false;
+		return result;
+	}
+
+	//the page is done; the list is done at its last page
+	cursor.ppid = cursorPosting.getNextPagePtr();
+	cursor.pidx = 0;
+	done = (cursor.ppid == 0);
+	return result;
+}
 
-	BTNonLeafNode test;
-	
-	for(int i = 2; i <= 2; i++){
-		test.read(i, pf);
-		test.printNode();
+/*
+ * Find the last index entry with a key <= searchKey.
+ * @param key[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the last index entry with
+ *                    searchKey or immediately before the smallest key
+ *                    larger than searchKey.
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locateLast(const KeyT& searchKey, IndexCursor& cursor)
+{
+	if(!insertRuns && !messages.empty())
+		flushInserts();
+
+	counters.locates++;
+	RC result = locateLastInTree(searchKey, cursor);
+	if(result < 0 && result != RC_NO_SUCH_RECORD)
+		return result;
+
+	//the last entry <= searchKey of every run and of the buffer
+	KeyT key;
+	RecordId rid;
+	for(int i = 0; i < runCount; i++){
+		int pos = runs[i].findPosition(searchKey, true);
+		if(pos < 0)
+			return pos;
+		cursor.run[i] = pos - 1;
+		if(runs[i].read(pos - 1, key, rid) == 0 && key == searchKey)
+			result = 0;
 	}
-	cout << treeHeight << " " << rootPid << endl;
+	sortMessages();
+	Message m;
+	m.key = searchKey;
+	cursor.mem = std::upper_bound(messages.begin(), messages.end(), m, messageOrder) - messages.begin() - 1;
+	if(cursor.mem >= 0 && messages[cursor.mem].key == searchKey)
+		result = 0;
+	return result;
 }
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::locateLastInTree(const KeyT& searchKey, IndexCursor& cursor)
+{
+	cursor.ppid = 0;
+	cursor.pidx = 0;
+	if(treeHeight == 0){
+		cursor.pid = 0;
+		cursor.eid = 0;
+		return RC_NO_SUCH_RECORD;
+	}
+
+	RecordId rid;
+	RC rc = findLeaf(searchKey, true, rid.pid);
+	if(rc < 0)
+		return rc;
+	BTLeafNodeT<KeyT> leaf(nodeSize());
+	counters.leafReads++;
+	leaf.read(rid.pid, pf);
+	int eid;
+	int result = leaf.locate(searchKey, eid);
+	if(result == 0){
+		//move to the last entry of the run
+		KeyT key;
+		RecordId r;
+		while(leaf.readEntry(eid + 1, key, r) == 0 && key == searchKey)
+			eid++;
+	}
+	else
+		eid--;
+	cursor.pid = rid.pid;
+	cursor.eid = eid;
+	return result;
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move the cursor back to the previous entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readBackward(IndexCursor& cursor, KeyT& key, RecordId& rid)
+{
+	if(!readsMerge())
+		return readBackwardInTree(cursor, key, rid);
+
+	//as readForward(), with the largest entry and the sources in the
+	//reverse order: the buffer, the runs from the newest, the tree
+	int from = -1;  //0: the tree, i + 1: run i, runCount + 1: the buffer
+	if(cursor.mem >= 0 && cursor.mem < (int)messages.size()){
+		key = messages[cursor.mem].key;
+		rid = messages[cursor.mem].rid;
+		from = runCount + 1;
+	}
+
+	KeyT k;
+	RecordId r;
+	RC rc;
+	for(int i = runCount - 1; i >= 0; i--){
+		if(cursor.run[i] < 0)
+			continue;
+		if((rc = runs[i].read(cursor.run[i], k, r)) < 0)
+			return rc;
+		if(from < 0 || key < k){
+			key = k;
+			rid = r;
+			from = i + 1;
+		}
+	}
+
+	IndexCursor next = cursor;
+	rc = readBackwardInTree(next, k, r);
+	if(rc == 0 && (from < 0 || key < k)){
+		key = k;
+		rid = r;
+		from = 0;
+	}
+	else if(rc < 0 && rc != RC_INVALID_CURSOR)
+		return rc;
+
+	if(from < 0)
+		return RC_INVALID_CURSOR;
+	if(from == 0)
+		cursor = next;
+	else if(from <= runCount)
+		cursor.run[from - 1]--;
+	else
+		cursor.mem--;
+	return 0;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::readBackwardInTree(IndexCursor& cursor, KeyT& key, RecordId& rid)
+{
+	//the cursor may point before the first entry of a leaf
+	while(1){
+		if(cursor.pid == 0)
+			return RC_INVALID_CURSOR;
+
+		if(cursor.pid != cursorLeafPid){
+			counters.leafReads++;
+			if(cursorLeaf.read(cursor.pid, pf))
+				return RC_FILE_READ_FAILED;
+			cursorLeafPid = cursor.pid;
+		}
+		if(cursor.eid >= cursorLeaf.getKeyCount())
+			cursor.eid = cursorLeaf.getKeyCount() - 1;
+		if(cursor.eid >= 0)
+			break;
+		cursor.pid = cursorLeaf.getPrevNodePtr();
+		cursor.eid = INT_MAX;
+	}
+
+	int result = cursorLeaf.readEntry(cursor.eid, key, rid);
+	if(!result && isPostingRef(rid)){
+		bool done;
+		result = readPosting(cursor, rid, rid, done);
+		if(!done)
+			return result;
+	}
+	if(!result)
+		cursor.eid--;
+	return result;
+}
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::skip(IndexCursor& cursor, int count, int& skipped, bool backward)
+{
+	KeyT key;
+	RecordId rid;
+	RC rc;
+
+	skipped = 0;
+
+	//the runs and the buffer have no counts to skip by
+	if(readsMerge()){
+		while(skipped < count){
+			rc = backward ? readBackward(cursor, key, rid) : readForward(cursor, key, rid);
+			if(rc == RC_INVALID_CURSOR)
+				return 0;
+			if(rc < 0)
+				return rc;
+			skipped++;
+		}
+		return 0;
+	}
+
+	while(skipped < count){
+		if(cursor.pid == 0)
+			return 0;
+
+		//only the leaves (and posting pages) are read, not the records
+		if(cursor.pid != cursorLeafPid){
+			counters.leafReads++;
+			if(cursorLeaf.read(cursor.pid, pf))
+				return RC_FILE_READ_FAILED;
+			cursorLeafPid = cursor.pid;
+		}
+		if(backward && cursor.eid >= cursorLeaf.getKeyCount())
+			cursor.eid = cursorLeaf.getKeyCount() - 1;
+		if(cursor.eid < 0 || cursor.eid >= cursorLeaf.getKeyCount()){
+			cursor.pid = backward ? cursorLeaf.getPrevNodePtr() : cursorLeaf.getNextNodePtr();
+			cursor.eid = backward ? INT_MAX : 0;
+			continue;
+		}
+
+		cursorLeaf.readEntry(cursor.eid, key, rid);
+		if(isPostingRef(rid)){
+			//skip whole posting pages by their count
+			if(cursor.ppid == 0){
+				cursor.ppid = -rid.pid;
+				cursor.pidx = 0;
+			}
+			if(cursor.ppid != cursorPostingPid){
+				counters.postingReads++;
+				if(cursorPosting.read(cursor.ppid, pf))
+					return RC_FILE_READ_FAILED;
+				cursorPostingPid = cursor.ppid;
+			}
+			int left = cursorPosting.getCount() - cursor.pidx;
+			if(left > count - skipped){
+				cursor.pidx += count - skipped;
+				skipped = count;
+				return 0;
+			}
+			skipped += left;
+			cursor.ppid = cursorPosting.getNextPagePtr();
+			cursor.pidx = 0;
+			if(cursor.ppid != 0)
+				continue;
+		}
+		else
+			skipped++;
+		cursor.eid += backward ? -1 : 1;
+	}
+	return 0;
+}
+
+IndexReport::IndexReport()
+{
+	height = 0;
+	nodeSize = 0;
+	for(int i = 0; i < MAX_LEVELS; i++){
+		nodeCount[i] = 0;
+		entryCount[i] = 0;
+		usedBytes[i] = 0;
+	}
+	for(int i = 0; i < FILL_BUCKETS; i++)
+		leafFill[i] = 0;
+	compressedLeaves = 0;
+	contiguousLeaves = 0;
+	postingLists = 0;
+	postingPages = 0;
+	postingEntries = 0;
+	wastedBytes = 0;
+	filePages = 0;
+	unusedPages = 0;
+	runs = 0;
+	runEntries = 0;
+	problemCount = 0;
+}
+
+void IndexReport::addProblem(PageId pid, const string& what)
+{
+	char buf[32];
+
+	problemCount++;
+	if((int)problems.size() < MAX_PROBLEMS){
+		snprintf(buf, sizeof(buf), "page %d: ", pid);
+		problems.push_back(buf + what);
+	}
+}
+
+void IndexReport::print(FILE* out) const
+{
+	int  capacity = nodeSize - NODE_TRAILER_SIZE;
+	long fileBytes = (long)filePages * PageFile::PAGE_SIZE;
+
+	fprintf(out, "height %d, node size %d bytes, %d pages\n", height, nodeSize, filePages);
+	fprintf(out, "level %8s %12s %9s\n", "nodes", "entries", "avg fill");
+	for(int level = height - 1; level >= 0; level--){
+		double fill = nodeCount[level] > 0 ? 100.0 * usedBytes[level] / ((double)nodeCount[level] * capacity) : 0;
+		fprintf(out, "%5d %8d %12ld %8.1f%%\n", level, nodeCount[level], entryCount[level], fill);
+	}
+
+	fprintf(out, "leaf fill:");
+	for(int i = 0; i < FILL_BUCKETS; i++)
+		fprintf(out, " %d-%d%%: %d%s", i * 100 / FILL_BUCKETS, (i + 1) * 100 / FILL_BUCKETS,
+		        leafFill[i], i + 1 < FILL_BUCKETS ? "," : "\n");
+	fprintf(out, "compressed leaves: %d\n", compressedLeaves);
+	if(nodeCount[0] > 1)
+		fprintf(out, "leaf contiguity: %d of %d leaves are followed by the next leaf on disk (%.1f%%)\n",
+		        contiguousLeaves, nodeCount[0] - 1, 100.0 * contiguousLeaves / (nodeCount[0] - 1));
+	fprintf(out, "posting lists: %d in %d pages with %ld RecordIds\n",
+	        postingLists, postingPages, postingEntries);
+	fprintf(out, "wasted space: %ld bytes free in nodes, %d unused pages (%.1f%% of the file)\n",
+	        wastedBytes, unusedPages,
+	        fileBytes > 0 ? 100.0 * (wastedBytes + (long)unusedPages * PageFile::PAGE_SIZE) / fileBytes : 0.0);
+	if(runs > 0)
+		fprintf(out, "sorted runs: %d with %ld entries not yet merged into the tree\n", runs, runEntries);
+
+	fprintf(out, "problems: %d\n", problemCount);
+	for(unsigned i = 0; i < problems.size(); i++)
+		fprintf(out, "  %s\n", problems[i].c_str());
+	if(problemCount > (int)problems.size())
+		fprintf(out, "  ...\n");
+}
+
+template <class KeyT>
+struct BTreeIndexT<KeyT>::WalkState {
+	IndexReport&        report;
+	std::vector<char>   seen;      // pages already reached
+	std::vector<PageId> leaves;    // the leaves in key order
+	std::vector<PageId> nextPtrs;  // their next pointers
+	std::vector<PageId> prevPtrs;  // their previous pointers
+	KeyT                lastKey;   // the last key of the leaves so far
+	bool                hasLastKey;
+
+	WalkState(IndexReport& r, int pages) : report(r), seen(pages, 0), hasLastKey(false) {}
+
+	/*
+	 * mark the pages of a node or posting page as reached.
+	 * @return false if the page is out of the file or reached before
+	 */
+	bool reach(PageId pid, int pages)
+	{
+		if(pid <= 0 || pid + pages > (int)seen.size()){
+			report.addProblem(pid, "pointer out of the index file");
+			return false;
+		}
+		for(int i = 0; i < pages; i++){
+			if(seen[pid + i]){
+				report.addProblem(pid, "page reached twice");
+				return false;
+			}
+			seen[pid + i] = 1;
+		}
+		return true;
+	}
+};
+
+template <class KeyT>
+RC BTreeIndexT<KeyT>::analyze(IndexReport& report)
+{
+	RC rc = flushInserts();
+	if(rc < 0)
+		return rc;
+
+	report = IndexReport();
+	report.height = treeHeight;
+	report.nodeSize = nodeSize();
+	report.filePages = pf.endPid();
+	report.runs = runCount;
+	for(int i = 0; i < runCount; i++)
+		report.runEntries += runs[i].size();
+	if(treeHeight > IndexReport::MAX_LEVELS)
+		return RC_INVALID_FILE_FORMAT;
+
+	WalkState state(report, report.filePages);
+	if(report.filePages > 0)
+		state.seen[0] = 1;
+	if(treeHeight > 0)
+		analyzeNode(rootPid, 0, NULL, NULL, state);
+
+	//the leaf chain must visit the leaves in key order
+	int leafCount = state.leaves.size();
+	for(int i = 0; i < leafCount; i++){
+		PageId next = (i + 1 < leafCount) ? state.leaves[i + 1] : 0;
+		PageId prev = (i > 0) ? state.leaves[i - 1] : 0;
+		if(state.nextPtrs[i] != next)
+			report.addProblem(state.leaves[i], "next pointer does not lead to the next leaf");
+		if(backLinks && state.prevPtrs[i] != prev)
+			report.addProblem(state.leaves[i], "previous pointer does not lead to the previous leaf");
+		if(next != 0 && next == state.leaves[i] + nodePages)
+			report.contiguousLeaves++;
+	}
+
+	for(int i = 0; i < report.filePages; i++){
+		if(!state.seen[i])
+			report.unusedPages++;
+	}
+	return 0;
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::analyzeNode(PageId pid, int depth, const KeyT* low, const KeyT* high, WalkState& state)
+{
+	IndexReport& report = state.report;
+	int          level = treeHeight - 1 - depth;
+	int          capacity = nodeSize() - NODE_TRAILER_SIZE;
+
+	if(!state.reach(pid, nodePages))
+		return;
+
+	BTNonLeafNodeT<KeyT> node(nodeSize());
+	if(node.read(pid, pf) < 0){
+		report.addProblem(pid, "cannot read the node");
+		return;
+	}
+
+	if(node.isLeaf()){
+		BTLeafNodeT<KeyT> leaf(nodeSize());
+		leaf.read(pid, pf);
+		if(level != 0)
+			report.addProblem(pid, "leaf above the leaf level");
+		level = 0;
+
+		int used = leaf.getStoredSize();
+		report.nodeCount[0]++;
+		report.entryCount[0] += leaf.getKeyCount();
+		report.usedBytes[0] += used;
+		report.wastedBytes += capacity - used;
+		report.leafFill[min(IndexReport::FILL_BUCKETS - 1, used * IndexReport::FILL_BUCKETS / capacity)]++;
+		if(leaf.isCompressed())
+			report.compressedLeaves++;
+		state.leaves.push_back(pid);
+		state.nextPtrs.push_back(leaf.getNextNodePtr());
+		state.prevPtrs.push_back(leaf.getPrevNodePtr());
+
+		KeyT key;
+		RecordId rid;
+		for(int eid = 0; eid < leaf.getKeyCount(); eid++){
+			leaf.readEntry(eid, key, rid);
+			if(state.hasLastKey && key < state.lastKey)
+				report.addProblem(pid, "leaf keys out of order");
+			if((low != NULL && key < *low) || (high != NULL && *high < key))
+				report.addProblem(pid, "leaf key outside the separators of its parent");
+			state.lastKey = key;
+			state.hasLastKey = true;
+			if(isPostingRef(rid))
+				analyzePosting(-rid.pid, state);
+		}
+		return;
+	}
+
+	int keyCount = node.getKeyCount();
+	if(level <= 0){
+		report.addProblem(pid, "non-leaf node at the leaf level");
+		return;
+	}
+	if(keyCount < 1 || keyCount > BTNonLeafNodeT<KeyT>::capacity(nodeSize())){
+		report.addProblem(pid, "bad key count in non-leaf node");
+		return;
+	}
+
+	int used = sizeof(RecordId) + keyCount * BTNonLeafNodeT<KeyT>::ENTRY_SIZE;
+	report.nodeCount[level]++;
+	report.entryCount[level] += keyCount;
+	report.usedBytes[level] += used;
+	report.wastedBytes += capacity - used;
+
+	//child i holds the keys between separators i - 1 and i; copies of
+	//a separator may be on both sides of it
+	KeyT prevKey, key;
+	for(int eid = 0; eid <= keyCount; eid++){
+		const KeyT* childLow = low;
+		const KeyT* childHigh = high;
+		if(eid > 0){
+			node.readKey(eid - 1, prevKey);
+			childLow = &prevKey;
+		}
+		if(eid < keyCount){
+			node.readKey(eid, key);
+			childHigh = &key;
+			if(eid > 0 && key < prevKey)
+				report.addProblem(pid, "separators out of order");
+			if((low != NULL && key < *low) || (high != NULL && *high < key))
+				report.addProblem(pid, "separator outside the separators of its parent");
+		}
+
+		PageId child;
+		node.readChildPtr(eid, child);
+		analyzeNode(child, depth + 1, childLow, childHigh, state);
+
+		//the recursion reads other nodes; keep the keys of this one
+		if(eid < keyCount)
+			prevKey = key;
+	}
+}
+
+template <class KeyT>
+void BTreeIndexT<KeyT>::analyzePosting(PageId head, WalkState& state)
+{
+	IndexReport& report = state.report;
+	BTPostingPage page;
+
+	report.postingLists++;
+	for(PageId pid = head; pid != 0; pid = page.getNextPagePtr()){
+		if(!state.reach(pid, 1))
+			return;
+		if(page.read(pid, pf) < 0 || !page.isPostingPage()){
+			report.addProblem(pid, "posting list leads to a page that is not a posting page");
+			return;
+		}
+		if(page.getCount() < 0 || page.getCount() > BTPostingPage::CAPACITY){
+			report.addProblem(pid, "bad count in posting page");
+			return;
+		}
+		report.postingPages++;
+		report.postingEntries += page.getCount();
+		report.wastedBytes += PageFile::PAGE_SIZE - NODE_TRAILER_SIZE - page.getCount() * (int)sizeof(RecordId);
+	}
+}
+
+//the key types an index can be built on
+template class BTreeIndexT<int>;
+template class BTreeIndexT<int64_t>;
+template class BTreeIndexT<StringKey>;
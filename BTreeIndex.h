@@ -10,14 +10,28 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
+#include "InnerCache.h"
+#include "LeafModel.h"
+#include "SortedRun.h"
+#include "PageIO.h"
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and 
  * eid (the location of the index entry inside the node).
+ * If the entry is a posting list, ppid and pidx point to the next
+ * RecordId to read from the list.
+ * If the index has sorted runs or buffered inserts in front of the tree
+ * (see BTreeIndexT::setInsertRuns()), run and mem point to the next entry
+ * to read from each of them.
  * IndexCursor is used for index lookup and traversal.
  */
 typedef struct {
@@ -25,15 +39,109 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // PageId of the posting page being read; 0 if none
+  PageId  ppid;
+  // The entry number inside the posting page
+  int     pidx;
+  // The entry number inside each sorted run
+  int     run[MAX_INDEX_RUNS];
+  // The entry number inside the buffered inserts
+  int     mem;
 } IndexCursor;
 
 /**
- * Implements a B-Tree index for bruinbase.
- * 
+ * Statistics about the keys in a BTreeIndexT. They are stored in the
+ * header page (page 0) of the index file behind rootPid and treeHeight
+ * and are maintained on every insert. Levels are counted from the leaves
+ * (level 0), so they do not change when the root splits.
  */
-class BTreeIndex {
+template <class KeyT>
+struct IndexStatsT {
+  static const int MAX_LEVELS = 16;
+  static const int HIST_BUCKETS = 32;
+
+  int keyCount;                 /// number of keys in the index
+  KeyT minKey;                  /// the smallest key (valid if keyCount > 0)
+  KeyT maxKey;                  /// the largest key (valid if keyCount > 0)
+  int nodeCount[MAX_LEVELS];    /// number of nodes per level; [0] = leaves
+  int entryCount[MAX_LEVELS];   /// number of keys per level
+  int histBuckets;              /// number of histogram buckets in use
+  int histBuiltAt;              /// keyCount when the histogram was built
+  KeyT histBound[HIST_BUCKETS]; /// largest key of each equi-depth bucket
+  int histCount[HIST_BUCKETS];  /// number of keys in each bucket
+};
+
+/**
+ * The shape of a BTreeIndexT and the violations of its invariants,
+ * as found by BTreeIndexT::analyze() walking the whole tree.
+ * Levels are counted from the leaves (level 0).
+ */
+struct IndexReport {
+  static const int MAX_LEVELS = 16;
+  static const int FILL_BUCKETS = 10;
+  static const int MAX_PROBLEMS = 20;  /// problems kept with a description
+
+  int  height;                  /// the height of the tree
+  int  nodeSize;                /// the size of a node in bytes
+  int  nodeCount[MAX_LEVELS];   /// nodes per level
+  long entryCount[MAX_LEVELS];  /// entries (keys) per level
+  long usedBytes[MAX_LEVELS];   /// bytes the entries take per level
+  int  leafFill[FILL_BUCKETS];  /// leaves by fill, in tenths of a node
+  int  compressedLeaves;        /// leaves in the compressed format
+  int  contiguousLeaves;        /// leaves whose next leaf follows on disk
+  int  postingLists;            /// keys with a posting list
+  int  postingPages;            /// pages of all posting lists
+  long postingEntries;          /// RecordIds in all posting lists
+  long wastedBytes;             /// free bytes in nodes and posting pages
+  int  filePages;               /// pages in the index file
+  int  unusedPages;             /// pages no node or posting list uses
+  int  runs;                    /// sorted runs in front of the tree
+  long runEntries;              /// entries in the sorted runs
+  int  problemCount;            /// violated invariants
+  std::vector<std::string> problems;
+
+  IndexReport();
+
+  /**
+   * record a violated invariant.
+   * @param pid[IN] the page where it was found
+   * @param what[IN] the description
+   */
+  void addProblem(PageId pid, const std::string& what);
+
+  /**
+   * print the report in a human readable form.
+   * @param out[IN] where to print
+   */
+  void print(FILE* out) const;
+};
+
+/**
+ * Operation counts of one BTreeIndexT object, for profiling queries.
+ * They are plain increments on the index object, so they are always on.
+ */
+struct IndexCounters {
+  long locates;       /// keys located by locate(), locateLast() and locateBatch()
+  long nodeReads;     /// nodes read while descending
+  long leafReads;     /// leaf nodes read by locating and cursor moves
+  long postingReads;  /// posting pages read by cursor moves
+  long runReads;      /// sorted run pages read by locating and cursor moves
+  long inserts;       /// calls of insert()
+  long splits;        /// leaf and non-leaf node splits
+
+  IndexCounters() : locates(0), nodeReads(0), leafReads(0), postingReads(0),
+                    runReads(0), inserts(0), splits(0) {}
+};
+
+/**
+ * Implements a B-Tree index for bruinbase with keys of type KeyT
+ * (int, int64_t or StringKey; see BTreeKey.h). The key type is kept in
+ * the index header and checked when the index is opened.
+ */
+template <class KeyT>
+class BTreeIndexT {
  public:
-  BTreeIndex();
+  BTreeIndexT();
 
   /**
    * Open the index file in read or write mode.
@@ -52,13 +160,82 @@ class BTreeIndex {
     
   /**
    * Insert (key, RecordId) pair to the index.
+   * The copies of a key are stored as leaf entries until they would
+   * fill half a posting page (see inlineLimit()); further copies move
+   * all RecordIds of the key to a posting list.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
    */
-  RC insert(int key, const RecordId& rid);
+  RC insert(const KeyT& key, const RecordId& rid);
+
+  /// the insert buffer used for loading tables, in inserts
+  static const int DEFAULT_INSERT_BUFFER = 64 * 1024;
+
+  /**
+   * Buffer inserts in memory and apply them in key order, in batches of
+   * up to entries inserts. A node changed by a batch is written once per
+   * batch rather than once per insert, which makes random inserts much
+   * cheaper. The batch is applied when the buffer is full, before
+   * locate(), locateLast() and analyze(), on flushInserts() and on
+   * close(); getStats() and estimateCount() count it only from then on.
+   * Buffered inserts are lost if the index is not closed.
+   * @param entries[IN] the capacity of the buffer; 0 to apply every
+   *                    insert at once (the default)
+   * @return error code. 0 if no error
+   */
+  RC setInsertBuffer(int entries);
+
+  /**
+   * Apply the buffered inserts to the tree, or write them to a sorted
+   * run if setInsertRuns() is on.
+   * @return error code. 0 if no error
+   */
+  RC flushInserts();
+
+  /**
+   * Write full insert buffers to immutable sorted runs (see SortedRunT)
+   * instead of applying them to the tree: a run is one sequential write.
+   * Once there are MAX_INDEX_RUNS runs, they are merged into the tree in
+   * one batch (see mergeRuns()). Meanwhile locate(), locateLast() and the
+   * reads merge the tree, the runs and the buffered inserts, which are
+   * searched in memory rather than flushed; getStats() and
+   * estimateCount() count the entries of a run once it is merged. The
+   * runs are kept in the files indexname.run0, .run1, ... and are listed
+   * in the index header, so the setting affects only where inserts go.
+   * Inserts invalidate the cursors.
+   * @param on[IN] true to write sorted runs
+   * @return error code. 0 if no error
+   */
+  RC setInsertRuns(bool on);
+
+  /**
+   * Merge the sorted runs and the buffered inserts into the tree and
+   * delete the runs. An empty tree is built bottom-up from them (see
+   * bulkBuild()), so a bulk load should end with this.
+   * @return error code. 0 if no error
+   */
+  RC mergeRuns();
+
+  /**
+   * Delete the sorted run files of an index file, e.g., along with the
+   * index file.
+   * @param indexname[IN] the name of the index file
+   */
+  static void dropRuns(const std::string& indexname);
+
+  /**
+   * Insert (key, RecordId) pair into the subtree rooted at pid.
+   * If the node at pid splits, key and pid are set to the key and the
+   * PageId that must be inserted into the parent and OVF is returned.
+   * @param key[IN/OUT] the key to insert / the key for the parent
+   * @param rid[IN] the RecordId to insert
+   * @param pid[IN/OUT] the root of the subtree / the new sibling
+   * @param level[IN] the level of pid counted from the leaves
+   * @return 0 or OVF if no error. Otherwise an error code
+   */
+  RC insertHelper(KeyT& key, const RecordId& rid, PageId& pid, int level);
 
-  RC insertHelper(int& key, const RecordId& rid, PageId& pid);
   /**
    * Run the standard B+Tree key search algorithm and identify the
    * leaf node where searchKey may exist. If an index entry with
@@ -77,21 +254,378 @@ class BTreeIndex {
    *                    smaller than searchKey.
    * @return 0 if searchKey is found. Othewise, an error code
    */
-  RC locate(int searchKey, IndexCursor& cursor);
+  RC locate(const KeyT& searchKey, IndexCursor& cursor);
+
+  /// the largest number of descents locateBatch() interleaves
+  static const int MAX_INTERLEAVE = 32;
+
+  /**
+   * locate() every key of a batch. Up to width descents are interleaved:
+   * each one is a state machine that queues the read of its next node
+   * and yields to the others until the node arrives, so the reads of
+   * the batch overlap (see PageIO) instead of one descent waiting for
+   * each of its nodes in turn. Without asynchronous reads the result is
+   * the same as of calling locate() for every key.
+   * @param keys[IN] the keys to find
+   * @param n[IN] the number of keys
+   * @param cursors[OUT] the cursor of every key, as set by locate()
+   * @param results[OUT] what locate() returns for every key
+   * @param width[IN] the number of descents in flight, up to MAX_INTERLEAVE
+   * @return error code. 0 if no error (the results of the keys aside)
+   */
+  RC locateBatch(const KeyT* keys, int n, IndexCursor* cursors, RC* results, int width = MAX_INTERLEAVE);
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
+   * A key with a posting list is returned once for every RecordId in it.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error
+   */
+  RC readForward(IndexCursor& cursor, KeyT& key, RecordId& rid);
+
+  /**
+   * Find the last index entry with a key <= searchKey, for reading the
+   * index backward. If an entry with searchKey exists, set the cursor to
+   * the last such entry and return 0. If not, set the cursor to the
+   * entry immediately before the smallest key that is larger than
+   * searchKey (in the previous leaf if eid is -1) and return
+   * RC_NO_SUCH_RECORD.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor pointing to the index entry
+   * @return 0 if searchKey is found. Othewise, an error code
+   */
+  RC locateLast(const KeyT& searchKey, IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index cursor,
+   * and move the cursor back to the previous entry.
+   * Requires hasBackLinks().
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
    * @return error code. 0 if no error
    */
-  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+  RC readBackward(IndexCursor& cursor, KeyT& key, RecordId& rid);
+
+  /**
+   * Move the cursor forward (or backward) over count RecordIds without
+   * returning them, reading only index pages. A posting list counts once
+   * per RecordId in it.
+   * @param cursor[IN/OUT] the cursor to move
+   * @param count[IN] the number of RecordIds to skip
+   * @param skipped[OUT] the number of RecordIds skipped; less than count
+   *                     at the end of the index
+   * @param backward[IN] move as readBackward() does
+   * @return error code. 0 if no error
+   */
+  RC skip(IndexCursor& cursor, int count, int& skipped, bool backward = false);
+
+  /**
+   * @return the number of sorted runs in front of the tree
+   */
+  int getRunCount() const { return runCount; }
+
+  /**
+   * @return true if the leaves are linked backward as well, which is
+   *         the case for indexes created since the previous links exist
+   */
+  bool hasBackLinks() const { return backLinks; }
+
+  /**
+   * Walk the whole tree to report its shape and fill, and check its
+   * invariants: keys in order within and across nodes, keys between the
+   * separators of their parent, all leaves at the same depth, a leaf
+   * chain (next and previous pointers) that visits the leaves in key
+   * order, and well-formed posting lists.
+   * @param report[OUT] the report
+   * @return error code. 0 if no error (violations are in the report)
+   */
+  RC analyze(IndexReport& report);
+
+  /**
+   * Store leaf nodes written from now on in the compressed format.
+   * The setting is kept in the index header.
+   * @param compress[IN] true to compress leaf nodes
+   */
+  void setLeafCompression(bool compress);
+
+  /**
+   * Set the size of the nodes of a new (empty) index. A node spans
+   * size / PageFile::PAGE_SIZE consecutive pages of the index file;
+   * the size is kept in the index header.
+   * @param size[IN] the node size in bytes: a multiple of
+   *                 PageFile::PAGE_SIZE up to MAX_NODE_SIZE
+   * @return error code. 0 if no error
+   */
+  RC setNodeSize(int size);
+
+  /**
+   * Find leaves with a learned model of the leaf separators (see
+   * LeafModelT) instead of the in-memory copy of the non-leaf levels, in
+   * indexes opened from now on. The model is kept up to date through
+   * leaf splits, while the copy is dropped on every split.
+   * @param use[IN] true to use the model
+   */
+  static void setLeafModel(bool use) { leafModelDefault = use; }
+
+  /**
+   * @return the height of the tree (0 if the index is empty)
+   */
+  int getTreeHeight() const { return treeHeight; }
+
+  /**
+   * Return the statistics kept in the index header.
+   * @return the index statistics
+   */
+  const IndexStatsT<KeyT>& getStats() const { return stats; }
+
+  /**
+   * @return the operation counts since the object was constructed
+   */
+  IndexCounters getCounters() const;
 
-  void printTree();
+  /**
+   * Estimate the number of keys in [lowKey, highKey] from the
+   * equi-depth histogram.
+   * @param lowKey[IN] the smallest key in the range
+   * @param highKey[IN] the largest key in the range
+   * @return the estimated number of keys. -1 if no statistics are available
+   */
+  int estimateCount(const KeyT& lowKey, const KeyT& highKey) const;
   
  private:
+  /// page 0 layout: rootPid, treeHeight, STATS_MAGIC, IndexStatsT, options
+  /// (compressLeaves, nodePages, key type, backLinks, runCount)
+  static const int STATS_MAGIC = 0x42545331;
+
+  int nodeSize() const { return nodePages * PageFile::PAGE_SIZE; }
+
+  /**
+   * A run of more leaf entries with one key moves to a posting list: a
+   * run that would fill half a posting page, or half a leaf if that is
+   * less. Smaller runs take less room in the leaf than a posting page of
+   * their own, and a run of up to half a leaf stays in one leaf.
+   * @return the most leaf entries of one key
+   */
+  int inlineLimit() const
+  {
+    int postingHalf = BTPostingPage::CAPACITY / 2;
+    int leafHalf = BTLeafNodeT<KeyT>::capacity(nodeSize()) / 2;
+    return postingHalf < leafHalf ? postingHalf : leafHalf;
+  }
+
+  /**
+   * Add rid for the key of entry eid of leaf. If the key has a posting
+   * list, or the run of its entries grows beyond inlineLimit(),
+   * rid goes to the posting list and done is set; leafChanged is set if
+   * the run was replaced by a reference to a new posting list.
+   * Otherwise the caller inserts a leaf entry.
+   * @return error code. 0 if no error
+   */
+  RC insertDuplicate(BTLeafNodeT<KeyT>& leaf, int eid, const RecordId& rid, bool& done, bool& leafChanged);
+
+  /**
+   * Add rid to the posting list starting at head.
+   */
+  RC appendPosting(PageId head, const RecordId& rid);
+
+  /**
+   * Write rids, in the order of their inserts, to a new posting list.
+   * @param head[OUT] the PageId of its head page
+   */
+  RC writePostingList(const std::vector<RecordId>& rids, PageId& head);
+
+  /**
+   * Read the next RecordId of the posting list ref into rid and move
+   * cursor.ppid/pidx forward.
+   * @param done[OUT] true if rid was the last RecordId of the list
+   */
+  RC readPosting(IndexCursor& cursor, const RecordId& ref, RecordId& rid, bool& done);
+
+  /**
+   * @return the number of RecordIds in the posting list starting at head
+   */
+  int postingCount(PageId head);
+
+  RC readHeader();
+  RC writeHeader();
+
+  /// a buffered insert
+  struct Message {
+    KeyT     key;
+    RecordId rid;
+  };
+  static bool messageOrder(const Message& a, const Message& b) { return a.key < b.key; }
+
+  /// the page images of a batch kept in memory before they are written
+  static const size_t MAX_BATCH_BYTES = 8 * 1024 * 1024;
+
+  /**
+   * Insert (key, RecordId) pair into the tree, as insert() does without
+   * the insert buffer.
+   */
+  RC applyInsert(const KeyT& key, const RecordId& rid);
+
+  /**
+   * Read a node, or a posting page, on the insert path: from the page
+   * images of the batch being applied, if there, or else from pf.
+   */
+  template <class NodeT> RC readNode(NodeT& node, PageId pid);
+
+  /**
+   * Write a node, or a posting page, on the insert path: to the page
+   * images of the batch being applied, if any, or else to pf.
+   */
+  template <class NodeT> RC writeNode(NodeT& node, PageId pid);
+
+  /**
+   * @return the PageId behind the last page, including the pages of the
+   *         batch being applied
+   */
+  PageId endPid() const { return batchEnd > pf.endPid() ? batchEnd : pf.endPid(); }
+
+  /**
+   * Write the page images of the batch being applied to pf.
+   */
+  RC writeBatch();
+
+  /**
+   * Write the buffered inserts to a new sorted run.
+   */
+  RC writeRun();
+
+  /**
+   * Build the empty tree from the entries that cursor reads: the leaves
+   * are filled in key order and each node is written once. The entries
+   * of a key stay in one leaf, or go to a posting list if there are more
+   * than inlineLimit() of them.
+   * @param cursor[IN] a cursor over the runs and the buffered inserts
+   */
+  RC bulkBuild(IndexCursor& cursor);
+
+  /**
+   * @return the name of the file of sorted run i of the index file
+   */
+  static std::string runName(const std::string& indexname, int i);
+
+  /**
+   * Sort the buffered inserts for searching them, keeping equal keys in
+   * the order of their inserts.
+   */
+  void sortMessages();
+
+  /**
+   * @return true if the reads must merge the tree with sorted runs or
+   *         buffered inserts
+   */
+  bool readsMerge() const { return runCount > 0 || !messages.empty(); }
+
+  /**
+   * locate(), locateLast(), readForward() and readBackward() on the tree
+   * alone.
+   */
+  RC locateInTree(const KeyT& searchKey, IndexCursor& cursor);
+  RC locateInRuns(const KeyT& searchKey, IndexCursor& cursor, RC result);
+  RC locateLastInTree(const KeyT& searchKey, IndexCursor& cursor);
+  RC readForwardInTree(IndexCursor& cursor, KeyT& key, RecordId& rid);
+  RC readBackwardInTree(IndexCursor& cursor, KeyT& key, RecordId& rid);
+
+  /**
+   * Find the leaf where locateChildPtr() leads from the root, using the
+   * leaf model or the in-memory copy of the non-leaf levels if one is
+   * built. They are built once the descents without them have read as
+   * many nodes as building takes. The copy is dropped whenever a node
+   * splits; the model is updated when a leaf splits.
+   * @param searchKey[IN] the key to find
+   * @param last[IN] as for BTNonLeafNodeT::locateChildPtr()
+   * @param pid[OUT] the PageId of the leaf
+   * @return error code. 0 if no error
+   */
+  RC findLeaf(const KeyT& searchKey, bool last, PageId& pid);
+
+  /**
+   * findLeaf() with the leaf model or the in-memory copy of the non-leaf
+   * levels only, building them if due.
+   * @return true if pid is set
+   */
+  bool findLeafInMemory(const KeyT& searchKey, bool last, PageId& pid);
+
+  /// a descent of locateBatch()
+  struct Descent;
+
+  /**
+   * queue the read of the node at pid for a descent of locateBatch().
+   */
+  void readDescent(Descent& d, PageId pid, char* page);
+
+  /**
+   * the callback of the node reads of locateBatch().
+   */
+  static void descentRead(void* arg, PageId pid, RC rc);
+
+  /// the state of analyze() while it walks the tree
+  struct WalkState;
+
+  /**
+   * analyze the subtree at pid, whose keys must be in [low, high]
+   * (NULL: unbounded).
+   */
+  void analyzeNode(PageId pid, int depth, const KeyT* low, const KeyT* high, WalkState& state);
+
+  /**
+   * analyze the posting list that starts at head.
+   */
+  void analyzePosting(PageId head, WalkState& state);
+
+  /**
+   * Add a key to the key count, min/max and histogram.
+   */
+  void countKey(const KeyT& key);
+
+  /**
+   * Rebuild the equi-depth histogram by scanning the leaf level.
+   */
+  RC buildHistogram();
+
+  IndexStatsT<KeyT> stats; /// statistics stored in the header page
+  bool statsValid;     /// false for index files written without statistics
+  bool compressLeaves; /// write leaf nodes in the compressed format
+  int  nodePages;      /// the number of pages per node
+  bool backLinks;      /// the leaves have valid previous pointers
+  bool headerDirty;    /// the header page must be written on close()
+  IndexCounters counters; /// operation counts for profiling
+
+  BTLeafNodeT<KeyT> cursorLeaf; /// the leaf last read by readForward()
+  PageId cursorLeafPid;         /// its PageId; 0 if none
+  BTPostingPage cursorPosting;  /// the posting page last read by readForward()
+  PageId cursorPostingPid;      /// its PageId; 0 if none
+
+  InnerCacheT<KeyT> upper;  /// the non-leaf levels in memory
+  LeafModelT<KeyT>  model;  /// the leaf model, if useModel
+  bool useModel;            /// find leaves with model instead of upper
+  int upperDebt;            /// nodes read by descents without upper or model
+
+  std::vector<Message> messages;  /// the buffered inserts
+  int    insertBuffer;            /// the capacity of messages; 0: no buffer
+  bool   batching;                /// node writes go to batchPages
+  std::map<PageId, std::vector<char> > batchPages; /// the nodes written by the batch
+  size_t batchBytes;              /// the size of batchPages
+  PageId batchEnd;                /// the PageId behind the last page in batchPages
+  bool   messagesSorted;          /// messages is in key order
+
+  bool   insertRuns;              /// full buffers go to sorted runs
+  SortedRunT<KeyT> runs[MAX_INDEX_RUNS]; /// the sorted runs, from the oldest
+  int    runCount;                /// the number of sorted runs
+  std::string indexName;          /// the name of the index file
+
+  PageIO aio;                     /// the node reads of locateBatch()
+  char*  aioPages;                /// MAX_INTERLEAVE nodes, registered with aio
+
+  static bool leafModelDefault;  /// useModel of indexes opened from now on
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
@@ -102,4 +636,7 @@ class BTreeIndex {
   /// is opened again later.
 };
 
+typedef IndexStatsT<int> IndexStats;
+typedef BTreeIndexT<int>  BTreeIndex;
+
 #endif /* BTREEINDEX_H */
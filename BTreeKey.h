@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BTREEKEY_H
+#define BTREEKEY_H
+
+#include <cstring>
+#include <climits>
+#include <ostream>
+#include <stdint.h>
+
+/**
+ * StringKey: a fixed-width key holding a string value, padded with
+ * null characters. Values longer than LENGTH bytes are truncated to
+ * their prefix, so different values may map to the same key: a match
+ * on a StringKey must be re-checked against the full value.
+ * StringKeys are ordered like strcmp() orders their values.
+ */
+struct StringKey {
+  static const int LENGTH = 16;
+
+  char data[LENGTH];
+
+  StringKey() { memset(data, 0, LENGTH); }
+
+  /**
+   * @param value[IN] the (null-terminated) value to build the key from
+   */
+  StringKey(const char* value)
+  {
+    memset(data, 0, LENGTH);
+    memcpy(data, value, strnlen(value, LENGTH));
+  }
+
+  /**
+   * @param value[IN] the value to build the key from (not null-terminated)
+   * @param len[IN] the length of value
+   */
+  StringKey(const char* value, int len)
+  {
+    memset(data, 0, LENGTH);
+    memcpy(data, value, len < LENGTH ? len : LENGTH);
+  }
+};
+
+inline bool operator < (const StringKey& a, const StringKey& b)
+{ return memcmp(a.data, b.data, StringKey::LENGTH) < 0; }
+inline bool operator > (const StringKey& a, const StringKey& b) { return b < a; }
+inline bool operator <= (const StringKey& a, const StringKey& b) { return !(b < a); }
+inline bool operator >= (const StringKey& a, const StringKey& b) { return !(a < b); }
+inline bool operator == (const StringKey& a, const StringKey& b)
+{ return memcmp(a.data, b.data, StringKey::LENGTH) == 0; }
+inline bool operator != (const StringKey& a, const StringKey& b) { return !(a == b); }
+
+inline std::ostream& operator << (std::ostream& os, const StringKey& key)
+{
+  return os.write(key.data, strnlen(key.data, StringKey::LENGTH));
+}
+
+/**
+ * KeyTraits: what the B+tree needs to know about a key type besides
+ * its ordering.
+ *  TYPE_ID:      stored in the index header to detect a key type mismatch
+ *  minValue():   a key that is smaller than or equal to any other key
+ *  delta():      the difference key - base as an unsigned 32-bit number;
+ *                false if it does not fit (used by compressed leaves)
+ *  fromDelta():  the inverse of delta()
+ *  toDouble():   a monotonic mapping to double (used by estimates)
+ */
+template <class KeyT> struct KeyTraits;
+
+template <> struct KeyTraits<int> {
+  static const int TYPE_ID = 0;
+  static int minValue() { return INT_MIN; }
+  static bool delta(int key, int base, unsigned& d)
+  { d = (unsigned)key - (unsigned)base; return true; }
+  static int fromDelta(int base, unsigned d) { return (int)((unsigned)base + d); }
+  static double toDouble(int key) { return key; }
+};
+
+template <> struct KeyTraits<int64_t> {
+  static const int TYPE_ID = 1;
+  static int64_t minValue() { return (int64_t)(1ULL << 63); }
+  static bool delta(int64_t key, int64_t base, unsigned& d)
+  {
+    uint64_t diff = (uint64_t)key - (uint64_t)base;
+    d = (unsigned)diff;
+    return diff <= 0xffffffffULL;
+  }
+  static int64_t fromDelta(int64_t base, unsigned d) { return (int64_t)((uint64_t)base + d); }
+  static double toDouble(int64_t key) { return (double)key; }
+};
+
+template <> struct KeyTraits<StringKey> {
+  static const int TYPE_ID = 2;
+  static StringKey minValue() { return StringKey(); }
+  static bool delta(const StringKey&, const StringKey&, unsigned& d) { d = 0; return false; }
+  static StringKey fromDelta(const StringKey& base, unsigned) { return base; }
+  static double toDouble(const StringKey& key)
+  {
+    // the first 6 bytes as a big-endian number; exact in a double
+    double v = 0;
+    for (int i = 0; i < 6; i++) v = v * 256 + (unsigned char)key.data[i];
+    return v;
+  }
+};
+
+#endif /* BTREEKEY_H */
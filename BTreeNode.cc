@@ -1,53 +1,171 @@
 #include "BTreeNode.h"
 #include "PageFile.h"
 #include <cstring>
+#include <climits>
 #include <iostream>
+#include <vector>
 
 using namespace std;
 
+/*
+ * Layout of a compressed leaf page: a header (smallest key, smallest
+ * pid, the bit widths of the key/pid/sid deltas, one pad byte) followed
+ * by three bit-packed arrays of keyCount deltas each: keys, pids and
+ * sids. Each array starts at a byte boundary. All deltas are of fixed
+ * width, so entry i of an array is found at bit i * width.
+ */
+template <class KeyT>
+struct CompressedHeader {
+	static const int PID_OFFSET = sizeof(KeyT);
+	static const int BITS_OFFSET = sizeof(KeyT) + sizeof(PageId);
+	static const int SIZE = BITS_OFFSET + 4;
+};
+
+/*
+ * Read the nodeSize bytes of the node at pid into buf.
+ */
+static RC readPages(PageId pid, const PageFile& pf, char* buf, int nodeSize)
+{
+	RC rc;
+	for(int i = 0; i < nodeSize / PageFile::PAGE_SIZE; i++){
+		if((rc = pf.read(pid + i, buf + i * PageFile::PAGE_SIZE)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Write the nodeSize bytes in buf to the node at pid.
+ */
+static RC writePages(PageId pid, PageFile& pf, const char* buf, int nodeSize)
+{
+	RC rc;
+	for(int i = 0; i < nodeSize / PageFile::PAGE_SIZE; i++){
+		if((rc = pf.write(pid + i, buf + i * PageFile::PAGE_SIZE)) < 0)
+			return rc;
+	}
+	return 0;
+}
+
+//number of bits needed to store v
+static int bitsFor(unsigned v)
+{
+	int bits = 0;
+	while(v){
+		bits++;
+		v >>= 1;
+	}
+	return bits;
+}
+
+//bytes used by count values of the given width
+static int packedSize(int count, int bits)
+{
+	return (count * bits + 7) / 8;
+}
+
+//store value i of the given width at dst, which starts out zeroed
+static void packBits(unsigned char* dst, int i, int bits, unsigned value)
+{
+	unsigned long long v = value;
+	int bit = i * bits;
+	for(int b = bit / 8, shift = bit % 8; v != 0; b++){
+		dst[b] |= (unsigned char)(v << shift);
+		v >>= (8 - shift);
+		shift = 0;
+	}
+}
+
+//load value i of the given width from src
+static unsigned unpackBits(const unsigned char* src, int i, int bits)
+{
+	if(bits == 0)
+		return 0;
+	unsigned long long mask = (bits == 32) ? 0xffffffffULL : ((1ULL << bits) - 1);
+
+	//fixed-width fields: gather the (at most 5) bytes holding entry i
+	int bit = i * bits;
+	int nbytes = (bit % 8 + bits + 7) / 8;
+	unsigned long long word = 0;
+	for(int b = 0; b < nbytes; b++)
+		word |= (unsigned long long)src[bit / 8 + b] << (8 * b);
+	return (unsigned)((word >> (bit % 8)) & mask);
+}
+
 /*
  * Read the content of the node from the page pid in the PageFile pf.
  * @param pid[IN] the PageId to read
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::read(PageId pid, const PageFile& pf)
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::read(PageId pid, const PageFile& pf)
 {
-	int result = pf.read(pid, buffer);
-	int p;
+	std::vector<char> page(nodeSize);
+	int result = readPages(pid, pf, &page[0], nodeSize);
 	keyCount = 0;
 
-	if(!result){
-		/*
-		for(int i = 0; i < N; i++){
-			memcpy(&p, (void*)(buffer + i * 12), sizeof(p));
-			if(p == 0)
-				break;
-			else
-				keyCount++;
-		}*/
-		memcpy(&keyCount, (void*)(buffer + 1008), sizeof(keyCount));
-	}
+	if(!result)
+		fromPage(&page[0]);
 	return result;
 }
 
+template <class KeyT>
+void BTLeafNodeT<KeyT>::fromPage(const char* page)
+{
+	memcpy(&keyCount, (void*)(page + nodeSize - COUNT_OFFSET), sizeof(keyCount));
+	memcpy(&nextPid, (void*)(page + nodeSize - NEXT_OFFSET), sizeof(nextPid));
+	memcpy(&prevPid, (void*)(page + nodeSize - PREV_OFFSET), sizeof(prevPid));
+	compressed = (page[nodeSize - TYPE_OFFSET] == 'C');
+	if(compressed)
+		decode(page);
+	else
+		memcpy(buffer, (void*)page, keyCount * ENTRY_SIZE);
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::write(PageId pid, PageFile& pf)
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::write(PageId pid, PageFile& pf)
 { 
-	memcpy(buffer + 1008, (void*)&keyCount, sizeof(keyCount));
-	return pf.write(pid, buffer); 
+	std::vector<char> page(nodeSize);
+	RC rc = toPage(&page[0]);
+	if(rc < 0)
+		return rc;
+	return writePages(pid, pf, &page[0], nodeSize); 
+}
+
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::toPage(char* page)
+{
+	memset(page, 0, nodeSize);
+
+	if(compressed && encodedSize(KeyT(), NULL) <= nodeSize - NODE_TRAILER_SIZE){
+		encode(page);
+		page[nodeSize - TYPE_OFFSET] = 'C';
+	}
+	else{
+		if(keyCount > capacity(nodeSize))
+			return RC_NODE_FULL;
+		memcpy(page, (void*)buffer, keyCount * ENTRY_SIZE);
+		page[nodeSize - TYPE_OFFSET] = 'L';
+	}
+	memcpy(page + nodeSize - COUNT_OFFSET, (void*)&keyCount, sizeof(keyCount));
+	memcpy(page + nodeSize - NEXT_OFFSET, (void*)&nextPid, sizeof(nextPid));
+	memcpy(page + nodeSize - PREV_OFFSET, (void*)&prevPid, sizeof(prevPid));
+	return 0;
 }
 
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
-int BTLeafNode::getKeyCount()
+template <class KeyT>
+int BTLeafNodeT<KeyT>::getKeyCount()
 { 
 	return keyCount;
 }
@@ -58,31 +176,37 @@ int BTLeafNode::getKeyCount()
  * @param rid[IN] the RecordId to insert
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::insert(const KeyT& key, const RecordId& rid)
 { 
 	//if full, return error
-	if(keyCount == N - 1)
+	int plainCapacity = capacity(nodeSize);
+	if(compressed){
+		if(keyCount == COMPRESSION_FACTOR * plainCapacity ||
+		   (keyCount >= plainCapacity && encodedSize(key, &rid) > nodeSize - NODE_TRAILER_SIZE))
+			return RC_NODE_FULL;
+	}
+	else if(keyCount == plainCapacity)
 		return RC_NODE_FULL;
 
 	//find the spot to insert the new key
-	int compKey;
-	int i;
-	for(i = 0; i < keyCount; i++){
-		char* src = buffer + (i * 12);
-		memcpy(&compKey, (void*)(src + 8), sizeof(compKey));
-		if(key <= compKey){
-			//found the spot, shift the rest to the right
-			memmove(src + 12, (void*)src, (keyCount - i) * 12);
-			break;
-		}
-	}
+	int eid;
+	locate(key, eid);
+	insertEntry(eid, key, rid);
+	return 0; 
+}
 
-	//insert the new tuple
-	memcpy(buffer + (i * 12), (void*)&rid, sizeof(rid));
-	memcpy(buffer + (i * 12) + 8, (void*)&key, sizeof(key));
+template <class KeyT>
+void BTLeafNodeT<KeyT>::insertEntry(int eid, const KeyT& key, const RecordId& rid)
+{
+	//shift the rest to the right
+	char* src = buffer + (eid * ENTRY_SIZE);
+	memmove(src + ENTRY_SIZE, (void*)src, (keyCount - eid) * ENTRY_SIZE);
 
+	//insert the new tuple
+	memcpy(src, (void*)&rid, sizeof(rid));
+	memcpy(src + sizeof(RecordId), (void*)&key, sizeof(key));
 	keyCount++;
-	return 0; 
 }
 
 /*
@@ -95,41 +219,69 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param siblingKey[OUT] the first key in the sibling node after split.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
-                              BTLeafNode& sibling, int& siblingKey)
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::insertAndSplit(const KeyT& key, const RecordId& rid, 
+                                     BTLeafNodeT& sibling, KeyT& siblingKey)
 { 
-	//first, insert into this node
-	RC result = this->insert(key, rid);
-	int halfKeyCount = keyCount/2;
-	int cut = halfKeyCount;
-	char whichNode;
-	if(halfKeyCount%2 == 1){
-		int comparator;
-		memcpy(&comparator, (void*)(buffer + (12 * halfKeyCount) + 8), sizeof(comparator));
-		if(comparator < key){
-			cut = halfKeyCount + 1;
-			whichNode = 'R';
+	//add the new key where it belongs in key order
+	int eid;
+	locate(key, eid);
+	insertEntry(eid, key, rid);
+	return split(sibling, siblingKey);
+}
+
+/*
+ * Split the node half and half with sibling.
+ * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+ * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::split(BTLeafNodeT& sibling, KeyT& siblingKey)
+{
+	if(keyCount < 2)
+		return RC_INVALID_CURSOR;
+
+	//cut in the middle, moved to the nearest boundary between two runs
+	//of equal keys so that all entries of a key stay in one node. A half
+	//of a compressed node may be too wide to compress and too long for
+	//the plain format, so cuts are tried outward from the middle until
+	//both halves fit: first the run boundaries, then any cut.
+	int half = keyCount / 2;
+	bool moved = false;
+	for(int pass = 0; pass < 2 && !moved; pass++){
+		for(int d = 0; d < keyCount && !moved; d++){
+			int cut = half - d;
+			if(cut > 0 && (pass == 1 || keyAt(cut - 1) != keyAt(cut)))
+				moved = splitAt(cut, sibling);
+			cut = half + d + 1;
+			if(!moved && cut < keyCount && (pass == 1 || keyAt(cut - 1) != keyAt(cut)))
+				moved = splitAt(cut, sibling);
 		}
-		else
-			whichNode = 'L';
 	}
+	if(!moved)
+		return RC_NODE_FULL;
 
-	//move the right half of the node to sibling	
-	memcpy(sibling.buffer, (void*)(buffer + (cut * 12)), (keyCount - cut) * 12);
-	sibling.keyCount = keyCount - cut;
-	keyCount = cut;	
-
-	if(result == RC_NODE_FULL){
-		//determine which node new key goes into
-		if(whichNode == 'L')
-			this->insert(key, rid);
-		else
-			sibling.insert(key, rid);
-	}
-	memcpy(&siblingKey, (void*)(sibling.buffer + 8), sizeof(siblingKey));
+	memcpy(&siblingKey, (void*)(sibling.buffer + sizeof(RecordId)), sizeof(siblingKey));
 	return 0;
+}
 
-	//TODO: error? pid of sibling?
+template <class KeyT>
+bool BTLeafNodeT<KeyT>::splitAt(int cut, BTLeafNodeT& sibling)
+{
+	//move the right part of the node to sibling
+	memcpy(sibling.buffer, (void*)(buffer + (cut * ENTRY_SIZE)), (keyCount - cut) * ENTRY_SIZE);
+	sibling.keyCount = keyCount - cut;
+	sibling.compressed = compressed;
+	int count = keyCount;
+	keyCount = cut;
+	if(fits() && sibling.fits())
+		return true;
+
+	//the entries are still in the buffer
+	keyCount = count;
+	sibling.keyCount = 0;
+	return false;
 }
 
 /**
@@ -143,25 +295,26 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                    behind the largest key smaller than searchKey.
  * @return 0 if searchKey is found. Otherwise return an error code.
  */
-RC BTLeafNode::locate(int searchKey, int& eid){ 
-    int comparator;
-    //traverse each search key to find match
-    for(int i = 0; i < keyCount; i++){
-        char* src = buffer + (i * 12);
-        memcpy(&comparator, (void*)(src + 8), sizeof(comparator));
-        //cout << comparator << " ";
-        if(comparator == searchKey){
-            eid = i;
-            return 0;
-        }
-        else if(comparator < searchKey)
-            eid = i+1;
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::locate(const KeyT& searchKey, int& eid){ 
+    KeyT comparator;
+    //binary search for the first key >= searchKey
+    int lo = 0, hi = keyCount;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        memcpy(&comparator, (void*)(buffer + mid * ENTRY_SIZE + sizeof(RecordId)), sizeof(comparator));
+        if(comparator < searchKey)
+            lo = mid + 1;
         else
-            break;
+            hi = mid;
+    }
+    eid = lo;
+    if(eid < keyCount){
+        memcpy(&comparator, (void*)(buffer + eid * ENTRY_SIZE + sizeof(RecordId)), sizeof(comparator));
+        if(comparator == searchKey)
+            return 0;
     }
     return RC_NO_SUCH_RECORD;
-
-    //TODO: check if eid is N
 }
 
 /*
@@ -171,22 +324,62 @@ RC BTLeafNode::locate(int searchKey, int& eid){
  * @param rid[OUT] the RecordId from the entry
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid){
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::readEntry(int eid, KeyT& key, RecordId& rid){
     if(eid < 0 || eid > keyCount-1)
         return RC_INVALID_CURSOR; 
-    memcpy(&key, (void*)(buffer + (eid * 12) + 8), sizeof(key));
-    memcpy(&rid, (void*)(buffer + (eid * 12)), sizeof(RecordId));
+    memcpy(&key, (void*)(buffer + (eid * ENTRY_SIZE) + sizeof(RecordId)), sizeof(key));
+    memcpy(&rid, (void*)(buffer + (eid * ENTRY_SIZE)), sizeof(RecordId));
     return 0; 
 }
 
+/*
+ * Replace the count entries starting at eid, which all hold the same
+ * key, by a single entry with that key and rid.
+ * @param eid[IN] the first entry to replace
+ * @param count[IN] the number of entries to replace
+ * @param rid[IN] the RecordId of the new entry
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::replaceRun(int eid, int count, const RecordId& rid){
+    if(eid < 0 || count < 1 || eid + count > keyCount)
+        return RC_INVALID_CURSOR;
+    char* dst = buffer + (eid * ENTRY_SIZE);
+    memcpy(dst, (void*)&rid, sizeof(rid));
+    memmove(dst + ENTRY_SIZE, (void*)(dst + count * ENTRY_SIZE), (keyCount - eid - count) * ENTRY_SIZE);
+    keyCount -= count - 1;
+    return 0;
+}
+
+template <class KeyT>
+int BTLeafNodeT<KeyT>::getStoredSize(){
+	if(compressed && encodedSize(KeyT(), NULL) <= nodeSize - NODE_TRAILER_SIZE)
+		return encodedSize(KeyT(), NULL);
+	return keyCount * ENTRY_SIZE;
+}
+
+template <class KeyT>
+bool BTLeafNodeT<KeyT>::fits(){
+	if(keyCount <= capacity(nodeSize))
+		return true;
+	return compressed && encodedSize(KeyT(), NULL) <= nodeSize - NODE_TRAILER_SIZE;
+}
+
+template <class KeyT>
+KeyT BTLeafNodeT<KeyT>::keyAt(int eid){
+    KeyT key;
+    memcpy(&key, (void*)(buffer + (eid * ENTRY_SIZE) + sizeof(RecordId)), sizeof(key));
+    return key;
+}
+
 /*
  * Return the pid of the next slibling node.
  * @return the PageId of the next sibling node 
  */
-PageId BTLeafNode::getNextNodePtr(){ 
-    int pageId;
-    memcpy(&pageId, (void*)(buffer + 1016), sizeof(pageId));
-    return pageId; 
+template <class KeyT>
+PageId BTLeafNodeT<KeyT>::getNextNodePtr(){ 
+    return nextPid; 
 }
 
 /*
@@ -194,36 +387,216 @@ PageId BTLeafNode::getNextNodePtr(){
  * @param pid[IN] the PageId of the next sibling node 
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::setNextNodePtr(PageId pid){
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::setNextNodePtr(PageId pid){
     if(pid < 0)
         return RC_INVALID_PID; 
-    memcpy(buffer + 1016, &pid, sizeof(pid));
+    nextPid = pid;
     return 0;
 }
 
+/*
+ * Return the pid of the previous slibling node.
+ * @return the PageId of the previous sibling node; 0 if none
+ */
+template <class KeyT>
+PageId BTLeafNodeT<KeyT>::getPrevNodePtr(){ 
+    return prevPid; 
+}
+
+/*
+ * Set the pid of the previous slibling node.
+ * @param pid[IN] the PageId of the previous sibling node 
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class KeyT>
+RC BTLeafNodeT<KeyT>::setPrevNodePtr(PageId pid){
+    if(pid < 0)
+        return RC_INVALID_PID; 
+    prevPid = pid;
+    return 0;
+}
+
+template <class KeyT>
+void BTLeafNodeT<KeyT>::setCompressed(bool compressed){
+	this->compressed = compressed;
+}
+
+/*
+ * Compute the compressed size of the entries (and of (key, rid) if given).
+ */
+template <class KeyT>
+int BTLeafNodeT<KeyT>::encodedSize(const KeyT& key, const RecordId* rid){
+	if(keyCount == 0 && rid == NULL)
+		return CompressedHeader<KeyT>::SIZE;
+
+	KeyT minKey, maxKey, k;
+	PageId minPid = 0, maxPid = 0;
+	unsigned maxSid = 0;
+	RecordId r;
+	r.pid = r.sid = 0;
+	if(rid != NULL){
+		minKey = maxKey = key;
+		minPid = maxPid = rid->pid;
+		maxSid = rid->sid;
+	}
+	else{
+		readEntry(0, minKey, r);
+		maxKey = minKey;
+		minPid = maxPid = r.pid;
+	}
+
+	for(int i = 0; i < keyCount; i++){
+		readEntry(i, k, r);
+		if(k < minKey) minKey = k;
+		if(maxKey < k) maxKey = k;
+		if(r.pid < minPid) minPid = r.pid;
+		if(r.pid > maxPid) maxPid = r.pid;
+		if((unsigned)r.sid > maxSid) maxSid = r.sid;
+	}
+
+	unsigned keyRange;
+	if(!KeyTraits<KeyT>::delta(maxKey, minKey, keyRange))
+		return INT_MAX;
+
+	int count = keyCount + (rid != NULL ? 1 : 0);
+	return CompressedHeader<KeyT>::SIZE +
+	       packedSize(count, bitsFor(keyRange)) +
+	       packedSize(count, bitsFor((unsigned)maxPid - (unsigned)minPid)) +
+	       packedSize(count, bitsFor(maxSid));
+}
+
+/*
+ * Write the entries into page in the compressed format.
+ * The caller has checked that they fit.
+ */
+template <class KeyT>
+void BTLeafNodeT<KeyT>::encode(char* page){
+	KeyT minKey = KeyT(), k;
+	PageId minPid = 0;
+	unsigned delta, maxKey = 0, maxPid = 0, maxSid = 0;
+	RecordId r;
+
+	//the keys are sorted, so the first one is the smallest
+	if(keyCount > 0){
+		readEntry(0, minKey, r);
+		minPid = r.pid;
+	}
+	for(int i = 0; i < keyCount; i++){
+		readEntry(i, k, r);
+		if(r.pid < minPid) minPid = r.pid;
+	}
+	for(int i = 0; i < keyCount; i++){
+		readEntry(i, k, r);
+		KeyTraits<KeyT>::delta(k, minKey, delta);
+		if(delta > maxKey) maxKey = delta;
+		if((unsigned)r.pid - (unsigned)minPid > maxPid) maxPid = (unsigned)r.pid - (unsigned)minPid;
+		if((unsigned)r.sid > maxSid) maxSid = r.sid;
+	}
+
+	unsigned char* p = (unsigned char*)page;
+	unsigned char* bits = p + CompressedHeader<KeyT>::BITS_OFFSET;
+	bits[0] = bitsFor(maxKey);
+	bits[1] = bitsFor(maxPid);
+	bits[2] = bitsFor(maxSid);
+	memcpy(p, (void*)&minKey, sizeof(minKey));
+	memcpy(p + CompressedHeader<KeyT>::PID_OFFSET, (void*)&minPid, sizeof(minPid));
+
+	//the page is zeroed, so only the bits set are written
+	unsigned char* keys = p + CompressedHeader<KeyT>::SIZE;
+	unsigned char* pids = keys + packedSize(keyCount, bits[0]);
+	unsigned char* sids = pids + packedSize(keyCount, bits[1]);
+	for(int i = 0; i < keyCount; i++){
+		readEntry(i, k, r);
+		KeyTraits<KeyT>::delta(k, minKey, delta);
+		packBits(keys, i, bits[0], delta);
+		packBits(pids, i, bits[1], (unsigned)r.pid - (unsigned)minPid);
+		packBits(sids, i, bits[2], (unsigned)r.sid);
+	}
+}
+
+/*
+ * Load the entries from a compressed page. keyCount must be set.
+ */
+template <class KeyT>
+void BTLeafNodeT<KeyT>::decode(const char* page){
+	KeyT minKey;
+	PageId minPid;
+	const unsigned char* p = (const unsigned char*)page;
+	const unsigned char* bits = p + CompressedHeader<KeyT>::BITS_OFFSET;
+	int keyBits = bits[0], pidBits = bits[1], sidBits = bits[2];
+
+	memcpy(&minKey, (void*)p, sizeof(minKey));
+	memcpy(&minPid, (void*)(p + CompressedHeader<KeyT>::PID_OFFSET), sizeof(minPid));
+
+	const unsigned char* keys = p + CompressedHeader<KeyT>::SIZE;
+	const unsigned char* pids = keys + packedSize(keyCount, keyBits);
+	const unsigned char* sids = pids + packedSize(keyCount, pidBits);
+	for(int i = 0; i < keyCount; i++){
+		char* dst = buffer + (i * ENTRY_SIZE);
+		KeyT key = KeyTraits<KeyT>::fromDelta(minKey, unpackBits(keys, i, keyBits));
+		RecordId rid;
+		rid.pid = (PageId)((unsigned)minPid + unpackBits(pids, i, pidBits));
+		rid.sid = (int)unpackBits(sids, i, sidBits);
+		memcpy(dst, (void*)&rid, sizeof(rid));
+		memcpy(dst + sizeof(RecordId), (void*)&key, sizeof(key));
+	}
+}
+
 //constructor
-BTLeafNode::BTLeafNode(){
+template <class KeyT>
+BTLeafNodeT<KeyT>::BTLeafNodeT(int nodeSize){
 	keyCount = 0;
-	memset(buffer, 0, 1024);
-	buffer[1015] = 'L';
+	nextPid = 0;
+	prevPid = 0;
+	compressed = false;
+	this->nodeSize = nodeSize;
+	buffer = new char[bufferSize(nodeSize)];
 }
 
-//print content of the node
-void BTLeafNode::printNode(){
-	int key;
-	for(int i = 0; i < 3*keyCount; i++){
-		memcpy(&key, (void*)(buffer + 4*i), 4);
-		cout << key << " ";
-		if((i%3) == 2)
-			cout << "| ";
+template <class KeyT>
+BTLeafNodeT<KeyT>::BTLeafNodeT(const BTLeafNodeT& node){
+	keyCount = node.keyCount;
+	nextPid = node.nextPid;
+	prevPid = node.prevPid;
+	compressed = node.compressed;
+	nodeSize = node.nodeSize;
+	buffer = new char[bufferSize(nodeSize)];
+	memcpy(buffer, (void*)node.buffer, keyCount * ENTRY_SIZE);
+}
+
+template <class KeyT>
+BTLeafNodeT<KeyT>& BTLeafNodeT<KeyT>::operator=(const BTLeafNodeT& node){
+	if(this == &node)
+		return *this;
+	if(nodeSize != node.nodeSize){
+		delete[] buffer;
+		buffer = new char[bufferSize(node.nodeSize)];
 	}
-	cout << endl;
+	keyCount = node.keyCount;
+	nextPid = node.nextPid;
+	prevPid = node.prevPid;
+	compressed = node.compressed;
+	nodeSize = node.nodeSize;
+	memcpy(buffer, (void*)node.buffer, keyCount * ENTRY_SIZE);
+	return *this;
 }
 
-char BTLeafNode::getBufferChar(int index){
-	if(index < 0 || index > 1023)
-		return 'E';
-	return buffer[index];
+template <class KeyT>
+BTLeafNodeT<KeyT>::~BTLeafNodeT(){
+	delete[] buffer;
+}
+
+//print content of the node
+template <class KeyT>
+void BTLeafNodeT<KeyT>::printNode(){
+	KeyT key;
+	RecordId rid;
+	for(int i = 0; i < keyCount; i++){
+		readEntry(i, key, rid);
+		cout << rid.pid << " " << rid.sid << " " << key << " | ";
+	}
+	cout << endl;
 }
 
 
@@ -236,26 +609,23 @@ char BTLeafNode::getBufferChar(int index){
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::read(PageId pid, const PageFile& pf)
 { 
-	int result = pf.read(pid, buffer);
-	int p;
+	int result = readPages(pid, pf, buffer, nodeSize);
 	keyCount = 0;
 	
-	if(!result){
-		/*
-		for(int i = 0; i < N; i++){
-			memcpy(&p, (void*)(buffer + i * 12), sizeof(p));
-			if(p == 0)
-				break;
-			else
-				keyCount++;
-		}
-		*/
-		memcpy(&keyCount, (void*)(buffer + 1008), sizeof(keyCount));
-	}
+	if(!result)
+		memcpy(&keyCount, (void*)(buffer + nodeSize - COUNT_OFFSET), sizeof(keyCount));
 	return result;
 }
+
+template <class KeyT>
+void BTNonLeafNodeT<KeyT>::fromPage(const char* page)
+{
+	memcpy(buffer, (void*)page, nodeSize);
+	memcpy(&keyCount, (void*)(buffer + nodeSize - COUNT_OFFSET), sizeof(keyCount));
+}
     
 /*
  * Write the content of the node to the page pid in the PageFile pf.
@@ -263,17 +633,27 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::write(PageId pid, PageFile& pf)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::write(PageId pid, PageFile& pf)
 { 
-	memcpy(buffer + 1008, (void*)&keyCount, sizeof(keyCount));
-	return pf.write(pid, buffer);
+	memcpy(buffer + nodeSize - COUNT_OFFSET, (void*)&keyCount, sizeof(keyCount));
+	return writePages(pid, pf, buffer, nodeSize);
+}
+
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::toPage(char* page)
+{
+	memcpy(buffer + nodeSize - COUNT_OFFSET, (void*)&keyCount, sizeof(keyCount));
+	memcpy(page, (void*)buffer, nodeSize);
+	return 0;
 }
 
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
-int BTNonLeafNode::getKeyCount()
+template <class KeyT>
+int BTNonLeafNodeT<KeyT>::getKeyCount()
 { 
 	return keyCount; 
 }
@@ -285,30 +665,29 @@ int BTNonLeafNode::getKeyCount()
  * @param pid[IN] the PageId to insert
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, const RecordId& rid)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::insert(const KeyT& key, const RecordId& rid)
 { 
-	//TODO: pointers probably not right. Check!
-
 	//if full, return error
-	if(keyCount == N - 1)
+	if(keyCount == capacity(nodeSize))
 		return RC_NODE_FULL;
 
 	//find the spot to insert the new key
-	int compKey;
+	KeyT compKey;
 	int i;
 	for(i = 0; i < keyCount; i++){
-		char* src = buffer + (i * 12);
-		memcpy(&compKey, (void*)(src + 8), sizeof(compKey));
+		char* src = buffer + (i * ENTRY_SIZE);
+		memcpy(&compKey, (void*)(src + sizeof(RecordId)), sizeof(compKey));
 		if(key <= compKey){
-			//found the spot, shift the rest to the right
-			memmove(src + 20, (void*)(src + 8), (keyCount - i) * 12);
+			//found the spot, shift the rest (keys and their right pointers) to the right
+			memmove(src + ENTRY_SIZE + sizeof(RecordId), (void*)(src + sizeof(RecordId)), (keyCount - i) * ENTRY_SIZE);
 			break;
 		}
 	}
 
-	//insert the new tuple
-	memcpy(buffer + (i * 12) + 12, (void*)&rid, sizeof(rid));
-	memcpy(buffer + (i * 12) + 8, (void*)&key, sizeof(key));
+	//insert the new key and the pointer to its right
+	memcpy(buffer + (i * ENTRY_SIZE) + ENTRY_SIZE, (void*)&rid, sizeof(rid));
+	memcpy(buffer + (i * ENTRY_SIZE) + sizeof(RecordId), (void*)&key, sizeof(key));
 
 	keyCount++;
 	return 0; 
@@ -324,17 +703,18 @@ RC BTNonLeafNode::insert(int key, const RecordId& rid)
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, const RecordId& rid, BTNonLeafNode& sibling, int& midKey)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::insertAndSplit(const KeyT& key, const RecordId& rid, BTNonLeafNodeT& sibling, KeyT& midKey)
 { 
 	//first, insert into this node
 	RC result = this->insert(key, rid);
 	int halfKeyCount = keyCount/2 + 1;
 
 	//move the right half of the node to sibling	
-	memcpy(sibling.buffer, (void*)(buffer + (halfKeyCount * 12)), (keyCount - halfKeyCount) * 12 + 8);
+	memcpy(sibling.buffer, (void*)(buffer + (halfKeyCount * ENTRY_SIZE)), (keyCount - halfKeyCount) * ENTRY_SIZE + sizeof(RecordId));
 	sibling.keyCount = keyCount - halfKeyCount;
 	keyCount = halfKeyCount - 1;
-	memcpy(&midKey, (void*)(buffer + ((halfKeyCount - 1)* 12) + 8), sizeof(midKey));
+	memcpy(&midKey, (void*)(buffer + ((halfKeyCount - 1) * ENTRY_SIZE) + sizeof(RecordId)), sizeof(midKey));
 
 	if(result == RC_NODE_FULL){
 		//determine which node new key goes into
@@ -344,7 +724,6 @@ RC BTNonLeafNode::insertAndSplit(int key, const RecordId& rid, BTNonLeafNode& si
 			sibling.insert(key, rid);
 	}
 	return 0;
-	//TODO: error? pid of sibling?
 }
 
 /*
@@ -354,36 +733,28 @@ RC BTNonLeafNode::insertAndSplit(int key, const RecordId& rid, BTNonLeafNode& si
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::locateChildPtr(int searchKey, RecordId& rid)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::locateChildPtr(const KeyT& searchKey, RecordId& rid, bool last)
 { 
-	int comparator;
-    //traverse each search key to find match
-    //check the first key
-    memcpy(&comparator, (void*)(buffer + 8), sizeof(comparator));
-    if(searchKey < comparator){
-    	memcpy(&rid.pid, (void*)buffer, sizeof(rid.pid));
-        return 0;
-    }
-
-    //check last key
-    memcpy(&comparator, (void*)(buffer + (keyCount - 1) * 12 + 8), sizeof(comparator));
-	if(searchKey >= comparator){
-    	memcpy(&rid.pid, (void*)(buffer + (keyCount) * 12), sizeof(rid.pid));
-        return 0;
-    }
-
-    //check the rest in the middle
-    int comparator2;
-    for(int i = 0; i < keyCount - 1; i++){
-        char* src = buffer + (i * 12);
-        memcpy(&comparator, (void*)(src + 8), sizeof(comparator));
-        memcpy(&comparator2, (void*)(src + 20), sizeof(comparator2));
-        if(comparator <= searchKey && searchKey < comparator2){
-            memcpy(&rid.pid, (void*)(src + 12), sizeof(rid.pid));
-            return 0;
-        }
-    }
-    return RC_INVALID_CURSOR;
+	if(keyCount <= 0)
+		return RC_INVALID_CURSOR;
+
+	//binary search for the first key >= searchKey (> searchKey if last);
+	//its left pointer is the child. copies of a key equal to a separator
+	//may be on both sides of it in older trees, so the search for the
+	//first of them goes left.
+	KeyT comparator;
+	int lo = 0, hi = keyCount;
+	while(lo < hi){
+		int mid = (lo + hi) / 2;
+		memcpy(&comparator, (void*)(buffer + mid * ENTRY_SIZE + sizeof(RecordId)), sizeof(comparator));
+		if(comparator < searchKey || (last && comparator == searchKey))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	memcpy(&rid.pid, (void*)(buffer + lo * ENTRY_SIZE), sizeof(rid.pid));
+	return 0;
 }
 
 /*
@@ -393,38 +764,173 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, RecordId& rid)
  * @param pid2[IN] the PageId to insert behind the key
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(RecordId rid1, int key, RecordId rid2)
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::initializeRoot(RecordId rid1, const KeyT& key, RecordId rid2)
 { 
 	memcpy(buffer, (void*)&rid1.pid, sizeof(rid1.pid));
-	memcpy(buffer + 8, (void*)&key, sizeof(key));
-	memcpy(buffer + 12, (void*)&rid2.pid, sizeof(rid2.pid));
+	memcpy(buffer + sizeof(RecordId), (void*)&key, sizeof(key));
+	memcpy(buffer + ENTRY_SIZE, (void*)&rid2.pid, sizeof(rid2.pid));
 	keyCount = 1;
 	return 0;
+}
+
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::readChildPtr(int eid, PageId& pid)
+{
+	if(eid < 0 || eid > keyCount)
+		return RC_INVALID_CURSOR;
+	memcpy(&pid, (void*)(buffer + eid * ENTRY_SIZE), sizeof(pid));
+	return 0;
+}
 
-	//TODO: error?
+template <class KeyT>
+RC BTNonLeafNodeT<KeyT>::readKey(int eid, KeyT& key)
+{
+	if(eid < 0 || eid >= keyCount)
+		return RC_INVALID_CURSOR;
+	memcpy(&key, (void*)(buffer + eid * ENTRY_SIZE + sizeof(RecordId)), sizeof(key));
+	return 0;
 }
 
 //print content of the node
-void BTNonLeafNode::printNode(){
-	int key;
-	for(int i = 0; i < 3*keyCount + 1; i++){
-		memcpy(&key, (void*)(buffer + 4*i), 4);
-		cout << key << " ";
-		if((i%3) == 2)
-			cout << "| ";
+template <class KeyT>
+void BTNonLeafNodeT<KeyT>::printNode(){
+	KeyT key;
+	PageId pid;
+	for(int i = 0; i < keyCount; i++){
+		memcpy(&pid, (void*)(buffer + i * ENTRY_SIZE), sizeof(pid));
+		memcpy(&key, (void*)(buffer + i * ENTRY_SIZE + sizeof(RecordId)), sizeof(key));
+		cout << pid << " | " << key << " | ";
 	}
-	cout << endl;
+	memcpy(&pid, (void*)(buffer + keyCount * ENTRY_SIZE), sizeof(pid));
+	cout << pid << endl;
 }
 
 //constructor
-BTNonLeafNode::BTNonLeafNode(){
+template <class KeyT>
+BTNonLeafNodeT<KeyT>::BTNonLeafNodeT(int nodeSize){
 	keyCount = 0;
-	memset(buffer, 0, 1024);
-	buffer[1015] = 'N';
+	this->nodeSize = nodeSize;
+	buffer = new char[nodeSize];
+	memset(buffer, 0, nodeSize);
+	buffer[nodeSize - TYPE_OFFSET] = 'N';
+}
+
+template <class KeyT>
+BTNonLeafNodeT<KeyT>::BTNonLeafNodeT(const BTNonLeafNodeT& node){
+	keyCount = node.keyCount;
+	nodeSize = node.nodeSize;
+	buffer = new char[nodeSize];
+	memcpy(buffer, (void*)node.buffer, nodeSize);
+}
+
+template <class KeyT>
+BTNonLeafNodeT<KeyT>& BTNonLeafNodeT<KeyT>::operator=(const BTNonLeafNodeT& node){
+	if(this == &node)
+		return *this;
+	if(nodeSize != node.nodeSize){
+		delete[] buffer;
+		buffer = new char[node.nodeSize];
+	}
+	keyCount = node.keyCount;
+	nodeSize = node.nodeSize;
+	memcpy(buffer, (void*)node.buffer, nodeSize);
+	return *this;
+}
+
+template <class KeyT>
+BTNonLeafNodeT<KeyT>::~BTNonLeafNodeT(){
+	delete[] buffer;
+}
+
+template <class KeyT>
+bool BTNonLeafNodeT<KeyT>::isLeaf(){
+	char type = buffer[nodeSize - TYPE_OFFSET];
+	return type == 'L' || type == 'C';
+}
+
+
+/*-------------------------POSTING PAGE--------------------------------*/
+
+
+BTPostingPage::BTPostingPage(){
+	clear();
 }
 
-char BTNonLeafNode::getBufferChar(int index){
-	if(index < 0 || index > 1023)
-		return 'E';
-	return buffer[index];
+void BTPostingPage::clear(){
+	count = 0;
+	nextPid = 0;
+	memset(buffer, 0, PageFile::PAGE_SIZE);
+	buffer[PageFile::PAGE_SIZE - TYPE_OFFSET] = 'P';
 }
+
+RC BTPostingPage::read(PageId pid, const PageFile& pf){
+	int result = pf.read(pid, buffer);
+	count = 0;
+	if(!result){
+		memcpy(&count, (void*)(buffer + PageFile::PAGE_SIZE - COUNT_OFFSET), sizeof(count));
+		memcpy(&nextPid, (void*)(buffer + PageFile::PAGE_SIZE - NEXT_OFFSET), sizeof(nextPid));
+	}
+	return result;
+}
+
+RC BTPostingPage::write(PageId pid, PageFile& pf){
+	memcpy(buffer + PageFile::PAGE_SIZE - COUNT_OFFSET, (void*)&count, sizeof(count));
+	memcpy(buffer + PageFile::PAGE_SIZE - NEXT_OFFSET, (void*)&nextPid, sizeof(nextPid));
+	return pf.write(pid, buffer);
+}
+
+void BTPostingPage::fromPage(const char* page){
+	memcpy(buffer, (void*)page, PageFile::PAGE_SIZE);
+	memcpy(&count, (void*)(buffer + PageFile::PAGE_SIZE - COUNT_OFFSET), sizeof(count));
+	memcpy(&nextPid, (void*)(buffer + PageFile::PAGE_SIZE - NEXT_OFFSET), sizeof(nextPid));
+}
+
+RC BTPostingPage::toPage(char* page){
+	memcpy(buffer + PageFile::PAGE_SIZE - COUNT_OFFSET, (void*)&count, sizeof(count));
+	memcpy(buffer + PageFile::PAGE_SIZE - NEXT_OFFSET, (void*)&nextPid, sizeof(nextPid));
+	memcpy(page, (void*)buffer, PageFile::PAGE_SIZE);
+	return 0;
+}
+
+RC BTPostingPage::insert(const RecordId& rid){
+	if(count == CAPACITY)
+		return RC_NODE_FULL;
+	memcpy(buffer + count * sizeof(RecordId), (void*)&rid, sizeof(rid));
+	count++;
+	return 0;
+}
+
+RC BTPostingPage::readEntry(int eid, RecordId& rid){
+	if(eid < 0 || eid >= count)
+		return RC_INVALID_CURSOR;
+	memcpy(&rid, (void*)(buffer + eid * sizeof(RecordId)), sizeof(rid));
+	return 0;
+}
+
+int BTPostingPage::getCount(){
+	return count;
+}
+
+bool BTPostingPage::isPostingPage(){
+	return buffer[PageFile::PAGE_SIZE - TYPE_OFFSET] == 'P';
+}
+
+PageId BTPostingPage::getNextPagePtr(){
+	return nextPid;
+}
+
+RC BTPostingPage::setNextPagePtr(PageId pid){
+	if(pid < 0)
+		return RC_INVALID_PID;
+	nextPid = pid;
+	return 0;
+}
+
+//the key types an index can be built on
+template class BTLeafNodeT<int>;
+template class BTLeafNodeT<int64_t>;
+template class BTLeafNodeT<StringKey>;
+template class BTNonLeafNodeT<int>;
+template class BTNonLeafNodeT<int64_t>;
+template class BTNonLeafNodeT<StringKey>;
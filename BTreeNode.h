@@ -12,17 +12,65 @@
 
 #include "RecordFile.h"
 #include "PageFile.h"
+#include "BTreeKey.h"
 
-const int N = 81;
-const int MIN_PTRS = 41;
 const int OVF = 1;
 
+/*
+ * A node spans one or more consecutive pages of the PageFile; the
+ * number of pages per node is chosen per index and kept in its header.
+ * Every node ends with a trailer of NODE_TRAILER_SIZE bytes, at these
+ * offsets from the end of the node:
+ *   COUNT_OFFSET: the number of keys in the node
+ *   TYPE_OFFSET:  the node type ('L'/'C': leaf, 'N': non-leaf,
+ *                 'P': posting page)
+ *   NEXT_OFFSET:  the PageId of the next sibling (leaf nodes only)
+ *   PREV_OFFSET:  the PageId of the previous sibling (leaf nodes only)
+ * All node capacities below are derived from the node size.
+ */
+const int MAX_NODE_PAGES = 16;
+const int MAX_NODE_SIZE = MAX_NODE_PAGES * PageFile::PAGE_SIZE;
+const int NODE_TRAILER_SIZE = 16;
+const int COUNT_OFFSET = 16;
+const int TYPE_OFFSET = 9;
+const int NEXT_OFFSET = 8;
+const int PREV_OFFSET = 4;
+
+/**
+ * A leaf entry whose RecordId has a negative pid refers to the posting
+ * list that starts at page -pid of the index. (A negative pid keeps the
+ * pid and sid columns of compressed leaves narrow.)
+ */
+inline bool isPostingRef(const RecordId& rid) { return rid.pid < 0; }
+
+/// compressed leaf nodes hold up to this many times the plain capacity
+const int COMPRESSION_FACTOR = 4;
+
 
 /**
- * BTLeafNode: The class representing a B+tree leaf node.
+ * BTLeafNodeT: The class representing a B+tree leaf node with keys of
+ * type KeyT (see BTreeKey.h).
+ * A leaf node is stored in one of two formats, told apart by the type
+ * byte in the node trailer:
+ *  'L' plain: (RecordId, key) entries of ENTRY_SIZE bytes each.
+ *  'C' compressed: keys, pids and sids are stored as three arrays of
+ *      fixed-width bit-packed deltas against the smallest key/pid of the
+ *      node (frame of reference). With dense keys and RecordIds a node
+ *      holds up to COMPRESSION_FACTOR times the plain capacity. Key
+ *      types whose deltas do not fit 32 bits are always stored plain.
+ * In memory, entries are always kept in the plain format.
  */
-class BTLeafNode {
+template <class KeyT>
+class BTLeafNodeT {
   public:
+   /// size of a (RecordId, key) entry
+    static const int ENTRY_SIZE = sizeof(RecordId) + sizeof(KeyT);
+
+   /**
+    * @return the number of entries a plain leaf node of nodeSize bytes holds
+    */
+    static int capacity(int nodeSize) { return (nodeSize - NODE_TRAILER_SIZE) / ENTRY_SIZE; }
+
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -30,7 +78,7 @@ class BTLeafNode {
     * @param rid[IN] the RecordId to insert
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(const KeyT& key, const RecordId& rid);
 
    /**
     * Insert the (key, rid) pair to the node
@@ -43,7 +91,23 @@ class BTLeafNode {
     * @param siblingKey[OUT] the first key in the sibling node after split.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(const KeyT& key, const RecordId& rid, BTLeafNodeT& sibling, KeyT& siblingKey);
+
+   /**
+    * Split the node half and half with sibling, between two runs of
+    * equal keys if possible, at a cut where both nodes fit in a page.
+    * The first key of the sibling node is returned in siblingKey.
+    * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
+    * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @return 0 if successful. RC_NODE_FULL if no cut fits, with the
+    *         node unchanged.
+    */
+    RC split(BTLeafNodeT& sibling, KeyT& siblingKey);
+
+   /**
+    * @return true if write() can store the entries in one node
+    */
+    bool fits();
 
    /**
     * If searchKey exists in the node, set eid to the index entry
@@ -56,7 +120,7 @@ class BTLeafNode {
                       behind the largest key smaller than searchKey.
     * @return 0 if searchKey is found. If not, RC_NO_SEARCH_RECORD.
     */
-    RC locate(int searchKey, int& eid);
+    RC locate(const KeyT& searchKey, int& eid);
 
    /**
     * Read the (key, rid) pair from the eid entry.
@@ -65,7 +129,17 @@ class BTLeafNode {
     * @param rid[OUT] the RecordId from the slot
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC readEntry(int eid, int& key, RecordId& rid);
+    RC readEntry(int eid, KeyT& key, RecordId& rid);
+
+   /**
+    * Replace the count entries starting at eid, which all hold the same
+    * key, by a single entry with that key and rid.
+    * @param eid[IN] the first entry to replace
+    * @param count[IN] the number of entries to replace
+    * @param rid[IN] the RecordId of the new entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC replaceRun(int eid, int count, const RecordId& rid);
 
    /**
     * Return the pid of the next slibling node.
@@ -81,6 +155,19 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous slibling node.
+    * @return the PageId of the previous sibling node; 0 if none
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous slibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node 
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -103,30 +190,125 @@ class BTLeafNode {
     */
     RC write(PageId pid, PageFile& pf);
 
-    void printNode();
+   /**
+    * Load the node from the page image that write() writes.
+    * @param page[IN] the nodeSize bytes of the page image
+    */
+    void fromPage(const char* page);
+
+   /**
+    * Store the node as the page image that write() writes.
+    * @param page[OUT] nodeSize bytes for the page image
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC toPage(char* page);
+
+   /**
+    * Choose the page format used by write(). A compressed node falls
+    * back to the plain format whenever its entries do not compress.
+    * read() sets the format to that of the page read.
+    * @param compressed[IN] true for the compressed format
+    */
+    void setCompressed(bool compressed);
 
-    BTLeafNode();
+   /**
+    * @return true if the node was read in, or will be written in, the
+    *         compressed format
+    */
+    bool isCompressed() { return compressed; }
 
-    char getBufferChar(int index);
+   /**
+    * @return the bytes the entries take in the node on disk
+    */
+    int getStoredSize();
 
+    void printNode();
+
+   /**
+    * @param nodeSize[IN] the size of the node in bytes, a multiple of
+    *                     PageFile::PAGE_SIZE up to MAX_NODE_SIZE
+    */
+    BTLeafNodeT(int nodeSize = PageFile::PAGE_SIZE);
+    BTLeafNodeT(const BTLeafNodeT& node);
+    BTLeafNodeT& operator=(const BTLeafNodeT& node);
+    ~BTLeafNodeT();
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * Return the size of the entry buffer of a node of nodeSize bytes.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    static int bufferSize(int nodeSize)
+    { return COMPRESSION_FACTOR * (nodeSize - NODE_TRAILER_SIZE) + ENTRY_SIZE; }
+
+   /**
+    * Insert (key, rid) at entry eid, shifting the following entries.
+    * The node must have room for the entry.
+    */
+    void insertEntry(int eid, const KeyT& key, const RecordId& rid);
+
+   /**
+    * Move the entries from cut on to the empty sibling if both nodes
+    * fit afterwards.
+    * @return true if the entries were moved
+    */
+    bool splitAt(int cut, BTLeafNodeT& sibling);
+
+   /**
+    * Return the key of entry eid.
+    */
+    KeyT keyAt(int eid);
+
+   /**
+    * Return the size of the compressed page image of the entries
+    * plus (key, rid), or of the entries only if rid is NULL.
+    * INT_MAX if the entries cannot be compressed.
+    */
+    int encodedSize(const KeyT& key, const RecordId* rid);
+
+    void encode(char* page);
+    void decode(const char* page);
+
+   /**
+    * The main memory buffer holding the entries of the node in the
+    * plain format, with room for the extra entry of a split; it is
+    * allocated for the node size (see bufferSize()).
+    */
+    char* buffer;
  
     //number of keys stored in the node
     int keyCount;
+
+    //the PageId of the next sibling node
+    PageId nextPid;
+
+    //the PageId of the previous sibling node
+    PageId prevPid;
+
+    //true if the node is written in the compressed format
+    bool compressed;
+
+    //the size of the node on disk
+    int nodeSize;
 }; 
 
 
 /**
- * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * BTNonLeafNodeT: The class representing a B+tree nonleaf node with keys
+ * of type KeyT. The node holds a child pointer followed by keyCount
+ * (key, child pointer) pairs; child pointers are stored as RecordIds.
  */
-class BTNonLeafNode {
+template <class KeyT>
+class BTNonLeafNodeT {
   public:
+   /// size of a (child pointer, key) entry
+    static const int ENTRY_SIZE = sizeof(RecordId) + sizeof(KeyT);
+
+   /**
+    * @return the number of keys a non-leaf node of nodeSize bytes holds
+    */
+    static int capacity(int nodeSize)
+    { return (nodeSize - NODE_TRAILER_SIZE - (int)sizeof(RecordId)) / ENTRY_SIZE; }
+
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -134,7 +316,7 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(const KeyT& key, const RecordId& rid);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -148,17 +330,21 @@ class BTNonLeafNode {
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(const KeyT& key, const RecordId& rid, BTNonLeafNodeT& sibling, KeyT& midKey);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
-    * output it in pid.
+    * output it in pid. This is the child left of the first key that is
+    * not smaller than searchKey, where the first entry >= searchKey is.
+    * With last set, it is the child right of the last key that is not
+    * larger than searchKey, where the last entry <= searchKey is.
     * Remember that the keys inside a B+tree node are sorted.
     * @param searchKey[IN] the searchKey that is being looked up.
     * @param pid[OUT] the pointer to the child node to follow.
+    * @param last[IN] find the last instead of the first entry
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC locateChildPtr(int searchKey, RecordId& rid);
+    RC locateChildPtr(const KeyT& searchKey, RecordId& rid, bool last = false);
 
    /**
     * Initialize the root node with (pid1, key, pid2).
@@ -167,7 +353,24 @@ class BTNonLeafNode {
     * @param pid2[IN] the PageId to insert behind the key
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(RecordId rid1, int key, RecordId rid2);
+    RC initializeRoot(RecordId rid1, const KeyT& key, RecordId rid2);
+
+   /**
+    * Read the child pointer left of key eid; eid == getKeyCount() reads
+    * the last child pointer.
+    * @param eid[IN] the entry number
+    * @param pid[OUT] the child pointer
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readChildPtr(int eid, PageId& pid);
+
+   /**
+    * Read key eid.
+    * @param eid[IN] the entry number
+    * @param key[OUT] the key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readKey(int eid, KeyT& key);
 
    /**
     * Return the number of keys stored in the node.
@@ -191,20 +394,107 @@ class BTNonLeafNode {
     */
     RC write(PageId pid, PageFile& pf);
 
-    void printNode();
+   /**
+    * Load the node from the page image that write() writes.
+    * @param page[IN] the nodeSize bytes of the page image
+    */
+    void fromPage(const char* page);
 
-    BTNonLeafNode();
+   /**
+    * Store the node as the page image that write() writes.
+    * @param page[OUT] nodeSize bytes for the page image
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC toPage(char* page);
+
+   /**
+    * Check the type byte of the page read into this node.
+    * BTreeIndex reads every node as a non-leaf node first and uses this
+    * to find out whether it is a leaf.
+    * @return true if the page holds a (plain or compressed) leaf node
+    */
+    bool isLeaf();
 
-    char getBufferChar(int index);
+    void printNode();
+
+   /**
+    * @param nodeSize[IN] the size of the node in bytes, a multiple of
+    *                     PageFile::PAGE_SIZE up to MAX_NODE_SIZE
+    */
+    BTNonLeafNodeT(int nodeSize = PageFile::PAGE_SIZE);
+    BTNonLeafNodeT(const BTNonLeafNodeT& node);
+    BTNonLeafNodeT& operator=(const BTNonLeafNodeT& node);
+    ~BTNonLeafNodeT();
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The main memory buffer for loading the content of the disk pages 
+    * that contain the node; nodeSize bytes.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char* buffer;
 
     int keyCount;
+
+    //the size of the node on disk
+    int nodeSize;
 }; 
 
+/**
+ * BTPostingPage: a page of the posting list of a key with many
+ * duplicates. The leaf entry of such a key holds a reference to head,
+ * the first page of a chain of posting pages (see isPostingRef()). A posting page holds up to CAPACITY RecordIds in no
+ * particular order and has the trailer of a node, with type 'P'.
+ */
+class BTPostingPage {
+  public:
+    static const int CAPACITY = (PageFile::PAGE_SIZE - NODE_TRAILER_SIZE) / sizeof(RecordId);
+
+   /**
+    * Add rid to the page.
+    * @param rid[IN] the RecordId to add
+    * @return 0 if successful. Return an error code if the page is full.
+    */
+    RC insert(const RecordId& rid);
+
+   /**
+    * Read the RecordId from the eid entry.
+    * @param eid[IN] the entry number
+    * @param rid[OUT] the RecordId from the entry
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, RecordId& rid);
+
+   /**
+    * Remove all RecordIds from the page.
+    */
+    void clear();
+
+    int getCount();
+
+   /**
+    * @return true if the page read has the type byte of a posting page
+    */
+    bool isPostingPage();
+
+    PageId getNextPagePtr();
+    RC setNextPagePtr(PageId pid);
+
+    RC read(PageId pid, const PageFile& pf);
+    RC write(PageId pid, PageFile& pf);
+
+    //the page image, as for BTLeafNodeT::fromPage() and toPage()
+    void fromPage(const char* page);
+    RC toPage(char* page);
+
+    BTPostingPage();
+
+  private:
+    char buffer[PageFile::PAGE_SIZE];
+    int count;
+    PageId nextPid;
+};
+
+typedef BTLeafNodeT<int>    BTLeafNode;
+typedef BTNonLeafNodeT<int> BTNonLeafNode;
+
 #endif /* BTREENODE_H */
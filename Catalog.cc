@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "Catalog.h"
+
+using namespace std;
+
+static pthread_mutex_t catalogMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// the released handles, most recently used first
+static list<TableHandles*> idle;
+
+// the generation of every table, bumped by invalidate()
+static map<string, unsigned> generations;
+
+/*
+ * @return true if st describes the file with the given identity
+ */
+static bool sameFile(const struct stat& st, ino_t ino, off_t size, time_t mtime, long mtimeNsec)
+{
+  return st.st_ino == ino && st.st_size == size &&
+         st.st_mtim.tv_sec == mtime && st.st_mtim.tv_nsec == mtimeNsec;
+}
+
+RC TableHandles::open(const string& table)
+{
+  struct stat st;
+  RC          rc;
+
+  if ((rc = rf.open(table + ".tbl", 'r')) < 0) return rc;
+  ino = 0;
+  size = 0;
+  mtime = 0;
+  mtimeNsec = 0;
+  if (stat((table + ".tbl").c_str(), &st) == 0) {
+    ino = st.st_ino;
+    size = st.st_size;
+    mtime = st.st_mtim.tv_sec;
+    mtimeNsec = st.st_mtim.tv_nsec;
+  }
+  heap.open(table + ".tbl");
+  hasTree = tree.open(table + ".idx", 'r') == 0;
+  hasValueTree = valueTree.open(table + ".vidx", 'r') == 0;
+  hasHash = hash.open(table + ".hsh", 'r') == 0;
+  hasZones = zones.open(table + ".zmp", 'r') == 0;
+  this->table = table;
+  return 0;
+}
+
+void TableHandles::close()
+{
+  if (hasTree) tree.close();
+  if (hasValueTree) valueTree.close();
+  if (hasHash) hash.close();
+  if (hasZones) zones.close();
+  if (heap.isOpen()) heap.close();
+  rf.close();
+}
+
+RC Catalog::acquire(const string& table, TableHandles*& handles)
+{
+  struct stat st;
+  bool        exists = stat((table + ".tbl").c_str(), &st) == 0;
+  RC          rc;
+
+  handles = NULL;
+  pthread_mutex_lock(&catalogMutex);
+  unsigned generation = generations[table];
+  for (list<TableHandles*>::iterator it = idle.begin(); it != idle.end(); ++it) {
+    TableHandles* h = *it;
+    if (h->table != table) continue;
+
+    idle.erase(it);
+    if (exists && h->generation == generation &&
+        sameFile(st, h->ino, h->size, h->mtime, h->mtimeNsec)) {
+      handles = h;
+    } else {
+      // stale: the table has changed since
+      h->close();
+      delete h;
+    }
+    break;
+  }
+  pthread_mutex_unlock(&catalogMutex);
+  if (handles != NULL) return 0;
+
+  TableHandles* h = new TableHandles;
+  if ((rc = h->open(table)) < 0) {
+    delete h;
+    return rc;
+  }
+  h->generation = generation;
+  handles = h;
+  return 0;
+}
+
+void Catalog::release(TableHandles* handles)
+{
+  TableHandles* evicted = NULL;
+
+  pthread_mutex_lock(&catalogMutex);
+  if (handles->generation == generations[handles->table]) {
+    idle.push_front(handles);
+    handles = NULL;
+    if ((int)idle.size() > MAX_IDLE) {
+      evicted = idle.back();
+      idle.pop_back();
+    }
+  }
+  pthread_mutex_unlock(&catalogMutex);
+
+  // a table changed while the handles were in use, or too many are open
+  if (handles != NULL) evicted = handles;
+  if (evicted != NULL) {
+    evicted->close();
+    delete evicted;
+  }
+}
+
+void Catalog::invalidate(const string& table)
+{
+  list<TableHandles*> stale;
+
+  pthread_mutex_lock(&catalogMutex);
+  generations[table]++;
+  for (list<TableHandles*>::iterator it = idle.begin(); it != idle.end(); ) {
+    if ((*it)->table == table) {
+      stale.push_back(*it);
+      it = idle.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  pthread_mutex_unlock(&catalogMutex);
+
+  for (list<TableHandles*>::iterator it = stale.begin(); it != stale.end(); ++it) {
+    (*it)->close();
+    delete *it;
+  }
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <string>
+#include <sys/types.h>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "RecordFetcher.h"
+#include "BTreeIndex.h"
+#include "HashIndex.h"
+#include "ZoneMap.h"
+
+/**
+ * TableHandles: a table file and its index files, opened for reading.
+ * An index that does not exist is not open; see the has* flags.
+ * heap reads the tuples an index returns a batch at a time; if it
+ * cannot be opened, the tuples are read one by one from rf.
+ * A TableHandles is used by one query at a time, since the indexes
+ * keep cursor state.
+ */
+struct TableHandles {
+  RecordFile             rf;         /// table.tbl
+  RecordFetcher          heap;       /// table.tbl, for batches of tuples
+  BTreeIndex             tree;       /// table.idx
+  BTreeIndexT<StringKey> valueTree;  /// table.vidx
+  HashIndex              hash;       /// table.hsh
+  ZoneMap                zones;      /// table.zmp
+  bool hasTree;
+  bool hasValueTree;
+  bool hasHash;
+  bool hasZones;
+
+ private:
+  friend class Catalog;
+
+  RC   open(const std::string& table);
+  void close();
+
+  std::string table;
+  unsigned    generation;  /// the generation of the table when opened
+  ino_t       ino;         /// the identity of table.tbl when opened
+  off_t       size;
+  time_t      mtime;
+  long        mtimeNsec;
+};
+
+/**
+ * Catalog: the process-wide cache of open TableHandles, so that a query
+ * neither opens nor closes any file and the index headers are parsed
+ * only once.
+ * acquire() hands out an idle TableHandles of the table, or opens a new
+ * one, for the exclusive use of the caller until release(). Up to
+ * MAX_IDLE released handles are kept open, the least recently used ones
+ * are closed first. invalidate() closes the idle handles of a table
+ * that changed; handles in use are closed when they are released.
+ * Handles of a table file replaced by another process are also
+ * discarded, as acquire() compares the identity of the table file.
+ * All methods may be called from several threads.
+ */
+class Catalog {
+ public:
+  /// the number of idle TableHandles kept open
+  static const int MAX_IDLE = 64;
+
+  /**
+   * get open handles of table.
+   * @param table[IN] the table name
+   * @param handles[OUT] the handles; to be returned with release()
+   * @return error code. 0 if no error
+   */
+  static RC acquire(const std::string& table, TableHandles*& handles);
+
+  /**
+   * return handles obtained from acquire().
+   * @param handles[IN] the handles
+   */
+  static void release(TableHandles* handles);
+
+  /**
+   * close the handles of table, e.g., after it was loaded.
+   * @param table[IN] the table name
+   */
+  static void invalidate(const std::string& table);
+};
+
+#endif /* CATALOG_H */
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include "HashIndex.h"
+
+using namespace std;
+
+const double HashIndex::MAX_LOAD = 0.6;
+
+/*
+ * mix the bits of the key so that the low bits pick the bucket
+ * (the finalizer of MurmurHash3)
+ */
+static unsigned hashKey(int key)
+{
+  unsigned h = (unsigned)key;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+HashIndex::HashIndex()
+{
+  mode = 'r';
+  level = 0;
+  next = 0;
+  keyCount = 0;
+  freePid = 0;
+  cursorPagePid = 0;
+}
+
+RC HashIndex::open(const string& indexname, char mode)
+{
+  RC rc;
+
+  if ((rc = pf.open(indexname, mode)) < 0) return rc;
+  if ((rc = ovf.open(indexname + ".ovf", mode)) < 0) {
+    pf.close();
+    return rc;
+  }
+  this->mode = mode;
+  cursorPagePid = 0;
+
+  if (pf.endPid() > 0) {
+    if ((rc = readHeader()) < 0) {
+      close();
+      return rc;
+    }
+    return 0;
+  }
+
+  // a new index: one empty bucket
+  level = 0;
+  next = 0;
+  keyCount = 0;
+  freePid = 0;
+  if (mode != 'w') return 0;
+
+  Page empty;
+  memset(&empty, 0, sizeof(empty));
+  if ((rc = writeHeader()) < 0 || (rc = pf.write(1, &empty)) < 0 ||
+      (ovf.endPid() == 0 && (rc = ovf.write(0, &empty)) < 0)) {
+    close();
+    return rc;
+  }
+  return 0;
+}
+
+RC HashIndex::close()
+{
+  RC rc = 0;
+
+  if (mode == 'w') rc = writeHeader();
+  if (ovf.close() < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  if (pf.close() < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  mode = 'r';
+  return rc;
+}
+
+RC HashIndex::readHeader()
+{
+  char buf[PageFile::PAGE_SIZE];
+  int  header[5];
+  RC   rc;
+
+  if ((rc = pf.read(0, buf)) < 0) return rc;
+  memcpy(header, buf, sizeof(header));
+  if (header[0] != MAGIC) return RC_INVALID_FILE_FORMAT;
+  level = header[1];
+  next = header[2];
+  keyCount = header[3];
+  freePid = header[4];
+  return 0;
+}
+
+RC HashIndex::writeHeader()
+{
+  char buf[PageFile::PAGE_SIZE];
+  int  header[5] = { MAGIC, level, next, keyCount, freePid };
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, header, sizeof(header));
+  return pf.write(0, buf);
+}
+
+int HashIndex::bucketOf(int key) const
+{
+  unsigned h = hashKey(key);
+  unsigned bucket = h & ((1u << level) - 1);
+
+  // buckets before the split pointer have been split already
+  if ((int)bucket < next) bucket = h & ((2u << level) - 1);
+  return bucket;
+}
+
+RC HashIndex::readPage(PageId pid, Page& page)
+{
+  return (pid > 0) ? pf.read(pid, &page) : ovf.read(-pid, &page);
+}
+
+RC HashIndex::writePage(PageId pid, const Page& page)
+{
+  return (pid > 0) ? pf.write(pid, &page) : ovf.write(-pid, &page);
+}
+
+PageId HashIndex::allocOverflow()
+{
+  PageId pid;
+
+  if (freePid != 0) {
+    Page page;
+    pid = freePid;
+    if (readPage(pid, page) < 0) return 0;
+    freePid = page.b.next;
+    return pid;
+  }
+  return -ovf.endPid();
+}
+
+RC HashIndex::insert(int key, const RecordId& rid)
+{
+  Page   page;
+  PageId pid = bucketOf(key) + 1;
+  RC     rc;
+
+  // append to the last page of the bucket
+  for (;;) {
+    if ((rc = readPage(pid, page)) < 0) return rc;
+    if (page.b.next == 0) break;
+    pid = page.b.next;
+  }
+
+  if (page.b.count == ENTRIES_PER_PAGE) {
+    PageId opid = allocOverflow();
+    if (opid == 0) return RC_FILE_READ_FAILED;
+    page.b.next = opid;
+    if ((rc = writePage(pid, page)) < 0) return rc;
+    memset(&page, 0, sizeof(page));
+    pid = opid;
+  }
+  page.b.entries[page.b.count].key = key;
+  page.b.entries[page.b.count].rid = rid;
+  page.b.count++;
+  if ((rc = writePage(pid, page)) < 0) return rc;
+
+  keyCount++;
+  cursorPagePid = 0;
+  if (keyCount > MAX_LOAD * ENTRIES_PER_PAGE * getBucketCount()) return split();
+  return 0;
+}
+
+RC HashIndex::split()
+{
+  vector<Entry> entries, moved;
+  Page          page;
+  RC            rc;
+  int           from = next;
+  int           to = next + (1 << level);
+
+  // collect the entries of the bucket and free its overflow pages
+  for (PageId pid = from + 1; pid != 0; ) {
+    if ((rc = readPage(pid, page)) < 0) return rc;
+    entries.insert(entries.end(), page.b.entries, page.b.entries + page.b.count);
+
+    PageId nextPid = page.b.next;
+    if (pid < 0) {
+      page.b.count = 0;
+      page.b.next = freePid;
+      if ((rc = writePage(pid, page)) < 0) return rc;
+      freePid = pid;
+    }
+    pid = nextPid;
+  }
+
+  if (++next == (1 << level)) {
+    level++;
+    next = 0;
+  }
+
+  // the entries stay or move to the new bucket at the end of the file
+  size_t kept = 0;
+  for (size_t i = 0; i < entries.size(); i++) {
+    if (bucketOf(entries[i].key) == to) moved.push_back(entries[i]);
+    else entries[kept++] = entries[i];
+  }
+  entries.resize(kept);
+
+  if ((rc = writeBucket(from, entries)) < 0) return rc;
+  return writeBucket(to, moved);
+}
+
+RC HashIndex::writeBucket(int bucket, const vector<Entry>& entries)
+{
+  Page   page;
+  PageId pid = bucket + 1;
+  size_t i = 0;
+  RC     rc;
+
+  do {
+    memset(&page, 0, sizeof(page));
+    while (i < entries.size() && page.b.count < ENTRIES_PER_PAGE) {
+      page.b.entries[page.b.count++] = entries[i++];
+    }
+    if (i < entries.size() && (page.b.next = allocOverflow()) == 0) return RC_FILE_READ_FAILED;
+    if ((rc = writePage(pid, page)) < 0) return rc;
+    pid = page.b.next;
+  } while (i < entries.size());
+
+  return 0;
+}
+
+RC HashIndex::locate(int searchKey, IndexCursor& cursor)
+{
+  RC rc;
+
+  cursor.pid = bucketOf(searchKey) + 1;
+  cursor.eid = 0;
+  while (cursor.pid != 0) {
+    if (cursor.pid != cursorPagePid) {
+      if ((rc = readPage(cursor.pid, cursorPage)) < 0) return rc;
+      cursorPagePid = cursor.pid;
+    }
+    for (int i = 0; i < cursorPage.b.count; i++) {
+      if (cursorPage.b.entries[i].key == searchKey) {
+        cursor.eid = i;
+        return 0;
+      }
+    }
+    cursor.pid = cursorPage.b.next;
+  }
+  return RC_NO_SUCH_RECORD;
+}
+
+RC HashIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+{
+  RC rc;
+
+  if (cursor.pid == 0) return RC_INVALID_CURSOR;
+  if (cursor.pid != cursorPagePid) {
+    if ((rc = readPage(cursor.pid, cursorPage)) < 0) return rc;
+    cursorPagePid = cursor.pid;
+  }
+  if (cursor.eid >= cursorPage.b.count) return RC_INVALID_CURSOR;
+
+  key = cursorPage.b.entries[cursor.eid].key;
+  rid = cursorPage.b.entries[cursor.eid].rid;
+
+  // move to the next entry with the same key
+  for (int i = cursor.eid + 1; ; i = 0) {
+    for (; i < cursorPage.b.count; i++) {
+      if (cursorPage.b.entries[i].key == key) {
+        cursor.eid = i;
+        return 0;
+      }
+    }
+    if ((cursor.pid = cursorPage.b.next) == 0) return 0;
+    if ((rc = readPage(cursor.pid, cursorPage)) < 0) return rc;
+    cursorPagePid = cursor.pid;
+  }
+}
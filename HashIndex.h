@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+
+/**
+ * HashIndex: an on-disk linear hash index on the key column, for tables
+ * queried by key equality only. It has the (key, RecordId) interface of
+ * BTreeIndex, but locate() finds only entries equal to the search key
+ * and readForward() returns the entries with that key, in no particular
+ * order.
+ *
+ * Bucket b is page b + 1 of the index file; page 0 is the header. A
+ * bucket that overflows is continued in a chain of overflow pages kept
+ * in a second file, indexname.ovf. The table grows by one bucket at a
+ * time: whenever the load factor exceeds MAX_LOAD, the bucket at the
+ * split pointer is split, so there is neither a directory nor a rehash
+ * of the whole table. A lookup reads one page unless its bucket has
+ * overflowed.
+ *
+ * An IndexCursor from a HashIndex points to entry eid of page pid of
+ * the index file if pid > 0, and of page -pid of the overflow file if
+ * pid < 0. pid == 0 means that there are no more entries.
+ */
+class HashIndex {
+ public:
+  HashIndex();
+
+  /**
+   * open the index file in read or write mode.
+   * under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * close the index file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * insert (key, RecordId) pair to the index.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * find the first entry with searchKey and point cursor to it.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor pointing to the entry
+   * @return 0 if searchKey is found. Otherwise RC_NO_SUCH_RECORD
+   */
+  RC locate(int searchKey, IndexCursor& cursor);
+
+  /**
+   * read the (key, rid) pair at the cursor and move the cursor to the
+   * next entry with the same key.
+   * @param cursor[IN/OUT] the cursor returned by locate()
+   * @param key[OUT] the key stored at the cursor location
+   * @param rid[OUT] the RecordId stored at the cursor location
+   * @return error code. 0 if no error
+   */
+  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * @return the number of keys in the index
+   */
+  int getKeyCount() const { return keyCount; }
+
+  /**
+   * @return the number of buckets
+   */
+  int getBucketCount() const { return (1 << level) + next; }
+
+ private:
+  static const int MAGIC = 0x48534831;
+
+  /// split a bucket when keys / (buckets * ENTRIES_PER_PAGE) exceeds this
+  static const double MAX_LOAD;
+
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+
+  static const int ENTRIES_PER_PAGE = (PageFile::PAGE_SIZE - 2 * sizeof(int)) / sizeof(Entry);
+
+  /// a bucket or overflow page
+  union Page {
+    struct {
+      int    count;     /// the number of entries in the page
+      PageId next;      /// the next overflow page of the bucket; 0 if none
+      Entry  entries[ENTRIES_PER_PAGE];
+    } b;
+    char raw[PageFile::PAGE_SIZE];
+  };
+
+  int bucketOf(int key) const;
+
+  RC readPage(PageId pid, Page& page);
+  RC writePage(PageId pid, const Page& page);
+
+  /**
+   * allocate an overflow page, reusing freed ones first.
+   * @return the (negative) cursor pid of the page
+   */
+  PageId allocOverflow();
+
+  /**
+   * split the bucket at the split pointer and advance the pointer.
+   */
+  RC split();
+
+  /**
+   * replace the content of bucket with entries.
+   */
+  RC writeBucket(int bucket, const std::vector<Entry>& entries);
+
+  RC readHeader();
+  RC writeHeader();
+
+  PageFile pf;        /// header and buckets
+  PageFile ovf;       /// overflow pages
+  char     mode;
+
+  int      level;     /// the table has 2^level buckets plus next
+  int      next;      /// the split pointer: the next bucket to split
+  int      keyCount;  /// the number of keys in the index
+  PageId   freePid;   /// the first free overflow page; 0 if none
+
+  Page     cursorPage;     /// the page last read by readForward()
+  PageId   cursorPagePid;  /// its cursor pid; 0 if none
+};
+
+#endif /* HASHINDEX_H */
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdlib>
+#include "InnerCache.h"
+#include "BTreeKey.h"
+
+using namespace std;
+
+template <class KeyT>
+InnerCacheT<KeyT>::InnerCacheT()
+{
+  keys = NULL;
+  leaves = NULL;
+  count = 0;
+}
+
+template <class KeyT>
+InnerCacheT<KeyT>::~InnerCacheT()
+{
+  clear();
+}
+
+template <class KeyT>
+void InnerCacheT<KeyT>::clear()
+{
+  free(keys);
+  delete [] leaves;
+  keys = NULL;
+  leaves = NULL;
+  count = 0;
+}
+
+template <class KeyT>
+RC InnerCacheT<KeyT>::readSeparators(PageFile& pf, PageId rootPid, int height, int nodeSize, int& nodeReads,
+                                     vector<KeyT>& sortedKeys, vector<PageId>& sortedLeaves)
+{
+  RC rc;
+
+  nodeReads = 0;
+  sortedKeys.clear();
+  sortedLeaves.clear();
+  if (height < 2)
+    return RC_INVALID_ATTRIBUTE;
+  if ((rc = collect(pf, rootPid, height - 1, nodeSize, nodeReads, sortedKeys, sortedLeaves)) < 0)
+    return rc;
+
+  // one descent equals one search only if the separators are in order
+  for (unsigned i = 1; i < sortedKeys.size(); i++) {
+    if (sortedKeys[i] < sortedKeys[i - 1])
+      return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
+}
+
+template <class KeyT>
+RC InnerCacheT<KeyT>::build(const vector<KeyT>& sortedKeys, const vector<PageId>& sortedLeaves)
+{
+  clear();
+
+  // keys[0] is not used, so that keys[LINE_KEYS * k] starts a cache line
+  count = sortedKeys.size();
+  void* p;
+  if (posix_memalign(&p, 64, (count + 1) * sizeof(KeyT)) != 0) {
+    // no room for the copy
+    count = 0;
+    return RC_NODE_FULL;
+  }
+  keys = (KeyT*)p;
+  leaves = new PageId[count + 1];
+  place(sortedKeys, sortedLeaves, 0, 1);
+  leaves[0] = sortedLeaves[count];
+  return 0;
+}
+
+/*
+ * append the separators and leaves of the subtree at pid in key order.
+ */
+template <class KeyT>
+RC InnerCacheT<KeyT>::collect(PageFile& pf, PageId pid, int level, int nodeSize, int& nodeReads,
+                              vector<KeyT>& sortedKeys, vector<PageId>& sortedLeaves)
+{
+  BTNonLeafNodeT<KeyT> node(nodeSize);
+  RC rc;
+
+  nodeReads++;
+  if (node.read(pid, pf) < 0)
+    return RC_FILE_READ_FAILED;
+  if (node.isLeaf() || node.getKeyCount() < 1)
+    return RC_INVALID_FILE_FORMAT;
+
+  for (int eid = 0; eid <= node.getKeyCount(); eid++) {
+    PageId child;
+    KeyT key;
+    node.readChildPtr(eid, child);
+    if (level == 1)
+      sortedLeaves.push_back(child);
+    else if ((rc = collect(pf, child, level - 1, nodeSize, nodeReads, sortedKeys, sortedLeaves)) < 0)
+      return rc;
+    if (eid < node.getKeyCount()) {
+      node.readKey(eid, key);
+      sortedKeys.push_back(key);
+    }
+  }
+  return 0;
+}
+
+/*
+ * fill the subtree at Eytzinger position k with the keys from rank i on.
+ * @return the rank of the next key
+ */
+template <class KeyT>
+int InnerCacheT<KeyT>::place(const vector<KeyT>& sortedKeys, const vector<PageId>& sortedLeaves, int i, int k)
+{
+  if (k <= count) {
+    i = place(sortedKeys, sortedLeaves, i, 2 * k);
+    keys[k] = sortedKeys[i];
+    leaves[k] = sortedLeaves[i];
+    i = place(sortedKeys, sortedLeaves, i + 1, 2 * k + 1);
+  }
+  return i;
+}
+
+template <class KeyT>
+PageId InnerCacheT<KeyT>::findLeaf(const KeyT& searchKey, bool last) const
+{
+  // go right past every key smaller than searchKey (not larger if last);
+  // k ends up as the position of the first key that was not passed,
+  // followed by a 0 for the left turn there and a 1 for every right turn
+  // after it. k is 0 if all keys were passed.
+  int k = 1;
+  if (last) {
+    while (k <= count) {
+      __builtin_prefetch(keys + LINE_KEYS * k);
+      k = 2 * k + !(searchKey < keys[k]);
+    }
+  } else {
+    while (k <= count) {
+      __builtin_prefetch(keys + LINE_KEYS * k);
+      k = 2 * k + (keys[k] < searchKey);
+    }
+  }
+  k >>= __builtin_ffs(~k);
+  return leaves[k];
+}
+
+template <class KeyT>
+size_t InnerCacheT<KeyT>::getSize() const
+{
+  return isValid() ? (count + 1) * (sizeof(KeyT) + sizeof(PageId)) : 0;
+}
+
+template class InnerCacheT<int>;
+template class InnerCacheT<int64_t>;
+template class InnerCacheT<StringKey>;
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef INNERCACHE_H
+#define INNERCACHE_H
+
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "BTreeNode.h"
+
+/**
+ * InnerCacheT: a read-only, in-memory copy of the non-leaf levels of a
+ * BTreeIndexT that maps a search key to its leaf without reading pages.
+ *
+ * Walking the non-leaf nodes in key order yields the separators
+ * s[0] <= ... <= s[n-1] with leaf i left of s[i] and leaf n last, so the
+ * descent from the root is a single search over the separators. They are
+ * stored in Eytzinger (breadth-first) order in 64-byte aligned memory:
+ * the first levels of every search share a few cache lines, and the line
+ * holding all candidates a few levels further down is prefetched while
+ * the current key is compared.
+ */
+template <class KeyT>
+class InnerCacheT {
+ public:
+  InnerCacheT();
+  ~InnerCacheT();
+
+  /**
+   * read the separators of the non-leaf levels of a tree in key order.
+   * @param pf[IN] the index file
+   * @param rootPid[IN] the PageId of the root
+   * @param height[IN] the height of the tree (at least 2)
+   * @param nodeSize[IN] the node size of the tree in bytes
+   * @param nodeReads[OUT] the number of nodes read
+   * @param sortedKeys[OUT] the separators
+   * @param sortedLeaves[OUT] the leaves; leaf i is left of separator i
+   * @return error code. RC_INVALID_FILE_FORMAT if the separators are out
+   *         of order, so that the tree must be searched page by page
+   */
+  static RC readSeparators(PageFile& pf, PageId rootPid, int height, int nodeSize, int& nodeReads,
+                           std::vector<KeyT>& sortedKeys, std::vector<PageId>& sortedLeaves);
+
+  /**
+   * build the copy from the output of readSeparators().
+   * @return error code. 0 if no error
+   */
+  RC build(const std::vector<KeyT>& sortedKeys, const std::vector<PageId>& sortedLeaves);
+
+  /**
+   * drop the copy, e.g., because a node split.
+   */
+  void clear();
+
+  /**
+   * @return true if the copy is built and current
+   */
+  bool isValid() const { return keys != NULL; }
+
+  /**
+   * find the leaf that locateChildPtr() reaches from the root.
+   * @param searchKey[IN] the key to find
+   * @param last[IN] as for BTNonLeafNodeT::locateChildPtr()
+   * @return the PageId of the leaf
+   */
+  PageId findLeaf(const KeyT& searchKey, bool last) const;
+
+  /**
+   * @return the memory held by the copy in bytes
+   */
+  size_t getSize() const;
+
+ private:
+  /// the number of keys per cache line; the search prefetches the
+  /// descendants of a key this many times further on
+  static const int LINE_KEYS = 64 / sizeof(KeyT);
+
+  InnerCacheT(const InnerCacheT&);
+  InnerCacheT& operator=(const InnerCacheT&);
+
+  static RC collect(PageFile& pf, PageId pid, int level, int nodeSize, int& nodeReads,
+             std::vector<KeyT>& sortedKeys, std::vector<PageId>& sortedLeaves);
+  int place(const std::vector<KeyT>& sortedKeys, const std::vector<PageId>& sortedLeaves, int i, int k);
+
+  KeyT*   keys;    /// keys[1..count] in Eytzinger order; NULL if not built
+  PageId* leaves;  /// leaves[k]: the leaf left of keys[k]; leaves[0]: the last leaf
+  int     count;   /// the number of separators
+};
+
+#endif /* INNERCACHE_H */
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "LeafModel.h"
+#include "BTreeKey.h"
+
+using namespace std;
+
+/*
+ * map a key to a number, preserving the order of keys. a StringKey is
+ * ordered by its first 8 bytes.
+ */
+static double keyValue(int key) { return key; }
+static double keyValue(int64_t key) { return (double)key; }
+static double keyValue(const StringKey& key)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | (unsigned char)key.data[i];
+  return (double)v;
+}
+
+template <class KeyT>
+LeafModelT<KeyT>::LeafModelT()
+{
+  valid = false;
+  misses = 0;
+}
+
+template <class KeyT>
+void LeafModelT<KeyT>::build(const vector<KeyT>& sortedKeys, const vector<PageId>& sortedLeaves)
+{
+  keys = sortedKeys;
+  leaves = sortedLeaves;
+  fit();
+  valid = true;
+}
+
+template <class KeyT>
+void LeafModelT<KeyT>::clear()
+{
+  keys.clear();
+  leaves.clear();
+  segments.clear();
+  valid = false;
+}
+
+/*
+ * cover the separators with as few segments as possible: a segment is
+ * extended as long as some slope predicts all its positions within
+ * FIT_ERROR (the range of such slopes only shrinks as it grows).
+ */
+template <class KeyT>
+void LeafModelT<KeyT>::fit()
+{
+  int n = keys.size();
+
+  segments.clear();
+  for (int i = 0; i < n; ) {
+    Segment seg;
+    seg.firstKey = keys[i];
+    seg.x0 = keyValue(keys[i]);
+    seg.start = i;
+    seg.error = FIT_ERROR;
+
+    double lo = 0, hi = HUGE_VAL;
+    int j;
+    for (j = i + 1; j < n; j++) {
+      double dx = keyValue(keys[j]) - seg.x0;
+      int    dy = j - i;
+      if (dx <= 0) {
+        // the same number as the first key: predicted at the start
+        if (dy > FIT_ERROR) break;
+        continue;
+      }
+      double l = max(lo, (dy - FIT_ERROR) / dx);
+      double h = min(hi, (dy + FIT_ERROR) / dx);
+      if (l > h) break;
+      lo = l;
+      hi = h;
+    }
+    seg.slope = (hi == HUGE_VAL) ? lo : (lo + hi) / 2;
+    segments.push_back(seg);
+    i = j;
+  }
+}
+
+/*
+ * @return true if pos is where searchKey would be inserted: the first
+ *         separator >= searchKey (> searchKey if last)
+ */
+template <class KeyT>
+bool LeafModelT<KeyT>::isBound(int pos, const KeyT& searchKey, bool last) const
+{
+  int n = keys.size();
+  if (pos > 0 && !(keys[pos - 1] < searchKey || (last && keys[pos - 1] == searchKey)))
+    return false;
+  if (pos < n && (keys[pos] < searchKey || (last && keys[pos] == searchKey)))
+    return false;
+  return true;
+}
+
+/*
+ * @return the position of the first separator >= searchKey (> searchKey
+ *         if last); the number of separators if there is none
+ */
+template <class KeyT>
+int LeafModelT<KeyT>::findPosition(const KeyT& searchKey, bool last)
+{
+  int n = keys.size();
+  int a = 0, b = segments.size();
+
+  // the separator before the position is in the last segment that
+  // starts before searchKey
+  while (a < b) {
+    int mid = (a + b) / 2;
+    if (segments[mid].firstKey < searchKey || (last && segments[mid].firstKey == searchKey))
+      a = mid + 1;
+    else
+      b = mid;
+  }
+  if (a == 0) return 0;
+
+  const Segment& seg = segments[a - 1];
+  int end = (a < (int)segments.size()) ? segments[a].start : n;
+  double pred = seg.start + seg.slope * (keyValue(searchKey) - seg.x0);
+  pred = min(max(pred, (double)seg.start), (double)end);
+
+  // the position is within the error of the prediction, after the
+  // first separator of the segment and at most at the next segment
+  int lo = max(seg.start + 1, (int)floor(pred) - seg.error);
+  int hi = min(end, (int)ceil(pred) + seg.error + 1);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (keys[mid] < searchKey || (last && keys[mid] == searchKey))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (isBound(lo, searchKey, last)) return lo;
+
+  misses++;
+  lo = 0;
+  hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (keys[mid] < searchKey || (last && keys[mid] == searchKey))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+template <class KeyT>
+PageId LeafModelT<KeyT>::findLeaf(const KeyT& searchKey, bool last)
+{
+  return leaves[findPosition(searchKey, last)];
+}
+
+template <class KeyT>
+RC LeafModelT<KeyT>::splitLeaf(const KeyT& key, PageId pid, const KeyT& sepKey, PageId siblingPid)
+{
+  int pos = findPosition(key, true);
+  int n = keys.size();
+
+  // the new separator goes right of the leaf, i.e., to position pos
+  if (leaves[pos] != pid) return RC_INVALID_CURSOR;
+  if ((pos > 0 && sepKey < keys[pos - 1]) || (pos < n && keys[pos] < sepKey))
+    return RC_INVALID_CURSOR;
+  keys.insert(keys.begin() + pos, sepKey);
+  leaves.insert(leaves.begin() + pos + 1, siblingPid);
+
+  if (pos == 0) {
+    // a new first separator: no segment starts before it
+    fit();
+    return 0;
+  }
+
+  // the later separators move one position to the right, which their
+  // segments absorb by starting one later; the segment that gets the
+  // new separator is off by one more for its later separators
+  int s = segments.size() - 1;
+  while (segments[s].start >= pos) segments[s--].start++;
+
+  Segment& seg = segments[s];
+  double miss = fabs(seg.start + seg.slope * (keyValue(sepKey) - seg.x0) - pos);
+  if (miss > MAX_ERROR) {
+    fit();
+    return 0;
+  }
+  seg.error = max(seg.error + 1, (int)ceil(miss));
+  if (seg.error > MAX_ERROR) fit();
+  return 0;
+}
+
+template class LeafModelT<int>;
+template class LeafModelT<int64_t>;
+template class LeafModelT<StringKey>;
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LEAFMODEL_H
+#define LEAFMODEL_H
+
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * LeafModelT: a learned index over the leaf separators of a BTreeIndexT
+ * (see InnerCacheT::readSeparators()) that maps a search key to its leaf
+ * without reading pages.
+ *
+ * The separators are covered by linear segments: within a segment, the
+ * position of a separator is predicted from its key with an error of at
+ * most the error of the segment, so a lookup is one interpolation and a
+ * binary search of a few positions. Dense, near-monotonic keys need only
+ * a handful of segments.
+ *
+ * A leaf split adds one separator, which shifts the later ones by one
+ * position: the model is updated in place by splitLeaf() and rebuilt in
+ * memory once a segment has become too inexact. Non-leaf splits do not
+ * change the separators.
+ */
+template <class KeyT>
+class LeafModelT {
+ public:
+  LeafModelT();
+
+  /**
+   * fit the model to the separators.
+   * @param sortedKeys[IN] the separators in key order
+   * @param sortedLeaves[IN] the leaves; leaf i is left of separator i
+   */
+  void build(const std::vector<KeyT>& sortedKeys, const std::vector<PageId>& sortedLeaves);
+
+  /**
+   * drop the model.
+   */
+  void clear();
+
+  /**
+   * @return true if the model is built and current
+   */
+  bool isValid() const { return valid; }
+
+  /**
+   * find the leaf that BTNonLeafNodeT::locateChildPtr() reaches from the root.
+   * @param searchKey[IN] the key to find
+   * @param last[IN] as for BTNonLeafNodeT::locateChildPtr()
+   * @return the PageId of the leaf
+   */
+  PageId findLeaf(const KeyT& searchKey, bool last);
+
+  /**
+   * record that the leaf reached by findLeaf(key, true) split.
+   * @param key[IN] the key whose insertion split the leaf
+   * @param pid[IN] the PageId of the leaf
+   * @param sepKey[IN] the separator between the leaf and its new sibling
+   * @param siblingPid[IN] the PageId of the new sibling
+   * @return error code. 0 if no error; otherwise the model must be dropped
+   */
+  RC splitLeaf(const KeyT& key, PageId pid, const KeyT& sepKey, PageId siblingPid);
+
+  /**
+   * @return the number of linear segments
+   */
+  int getSegmentCount() const { return segments.size(); }
+
+  /**
+   * @return the number of lookups whose bounded search missed, so that
+   *         the whole separator array was searched
+   */
+  long getMisses() const { return misses; }
+
+ private:
+  /// the largest error of a segment when it is fitted
+  static const int FIT_ERROR = 16;
+  /// the largest error of a segment before the model is fitted again
+  static const int MAX_ERROR = 4 * FIT_ERROR;
+
+  struct Segment {
+    KeyT   firstKey;  /// the key of the first separator of the segment
+    double x0;        /// firstKey as a number
+    double slope;     /// positions per key unit
+    int    start;     /// the position of the first separator
+    int    error;     /// the largest prediction error within the segment
+  };
+
+  void fit();
+  int  findPosition(const KeyT& searchKey, bool last);
+  bool isBound(int pos, const KeyT& searchKey, bool last) const;
+
+  std::vector<KeyT>    keys;      /// the separators in key order
+  std::vector<PageId>  leaves;    /// leaves[i] is left of keys[i]; the last leaf is at the end
+  std::vector<Segment> segments;  /// in key order
+  bool valid;
+  long misses;
+};
+
+#endif /* LEAFMODEL_H */
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "PageIO.h"
+
+// io_uring is used through its system calls, so that no library is needed
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+using namespace std;
+
+long PageIO::readCount = 0;
+long PageIO::writeCount = 0;
+
+PageIO::PageIO()
+{
+  fd = -1;
+  depth = 0;
+  fixedBuf = NULL;
+  fixedSize = 0;
+  ringFd = -1;
+  sqRing = cqRing = sqes = cqes = NULL;
+  sqRingSize = cqRingSize = sqesSize = 0;
+  sqHead = sqTail = sqMask = sqArray = NULL;
+  cqHead = cqTail = cqMask = NULL;
+  queued = 0;
+}
+
+PageIO::~PageIO()
+{
+  if (fd >= 0) close();
+}
+
+RC PageIO::open(const string& filename, char mode, int depth)
+{
+  if (fd >= 0 || depth < 1) return RC_FILE_OPEN_FAILED;
+
+  int flags;
+  switch (mode) {
+  case 'r': flags = O_RDONLY; break;
+  case 'w': flags = O_RDWR | O_CREAT; break;
+  default: return RC_INVALID_FILE_MODE;
+  }
+  if ((fd = ::open(filename.c_str(), flags, 0644)) < 0) return RC_FILE_OPEN_FAILED;
+
+  this->depth = depth;
+  slots.resize(depth);
+  freeSlots.clear();
+  for (int i = depth - 1; i >= 0; i--) freeSlots.push_back(i);
+  doneSlots.clear();
+
+  // without a ring, the requests are done synchronously
+  if (setupRing() < 0) closeRing();
+  return 0;
+}
+
+RC PageIO::close()
+{
+  RC rc = 0;
+
+  if (fd < 0) return RC_FILE_CLOSE_FAILED;
+  rc = drain();
+  closeRing();
+  if (::close(fd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  fd = -1;
+  fixedBuf = NULL;
+  fixedSize = 0;
+  return rc;
+}
+
+RC PageIO::setupRing()
+{
+#ifdef HAVE_IO_URING
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  if ((ringFd = syscall(__NR_io_uring_setup, depth, &p)) < 0) return RC_FILE_OPEN_FAILED;
+
+  // the submission ring, the completion ring (often in the same
+  // mapping) and the submission entries are shared with the kernel
+  sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single) {
+    if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+    cqRingSize = 0;
+  }
+  sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    sqRing = NULL;
+    return RC_FILE_OPEN_FAILED;
+  }
+  cqRing = sqRing;
+  if (!single) {
+    cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+      cqRing = NULL;
+      return RC_FILE_OPEN_FAILED;
+    }
+  }
+  sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ringFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    sqes = NULL;
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  char* sq = (char*)sqRing;
+  char* cq = (char*)cqRing;
+  sqHead = (unsigned*)(sq + p.sq_off.head);
+  sqTail = (unsigned*)(sq + p.sq_off.tail);
+  sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+  sqArray = (unsigned*)(sq + p.sq_off.array);
+  cqHead = (unsigned*)(cq + p.cq_off.head);
+  cqTail = (unsigned*)(cq + p.cq_off.tail);
+  cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+  cqes = cq + p.cq_off.cqes;
+  queued = 0;
+  return 0;
+#else
+  return RC_FILE_OPEN_FAILED;
+#endif
+}
+
+void PageIO::closeRing()
+{
+#ifdef HAVE_IO_URING
+  if (sqes != NULL) munmap(sqes, sqesSize);
+  if (cqRing != NULL && cqRing != sqRing) munmap(cqRing, cqRingSize);
+  if (sqRing != NULL) munmap(sqRing, sqRingSize);
+#endif
+  if (ringFd >= 0) ::close(ringFd);
+  ringFd = -1;
+  sqRing = cqRing = sqes = cqes = NULL;
+  sqHead = sqTail = sqMask = sqArray = NULL;
+  cqHead = cqTail = cqMask = NULL;
+  queued = 0;
+}
+
+RC PageIO::registerBuffer(void* buf, int pages)
+{
+  RC rc;
+
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (ringFd < 0) return 0;
+
+  // the kernel changes the registration only with no requests in flight
+  if ((rc = drain()) < 0) return rc;
+#ifdef HAVE_IO_URING
+  if (fixedBuf != NULL) syscall(__NR_io_uring_register, ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+  fixedBuf = NULL;
+  fixedSize = 0;
+
+  // a buffer the kernel cannot pin (e.g., beyond RLIMIT_MEMLOCK) is
+  // used as any other buffer
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = (size_t)pages * PageFile::PAGE_SIZE;
+  if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) == 0) {
+    fixedBuf = (char*)buf;
+    fixedSize = iov.iov_len;
+  }
+#endif
+  return 0;
+}
+
+RC PageIO::read(PageId pid, void* buf, Callback done, void* arg)
+{
+  return queue(pid, buf, false, done, arg);
+}
+
+RC PageIO::write(PageId pid, const void* buf, Callback done, void* arg)
+{
+  return queue(pid, (void*)buf, true, done, arg);
+}
+
+RC PageIO::queue(PageId pid, void* buf, bool write, Callback done, void* arg)
+{
+  RC rc;
+
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (pid < 0) return RC_INVALID_PID;
+  if (freeSlots.empty() && (rc = wait(1)) < 0) return rc;
+
+  int   s = freeSlots.back();
+  Slot& slot = slots[s];
+  freeSlots.pop_back();
+  slot.done = done;
+  slot.arg = arg;
+  slot.pid = pid;
+  slot.rc = 0;
+  slot.write = write;
+  slot.iov.iov_base = buf;
+  slot.iov.iov_len = PageFile::PAGE_SIZE;
+  // the counts are shared by the threads of the server
+  __atomic_add_fetch(write ? &writeCount : &readCount, 1, __ATOMIC_RELAXED);
+
+  off_t offset = (off_t)pid * PageFile::PAGE_SIZE;
+  if (ringFd < 0) {
+    // done now; the callback comes with the next wait()
+    ssize_t n;
+    do {
+      n = write ? pwrite(fd, buf, PageFile::PAGE_SIZE, offset) : pread(fd, buf, PageFile::PAGE_SIZE, offset);
+    } while (n < 0 && errno == EINTR);
+    if (n != PageFile::PAGE_SIZE) slot.rc = write ? RC_FILE_WRITE_FAILED : RC_FILE_READ_FAILED;
+    doneSlots.push_back(s);
+    return 0;
+  }
+
+#ifdef HAVE_IO_URING
+  // the slots never outnumber the ring entries, so the ring has room
+  unsigned tail = *sqTail;
+  unsigned idx = tail & *sqMask;
+  struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes + idx;
+  char* b = (char*)buf;
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->user_data = s;
+  if (fixedBuf != NULL && b >= fixedBuf && b + PageFile::PAGE_SIZE <= fixedBuf + fixedSize) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->addr = (unsigned long)b;
+    sqe->len = PageFile::PAGE_SIZE;
+    sqe->buf_index = 0;
+  } else {
+    sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->addr = (unsigned long)&slot.iov;
+    sqe->len = 1;
+  }
+  sqArray[idx] = idx;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+  queued++;
+#endif
+  return 0;
+}
+
+RC PageIO::submit()
+{
+#ifdef HAVE_IO_URING
+  while (ringFd >= 0 && queued > 0) {
+    int n = syscall(__NR_io_uring_enter, ringFd, queued, 0, 0, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_READ_FAILED;
+    }
+    queued -= n;
+  }
+#endif
+  return 0;
+}
+
+RC PageIO::wait(int count)
+{
+  int done = 0;
+
+  if (count > pending()) count = pending();
+  while (done < count) {
+    // the synchronous requests are done already
+    if (!doneSlots.empty()) {
+      vector<int> finished;
+      finished.swap(doneSlots);
+      for (unsigned i = 0; i < finished.size(); i++) complete(finished[i], slots[finished[i]].rc);
+      done += finished.size();
+      continue;
+    }
+    if (ringFd < 0) break;
+
+    if ((done += reap()) >= count) break;
+#ifdef HAVE_IO_URING
+    int n = syscall(__NR_io_uring_enter, ringFd, queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_READ_FAILED;
+    }
+    queued -= n;
+#endif
+  }
+  return 0;
+}
+
+/*
+ * complete the requests in the completion ring.
+ * @return the number of requests completed
+ */
+int PageIO::reap()
+{
+  int n = 0;
+
+#ifdef HAVE_IO_URING
+  unsigned head = *cqHead;
+  unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe* cqe = (struct io_uring_cqe*)cqes + (head & *cqMask);
+    int s = cqe->user_data;
+    int res = cqe->res;
+
+    // the entry is free for the kernel before the callback runs
+    __atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+    if (res == PageFile::PAGE_SIZE) complete(s, 0);
+    else complete(s, slots[s].write ? RC_FILE_WRITE_FAILED : RC_FILE_READ_FAILED);
+    n++;
+  }
+#endif
+  return n;
+}
+
+void PageIO::complete(int s, RC rc)
+{
+  Slot slot = slots[s];
+
+  // the callback may queue the next request in the slot
+  freeSlots.push_back(s);
+  if (slot.done != NULL) slot.done(slot.arg, slot.pid, rc);
+}
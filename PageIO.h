@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PAGEIO_H
+#define PAGEIO_H
+
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * PageIO: asynchronous page reads and writes on a file with the same
+ * page layout as PageFile.
+ * Requests are queued by read() and write(), handed to the kernel in one
+ * system call by submit(), and completed by wait(), which calls the
+ * callback of every finished request. Up to the queue depth requests are
+ * in flight at once, so a batch of random page reads costs about one
+ * device latency instead of one per page.
+ *
+ * On Linux the requests go through an io_uring; a buffer registered with
+ * registerBuffer() is pinned once, so that requests on it need no page
+ * mapping per I/O. Where io_uring is not available (an old kernel, or a
+ * sandbox that forbids it), every request is done with pread()/pwrite()
+ * when it is queued and completed by the next wait(), so the callers see
+ * the same behavior.
+ *
+ * PageIO has its own file descriptor and no page cache: pages written
+ * through a PageFile are seen, but a file must not be written through
+ * both at once. Like PageFile, a PageIO object is not thread-safe; the
+ * page counts are shared by all threads.
+ */
+class PageIO {
+ public:
+  /**
+   * called by wait() when a request is done.
+   * @param arg[IN] the argument given with the request
+   * @param pid[IN] the PageId of the request
+   * @param rc[IN] 0 if the page was read or written; otherwise an error code
+   */
+  typedef void (*Callback)(void* arg, PageId pid, RC rc);
+
+  /// the number of requests in flight by default
+  static const int DEFAULT_DEPTH = 64;
+
+  PageIO();
+  ~PageIO();
+
+  /**
+   * open a file for page I/O.
+   * @param filename[IN] the name of the file
+   * @param mode[IN] 'r' for read, 'w' for read and write (the file is
+   *                 created if it does not exist)
+   * @param depth[IN] the largest number of requests in flight
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode, int depth = DEFAULT_DEPTH);
+
+  /**
+   * wait for the requests in flight and close the file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return true if the file is open
+   */
+  bool isOpen() const { return fd >= 0; }
+
+  /**
+   * @return true if requests are done by io_uring, false if synchronously
+   */
+  bool isAsync() const { return ringFd >= 0; }
+
+  /**
+   * register the buffer that most requests read into or write from; the
+   * kernel pins it until close().
+   * @param buf[IN] the buffer
+   * @param pages[IN] its size in pages
+   * @return error code. 0 if no error (also if requests are synchronous)
+   */
+  RC registerBuffer(void* buf, int pages);
+
+  /**
+   * queue a read of a page. A full queue is completed first by wait().
+   * @param pid[IN] the page to read
+   * @param buf[OUT] where to read the page; PageFile::PAGE_SIZE bytes
+   *                 that stay valid until the callback
+   * @param done[IN] the callback; NULL for none
+   * @param arg[IN] the argument of the callback
+   * @return error code. 0 if no error
+   */
+  RC read(PageId pid, void* buf, Callback done, void* arg);
+
+  /**
+   * queue a write of a page, as read() does.
+   * @param pid[IN] the page to write
+   * @param buf[IN] the page
+   * @param done[IN] the callback; NULL for none
+   * @param arg[IN] the argument of the callback
+   * @return error code. 0 if no error
+   */
+  RC write(PageId pid, const void* buf, Callback done, void* arg);
+
+  /**
+   * hand the queued requests to the kernel without waiting for them.
+   * @return error code. 0 if no error
+   */
+  RC submit();
+
+  /**
+   * submit the queued requests and wait until count of the requests
+   * (all of them, if fewer) are done, calling their callbacks.
+   * @param count[IN] the number of requests to wait for
+   * @return error code. 0 if no error; the errors of the requests go to
+   *         their callbacks
+   */
+  RC wait(int count = 1);
+
+  /**
+   * wait for all requests.
+   * @return error code. 0 if no error
+   */
+  RC drain() { return wait(pending()); }
+
+  /**
+   * @return the number of requests queued or in flight
+   */
+  int pending() const { return depth - freeSlots.size(); }
+
+  /**
+   * @return the number of pages read and written through PageIO, by
+   *         all threads
+   */
+  static long getPageReadCount() { return __atomic_load_n(&readCount, __ATOMIC_RELAXED); }
+  static long getPageWriteCount() { return __atomic_load_n(&writeCount, __ATOMIC_RELAXED); }
+
+ private:
+  /// a request queued or in flight
+  struct Slot {
+    Callback done;
+    void*    arg;
+    PageId   pid;
+    RC       rc;      /// the result of a synchronous request
+    bool     write;
+    struct iovec iov; /// the page buffer
+  };
+
+  PageIO(const PageIO&);
+  PageIO& operator=(const PageIO&);
+
+  RC   setupRing();
+  void closeRing();
+  RC   queue(PageId pid, void* buf, bool write, Callback done, void* arg);
+  int  reap();
+  void complete(int slot, RC rc);
+
+  int    fd;
+  int    depth;           /// the number of slots
+  std::vector<Slot> slots;
+  std::vector<int>  freeSlots;
+  std::vector<int>  doneSlots;  /// synchronous requests not completed yet
+  char*  fixedBuf;        /// the registered buffer; NULL if none
+  size_t fixedSize;
+
+  // the io_uring, if any
+  int       ringFd;
+  void*     sqRing;
+  void*     cqRing;
+  void*     sqes;
+  size_t    sqRingSize;
+  size_t    cqRingSize;
+  size_t    sqesSize;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned* cqMask;
+  void*     cqes;
+  unsigned  queued;       /// requests in the submission queue, not submitted
+
+  static long readCount;
+  static long writeCount;
+};
+
+#endif /* PAGEIO_H */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <time.h>
+#include "QueryStats.h"
+
+using namespace std;
+
+static pthread_mutex_t totalsMutex = PTHREAD_MUTEX_INITIALIZER;
+static QueryStats      totals;                // the sum of all recorded stats
+static long            cacheHits = 0;
+static map<string, long> statementsByPlan;
+
+QueryStats::QueryStats()
+{
+  plan = "none";
+  cacheHit = false;
+  timed = false;
+  pageReads = pageWrites = 0;
+  heapFetches = zoneSkips = rows = 0;
+  openTime = accessTime = fetchTime = outputTime = totalTime = 0;
+}
+
+void QueryStats::addIndex(const IndexCounters& before, const IndexCounters& after)
+{
+  index.locates += after.locates - before.locates;
+  index.nodeReads += after.nodeReads - before.nodeReads;
+  index.leafReads += after.leafReads - before.leafReads;
+  index.postingReads += after.postingReads - before.postingReads;
+  index.runReads += after.runReads - before.runReads;
+  index.inserts += after.inserts - before.inserts;
+  index.splits += after.splits - before.splits;
+}
+
+int QueryStats::format(char* buf, int size) const
+{
+  return snprintf(buf, size,
+    "-- plan: %s%s\n"
+    "-- open:   %9.3f ms\n"
+    "-- access: %9.3f ms  locates %ld, nodes %ld, leaves %ld, posting pages %ld, run pages %ld, zone skips %ld\n"
+    "-- fetch:  %9.3f ms  tuples %ld\n"
+    "-- output: %9.3f ms  rows %ld\n"
+    "-- total:  %9.3f ms  page reads %ld, page writes %ld\n",
+    plan, cacheHit ? " (cached result)" : "",
+    openTime * 1e3,
+    accessTime * 1e3, index.locates, index.nodeReads, index.leafReads, index.postingReads, index.runReads, zoneSkips,
+    fetchTime * 1e3, heapFetches,
+    outputTime * 1e3, rows,
+    totalTime * 1e3, pageReads, pageWrites);
+}
+
+double QueryStats::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void QueryStats::record(const QueryStats& stats)
+{
+  pthread_mutex_lock(&totalsMutex);
+  statementsByPlan[stats.plan]++;
+  if (stats.cacheHit) cacheHits++;
+  totals.pageReads += stats.pageReads;
+  totals.pageWrites += stats.pageWrites;
+  totals.addIndex(IndexCounters(), stats.index);
+  totals.heapFetches += stats.heapFetches;
+  totals.zoneSkips += stats.zoneSkips;
+  totals.rows += stats.rows;
+  totals.totalTime += stats.totalTime;
+  pthread_mutex_unlock(&totalsMutex);
+}
+
+void QueryStats::dump(FILE* out)
+{
+  pthread_mutex_lock(&totalsMutex);
+  for (map<string, long>::iterator it = statementsByPlan.begin(); it != statementsByPlan.end(); ++it) {
+    fprintf(out, "bruinbase_statements_total{plan=\"%s\"} %ld\n", it->first.c_str(), it->second);
+  }
+  fprintf(out, "bruinbase_cache_hits_total %ld\n", cacheHits);
+  fprintf(out, "bruinbase_page_reads_total %ld\n", totals.pageReads);
+  fprintf(out, "bruinbase_page_writes_total %ld\n", totals.pageWrites);
+  fprintf(out, "bruinbase_index_locates_total %ld\n", totals.index.locates);
+  fprintf(out, "bruinbase_index_node_reads_total %ld\n", totals.index.nodeReads);
+  fprintf(out, "bruinbase_index_leaf_reads_total %ld\n", totals.index.leafReads);
+  fprintf(out, "bruinbase_index_posting_reads_total %ld\n", totals.index.postingReads);
+  fprintf(out, "bruinbase_index_run_reads_total %ld\n", totals.index.runReads);
+  fprintf(out, "bruinbase_index_inserts_total %ld\n", totals.index.inserts);
+  fprintf(out, "bruinbase_index_splits_total %ld\n", totals.index.splits);
+  fprintf(out, "bruinbase_heap_fetches_total %ld\n", totals.heapFetches);
+  fprintf(out, "bruinbase_zone_skips_total %ld\n", totals.zoneSkips);
+  fprintf(out, "bruinbase_rows_total %ld\n", totals.rows);
+  fprintf(out, "bruinbase_statement_seconds_total %.6f\n", totals.totalTime);
+  pthread_mutex_unlock(&totalsMutex);
+  fflush(out);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef QUERYSTATS_H
+#define QUERYSTATS_H
+
+#include <cstdio>
+#include "BTreeIndex.h"
+
+/**
+ * QueryStats: what one statement did, for PROFILE SELECT and for the
+ * cumulative statistics of the process that record() maintains and
+ * dump() prints for monitoring.
+ * The page counts come from the process-wide counters of PageFile, so
+ * they include the pages read by concurrent statements.
+ */
+struct QueryStats {
+  const char* plan;     /// the access path, e.g., "key index range"
+  bool   cacheHit;      /// answered from the result cache
+  bool   timed;         /// time the operators (PROFILE)
+
+  long   pageReads;     /// PageFile pages read
+  long   pageWrites;    /// PageFile pages written
+  IndexCounters index;  /// the work of the B+tree indexes
+  long   heapFetches;   /// tuples read from the table file
+  long   zoneSkips;     /// table pages skipped by the zone map
+  long   rows;          /// tuples returned
+
+  double openTime;      /// getting the table handles
+  double accessTime;    /// running the access path, without fetchTime
+  double fetchTime;     /// reading tuples from the table file (if timed)
+  double outputTime;    /// writing the result
+  double totalTime;
+
+  QueryStats();
+
+  /**
+   * add the counts of an index between two snapshots
+   */
+  void addIndex(const IndexCounters& before, const IndexCounters& after);
+
+  /**
+   * print the stats as "-- " lines for PROFILE.
+   * @param buf[OUT] the text
+   * @param size[IN] the size of buf
+   * @return the length of the text
+   */
+  int format(char* buf, int size) const;
+
+  /**
+   * @return a monotonic time in seconds
+   */
+  static double now();
+
+  /**
+   * add stats to the cumulative statistics of the process.
+   * @param stats[IN] the stats of a finished statement
+   */
+  static void record(const QueryStats& stats);
+
+  /**
+   * print the cumulative statistics in the Prometheus text format.
+   * @param out[IN] where to print
+   */
+  static void dump(FILE* out);
+};
+
+#endif /* QUERYSTATS_H */
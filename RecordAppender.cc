@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "RecordAppender.h"
+
+// a page starts with the number of records in it, followed by the slots
+static int getRecordCount(const char* page)
+{
+  int count;
+  memcpy(&count, page, sizeof(count));
+  return count;
+}
+
+static void setRecordCount(char* page, int count)
+{
+  memcpy(page, &count, sizeof(count));
+}
+
+static char* slotPtr(char* page, int sid)
+{
+  return page + sizeof(int) + sid * RecordFile::RECORD_SIZE;
+}
+
+RecordAppender::RecordAppender()
+{
+  fd = -1;
+  pages = NULL;
+  firstPid = 0;
+  erid.pid = erid.sid = 0;
+}
+
+RecordAppender::~RecordAppender()
+{
+  if (fd >= 0) close();
+}
+
+RC RecordAppender::open(const std::string& filename)
+{
+  if (fd >= 0) return RC_FILE_OPEN_FAILED;
+
+  if ((fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644)) < 0) {
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  void* p;
+  if (posix_memalign(&p, PageFile::PAGE_SIZE, BATCH_PAGES * PageFile::PAGE_SIZE) != 0) {
+    ::close(fd);
+    fd = -1;
+    return RC_FILE_OPEN_FAILED;
+  }
+  pages = (char*)p;
+  memset(pages, 0, PageFile::PAGE_SIZE);
+
+  // continue on the last page if it still has free slots
+  off_t  size = lseek(fd, 0, SEEK_END);
+  PageId epid = size / PageFile::PAGE_SIZE;
+  erid.pid = epid;
+  erid.sid = 0;
+  if (epid > 0) {
+    if (pread(fd, pages, PageFile::PAGE_SIZE, (off_t)(epid - 1) * PageFile::PAGE_SIZE) != PageFile::PAGE_SIZE) {
+      close();
+      return RC_FILE_READ_FAILED;
+    }
+    int count = getRecordCount(pages);
+    if (count < RecordFile::RECORDS_PER_PAGE) {
+      erid.pid = epid - 1;
+      erid.sid = count;
+    } else {
+      memset(pages, 0, PageFile::PAGE_SIZE);
+    }
+  }
+  firstPid = erid.pid;
+
+  return 0;
+}
+
+RC RecordAppender::close()
+{
+  RC rc = 0;
+
+  if (fd < 0) return RC_FILE_CLOSE_FAILED;
+
+  rc = flush();
+  if (::close(fd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  free(pages);
+  fd = -1;
+  pages = NULL;
+  erid.pid = erid.sid = 0;
+
+  return rc;
+}
+
+RC RecordAppender::append(int key, const char* value, int len, RecordId& rid)
+{
+  RC rc;
+
+  // the batch is full, so write it out first
+  if (erid.pid - firstPid == BATCH_PAGES) {
+    if ((rc = flush()) < 0) return rc;
+  }
+
+  char* page = pages + (erid.pid - firstPid) * PageFile::PAGE_SIZE;
+  char* ptr = slotPtr(page, erid.sid);
+
+  // values are truncated and null-terminated as RecordFile does
+  if (len >= RecordFile::MAX_VALUE_LENGTH) len = RecordFile::MAX_VALUE_LENGTH - 1;
+  memcpy(ptr, &key, sizeof(key));
+  memcpy(ptr + sizeof(key), value, len);
+  ptr[sizeof(key) + len] = 0;
+  setRecordCount(page, erid.sid + 1);
+
+  rid = erid;
+  if (++erid.sid == RecordFile::RECORDS_PER_PAGE) {
+    erid.pid++;
+    erid.sid = 0;
+    if (erid.pid - firstPid < BATCH_PAGES) {
+      memset(page + PageFile::PAGE_SIZE, 0, PageFile::PAGE_SIZE);
+    }
+  }
+
+  return 0;
+}
+
+RC RecordAppender::flush()
+{
+  // pages to write: all full pages plus the partially filled last one
+  int npages = erid.pid - firstPid + (erid.sid > 0 ? 1 : 0);
+  if (npages == 0) return 0;
+
+  const char* buf = pages;
+  size_t      left = npages * PageFile::PAGE_SIZE;
+  off_t       offset = (off_t)firstPid * PageFile::PAGE_SIZE;
+  while (left > 0) {
+    ssize_t n = pwrite(fd, buf, left, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_WRITE_FAILED;
+    }
+    buf += n;
+    offset += n;
+    left -= n;
+  }
+
+  // keep the partially filled last page; it is rewritten by the next flush
+  if (erid.sid > 0) {
+    if (erid.pid != firstPid) {
+      memcpy(pages, pages + (erid.pid - firstPid) * PageFile::PAGE_SIZE, PageFile::PAGE_SIZE);
+    }
+  } else {
+    memset(pages, 0, PageFile::PAGE_SIZE);
+  }
+  firstPid = erid.pid;
+
+  return 0;
+}
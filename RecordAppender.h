@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RECORDAPPENDER_H
+#define RECORDAPPENDER_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/**
+ * RecordAppender: bulk-append mode for a table file.
+ * Records are laid out exactly as RecordFile::append() would lay them out,
+ * but whole pages are filled in memory and written BATCH_PAGES at a time
+ * with a single pwrite(), instead of a read-modify-write of the last page
+ * for every record. Only a partially filled last page is ever rewritten.
+ * The table file must not be opened through RecordFile while the
+ * appender is open.
+ */
+class RecordAppender {
+ public:
+  RecordAppender();
+  ~RecordAppender();
+
+  /**
+   * open the table file for appending. the file is created if it
+   * does not exist.
+   * @param filename[IN] the name of the table file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * write out all pending pages and close the table file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * append a (key, value) record to the end of the table.
+   * the record reaches the disk when its page batch is written.
+   * @param key[IN] the key of the record
+   * @param value[IN] the value of the record (need not be null-terminated)
+   * @param len[IN] the length of value
+   * @param rid[OUT] the RecordId assigned to the record
+   * @return error code. 0 if no error
+   */
+  RC append(int key, const char* value, int len, RecordId& rid);
+
+  /**
+   * write all pending pages to the table file.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * @return the RecordId that the next appended record will get
+   */
+  const RecordId& endRid() const { return erid; }
+
+ private:
+  static const int BATCH_PAGES = 64;  /// pages written per system call
+
+  int      fd;
+  char*    pages;     /// BATCH_PAGES pages being filled
+  PageId   firstPid;  /// PageId of the first page in pages
+  RecordId erid;      /// the RecordId of the next record
+};
+
+#endif /* RECORDAPPENDER_H */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include "RecordFetcher.h"
+
+using namespace std;
+
+// min() takes the batch size by reference
+const int RecordFetcher::MAX_BATCH;
+
+RecordFetcher::RecordFetcher()
+{
+  pages = NULL;
+  for (int i = 0; i < MAX_BATCH; i++) pagePid[i] = -1;
+}
+
+RecordFetcher::~RecordFetcher()
+{
+  if (isOpen()) close();
+}
+
+RC RecordFetcher::open(const string& filename)
+{
+  RC rc;
+
+  if (isOpen()) return RC_FILE_OPEN_FAILED;
+
+  void* p;
+  if (posix_memalign(&p, PageFile::PAGE_SIZE, MAX_BATCH * PageFile::PAGE_SIZE) != 0) {
+    return RC_FILE_OPEN_FAILED;
+  }
+  pages = (char*)p;
+  for (int i = 0; i < MAX_BATCH; i++) pagePid[i] = -1;
+
+  if ((rc = io.open(filename, 'r', MAX_BATCH)) < 0 ||
+      (rc = io.registerBuffer(pages, MAX_BATCH)) < 0) {
+    if (io.isOpen()) io.close();
+    free(pages);
+    pages = NULL;
+    return rc;
+  }
+  return 0;
+}
+
+RC RecordFetcher::close()
+{
+  if (!isOpen()) return RC_FILE_CLOSE_FAILED;
+
+  // the buffer stays registered until the ring is gone
+  RC rc = io.close();
+  free(pages);
+  pages = NULL;
+  return rc;
+}
+
+void RecordFetcher::pageRead(void* arg, PageId pid, RC rc)
+{
+  *(RC*)arg = rc;
+}
+
+RC RecordFetcher::fetch(const RecordId* rids, int n, int* keys, string* values)
+{
+  int slotOf[MAX_BATCH];
+  bool used[MAX_BATCH];
+  RC  rc;
+
+  if (n < 0 || n > MAX_BATCH) return RC_INVALID_ATTRIBUTE;
+  for (int s = 0; s < MAX_BATCH; s++) used[s] = false;
+
+  // every page of the batch gets a buffer: the one that has it from the
+  // previous batch, or one no RecordId of this batch uses
+  for (int i = 0; i < n; i++) {
+    int s;
+    for (s = 0; s < MAX_BATCH && pagePid[s] != rids[i].pid; s++);
+    if (s == MAX_BATCH) {
+      for (s = 0; used[s]; s++);
+      pagePid[s] = rids[i].pid;
+      pageRc[s] = 0;
+      if ((rc = io.read(rids[i].pid, pages + s * PageFile::PAGE_SIZE, pageRead, &pageRc[s])) < 0) {
+        pagePid[s] = -1;
+        return rc;
+      }
+    }
+    used[s] = true;
+    slotOf[i] = s;
+  }
+  if ((rc = io.drain()) < 0) return rc;
+
+  for (int i = 0; i < n; i++) {
+    int s = slotOf[i];
+    if (pageRc[s] < 0) {
+      pagePid[s] = -1;
+      return pageRc[s];
+    }
+
+    // a page starts with the number of records in it, followed by the slots
+    const char* page = pages + s * PageFile::PAGE_SIZE;
+    int count;
+    memcpy(&count, page, sizeof(count));
+    if (rids[i].sid < 0 || rids[i].sid >= count) return RC_INVALID_RID;
+
+    const char* ptr = page + sizeof(int) + rids[i].sid * RecordFile::RECORD_SIZE;
+    memcpy(&keys[i], ptr, sizeof(int));
+    values[i].assign(ptr + sizeof(int), strnlen(ptr + sizeof(int), RecordFile::MAX_VALUE_LENGTH));
+  }
+  return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RECORDFETCHER_H
+#define RECORDFETCHER_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "PageIO.h"
+
+/**
+ * RecordFetcher: reads the tuples of a batch of RecordIds from a table
+ * file, e.g., the RecordIds an index scan returned, with the distinct
+ * pages of the batch read at once through PageIO. The pages land in a
+ * buffer registered with PageIO, and the pages of the previous batch are
+ * kept, so a page shared by consecutive batches is read once.
+ * Records are decoded as RecordFile lays them out (see RecordAppender).
+ * The table file must not be written while the fetcher is open.
+ */
+class RecordFetcher {
+ public:
+  /// the largest number of RecordIds in a batch, and of pages in flight
+  static const int MAX_BATCH = 64;
+
+  RecordFetcher();
+  ~RecordFetcher();
+
+  /**
+   * open a table file for reading.
+   * @param filename[IN] the name of the table file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * close the table file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return true if the table file is open
+   */
+  bool isOpen() const { return io.isOpen(); }
+
+  /**
+   * read the tuples of a batch of RecordIds.
+   * @param rids[IN] the RecordIds
+   * @param n[IN] their number, up to MAX_BATCH
+   * @param keys[OUT] the keys of the tuples, in the order of rids
+   * @param values[OUT] the values of the tuples, in the order of rids
+   * @return error code. 0 if no error
+   */
+  RC fetch(const RecordId* rids, int n, int* keys, std::string* values);
+
+ private:
+  RecordFetcher(const RecordFetcher&);
+  RecordFetcher& operator=(const RecordFetcher&);
+
+  static void pageRead(void* arg, PageId pid, RC rc);
+
+  PageIO io;
+  char*  pages;                 /// MAX_BATCH page buffers, registered with io
+  PageId pagePid[MAX_BATCH];    /// the page in each buffer; -1 if none
+  RC     pageRc[MAX_BATCH];     /// the result of reading it
+};
+
+#endif /* RECORDFETCHER_H */
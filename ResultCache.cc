@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ResultCache.h"
+
+using namespace std;
+
+ResultCache::ResultCache(size_t budget)
+{
+  this->budget = budget;
+  size = 0;
+  pthread_mutex_init(&mutex, NULL);
+}
+
+ResultCache::~ResultCache()
+{
+  pthread_mutex_destroy(&mutex);
+}
+
+size_t ResultCache::cost(const Entry& e)
+{
+  return sizeof(Entry) + e.key.size() + e.table.size() + e.result.size();
+}
+
+void ResultCache::erase(EntryList::iterator it)
+{
+  size -= cost(*it);
+  entries.erase(it->key);
+  lru.erase(it);
+}
+
+void ResultCache::evict()
+{
+  while (size > budget && !lru.empty()) erase(--lru.end());
+}
+
+unsigned ResultCache::getVersion(const string& table)
+{
+  pthread_mutex_lock(&mutex);
+  unsigned version = versions[table];
+  pthread_mutex_unlock(&mutex);
+  return version;
+}
+
+void ResultCache::bump(const string& table)
+{
+  pthread_mutex_lock(&mutex);
+  versions[table]++;
+  for (EntryList::iterator it = lru.begin(); it != lru.end(); ) {
+    if (it->table == table) erase(it++);
+    else ++it;
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+bool ResultCache::lookup(const string& key, string& result)
+{
+  bool found = false;
+
+  pthread_mutex_lock(&mutex);
+  map<string, EntryList::iterator>::iterator e = entries.find(key);
+  if (e != entries.end()) {
+    EntryList::iterator it = e->second;
+    if (it->version != versions[it->table]) {
+      erase(it);
+    } else {
+      lru.splice(lru.begin(), lru, it);
+      result = it->result;
+      found = true;
+    }
+  }
+  pthread_mutex_unlock(&mutex);
+  return found;
+}
+
+void ResultCache::store(const string& table, unsigned version,
+                        const string& key, const string& result)
+{
+  Entry e;
+
+  e.key = key;
+  e.table = table;
+  e.version = version;
+  e.result = result;
+  if (cost(e) > budget) return;
+
+  pthread_mutex_lock(&mutex);
+  if (version == versions[table]) {
+    map<string, EntryList::iterator>::iterator old = entries.find(key);
+    if (old != entries.end()) erase(old->second);
+
+    lru.push_front(e);
+    entries[key] = lru.begin();
+    size += cost(e);
+    evict();
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void ResultCache::setBudget(size_t budget)
+{
+  pthread_mutex_lock(&mutex);
+  this->budget = budget;
+  evict();
+  pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <pthread.h>
+
+/**
+ * ResultCache: the formatted output of recent SELECTs, so that a
+ * repeated query is answered without any page I/O.
+ * Entries are looked up by a key that identifies the query; the caller
+ * normalizes the query into it. Every table has a version that is bumped
+ * whenever the table changes; an entry stored under an older version of
+ * its table is never returned again. When the entries take more than
+ * the memory budget, the least recently used ones are evicted.
+ * All methods may be called from several threads.
+ */
+class ResultCache {
+ public:
+  /**
+   * @param budget[IN] the memory budget in bytes; 0 disables the cache
+   */
+  ResultCache(size_t budget);
+  ~ResultCache();
+
+  /**
+   * @return the current version of table
+   */
+  unsigned getVersion(const std::string& table);
+
+  /**
+   * drop the entries of table and bump its version.
+   * @param table[IN] the table that changed
+   */
+  void bump(const std::string& table);
+
+  /**
+   * find the result stored under key and mark it as recently used.
+   * @param key[IN] the normalized query
+   * @param result[OUT] the stored result
+   * @return true if a current result was found
+   */
+  bool lookup(const std::string& key, std::string& result);
+
+  /**
+   * store result under key, unless table changed since version was read.
+   * @param table[IN] the table the query read
+   * @param version[IN] the version of table when the query started
+   * @param key[IN] the normalized query
+   * @param result[IN] the formatted result of the query
+   */
+  void store(const std::string& table, unsigned version,
+             const std::string& key, const std::string& result);
+
+  /**
+   * change the memory budget, evicting entries as needed.
+   * @param budget[IN] the memory budget in bytes; 0 disables the cache
+   */
+  void setBudget(size_t budget);
+
+  /**
+   * @return the memory budget in bytes
+   */
+  size_t getBudget() const { return budget; }
+
+  /**
+   * @return the bytes taken by the entries
+   */
+  size_t getSize() const { return size; }
+
+ private:
+  struct Entry {
+    std::string key;
+    std::string table;
+    unsigned    version;
+    std::string result;
+  };
+  typedef std::list<Entry> EntryList;
+
+  /// the bytes an entry is charged for
+  static size_t cost(const Entry& e);
+
+  void erase(EntryList::iterator it);
+  void evict();
+
+  EntryList lru;   /// the entries, most recently used first
+  std::map<std::string, EntryList::iterator> entries;  /// by key
+  std::map<std::string, unsigned> versions;            /// by table
+  size_t budget;
+  size_t size;
+  pthread_mutex_t mutex;
+};
+
+#endif /* RESULTCACHE_H */
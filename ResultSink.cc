@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "ResultSink.h"
+
+/*
+ * write the iovecs completely, retrying on partial writes.
+ */
+static RC writeAll(int fd, struct iovec* iov, int iovcnt)
+{
+  while (iovcnt > 0) {
+    ssize_t n = writev(fd, iov, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_WRITE_FAILED;
+    }
+    // skip the iovecs that were written completely
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 0;
+}
+
+ResultSink::ResultSink(int fd, Format format)
+{
+  this->fd = fd;
+  used = 0;
+  this->format = format;
+  offset = 0;
+  limit = -1;
+  rows = 0;
+  copy = NULL;
+  copyMax = 0;
+}
+
+ResultSink::~ResultSink()
+{
+  flush();
+}
+
+RC ResultSink::flush()
+{
+  if (used == 0) return 0;
+
+  // anything printed through stdio (e.g., the prompt) must go out first
+  fflush(stdout);
+
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = used;
+  used = 0;
+  return writeAll(fd, &iov, 1);
+}
+
+void ResultSink::capture(std::string* copy, size_t max)
+{
+  this->copy = copy;
+  copyMax = max;
+}
+
+RC ResultSink::put(const char* data, int len)
+{
+  if (copy != NULL) {
+    // give up the copy once it grows too large
+    if (copy->size() + len <= copyMax) copy->append(data, len);
+    else copy = NULL;
+  }
+
+  if (len <= BUFFER_SIZE - used) {
+    memcpy(buffer + used, data, len);
+    used += len;
+    return 0;
+  }
+
+  // does not fit: send the pending buffer and the data in one system call
+  fflush(stdout);
+
+  struct iovec iov[2];
+  iov[0].iov_base = buffer;
+  iov[0].iov_len = used;
+  iov[1].iov_base = (void*)data;
+  iov[1].iov_len = len;
+  used = 0;
+  return writeAll(fd, iov, 2);
+}
+
+RC ResultSink::putInt(int v)
+{
+  char  digits[12];
+  char* p = digits + sizeof(digits);
+  // work on the negative value so that INT_MIN does not overflow
+  int   n = (v < 0) ? v : -v;
+
+  do {
+    *--p = '0' - (n % 10);
+    n /= 10;
+  } while (n != 0);
+  if (v < 0) *--p = '-';
+
+  return put(p, digits + sizeof(digits) - p);
+}
+
+RC ResultSink::putRaw(int v)
+{
+  return put((const char*)&v, sizeof(v));
+}
+
+void ResultSink::setLimit(int offset, int limit)
+{
+  this->offset = (offset > 0) ? offset : 0;
+  this->limit = (limit >= 0) ? limit : -1;
+}
+
+RC ResultSink::emit(int attr, int key, const char* value, int len)
+{
+  RC rc = 0;
+
+  if (offset > 0) {
+    offset--;
+    return 0;
+  }
+  if (limit == 0) return 0;
+  if (limit > 0) limit--;
+  rows++;
+
+  if (format == BINARY) {
+    if ((rc = put("R", 1)) < 0) return rc;
+    if (attr == 1 || attr == 3) {
+      if ((rc = putRaw(key)) < 0) return rc;
+    }
+    if (attr == 2 || attr == 3) {
+      if ((rc = putRaw(len)) < 0) return rc;
+      rc = put(value, len);
+    }
+    return rc;
+  }
+
+  switch (attr) {
+  case 1:  // SELECT key
+    if ((rc = putInt(key)) < 0) return rc;
+    return put("\n", 1);
+  case 2:  // SELECT value
+    if ((rc = put(value, len)) < 0) return rc;
+    return put("\n", 1);
+  case 3:  // SELECT *
+    if ((rc = putInt(key)) < 0) return rc;
+    if ((rc = put(" '", 2)) < 0) return rc;
+    if ((rc = put(value, len)) < 0) return rc;
+    return put("'\n", 2);
+  }
+  return 0;
+}
+
+RC ResultSink::emitJoin(int attr, int key, const char* left, int leftLen,
+                         const char* right, int rightLen)
+{
+  RC rc = 0;
+
+  if (offset > 0) {
+    offset--;
+    return 0;
+  }
+  if (limit == 0) return 0;
+  if (limit > 0) limit--;
+  rows++;
+
+  if (format == BINARY) {
+    if ((rc = put("J", 1)) < 0) return rc;
+    if (attr == 1 || attr == 3) {
+      if ((rc = putRaw(key)) < 0) return rc;
+    }
+    if (attr == 2 || attr == 3) {
+      if ((rc = putRaw(leftLen)) < 0) return rc;
+      if ((rc = put(left, leftLen)) < 0) return rc;
+      if ((rc = putRaw(rightLen)) < 0) return rc;
+      rc = put(right, rightLen);
+    }
+    return rc;
+  }
+
+  // as emit(), with the values quoted since there are two
+  if (attr == 1 || attr == 3) {
+    if ((rc = putInt(key)) < 0) return rc;
+    if (attr == 1) return put("\n", 1);
+    if ((rc = put(" ", 1)) < 0) return rc;
+  }
+  if ((rc = put("'", 1)) < 0) return rc;
+  if ((rc = put(left, leftLen)) < 0) return rc;
+  if ((rc = put("' '", 3)) < 0) return rc;
+  if ((rc = put(right, rightLen)) < 0) return rc;
+  return put("'\n", 2);
+}
+
+RC ResultSink::emitCount(int count)
+{
+  RC rc;
+
+  if (format == BINARY) {
+    if ((rc = put("C", 1)) < 0) return rc;
+    return putRaw(count);
+  }
+
+  if ((rc = putInt(count)) < 0) return rc;
+  return put("\n", 1);
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <string>
+#include "Bruinbase.h"
+
+/**
+ * ResultSink: the buffered output channel for SELECT results.
+ * Rows are formatted into one large buffer (integers are formatted by hand)
+ * and handed to the kernel with write()/writev() only when the buffer fills
+ * up or the query ends. Values that do not fit into the remaining buffer
+ * are written straight from the caller's memory with writev().
+ *
+ * In BINARY format every row is emitted as
+ *   'R' <int32 key> <int32 length> <length bytes of value>
+ * (key and/or value omitted depending on the SELECT attribute), a row of
+ * a join as
+ *   'J' <int32 key> <int32 length> <left value> <int32 length> <right value>
+ * (key and/or values omitted likewise) and the result of count(*) as
+ * 'C' <int32 count>, in host byte order.
+ */
+class ResultSink {
+ public:
+  enum Format { TEXT, BINARY };
+
+  /**
+   * @param fd[IN] the file descriptor to write the results to
+   * @param format[IN] the output format: TEXT or BINARY
+   */
+  ResultSink(int fd = 1, Format format = TEXT);
+
+  /**
+   * flushes any pending output.
+   */
+  ~ResultSink();
+
+  /**
+   * apply LIMIT/OFFSET to the tuples emitted from now on: the first
+   * offset tuples are dropped and at most limit tuples are written.
+   * the result of count(*) is not affected.
+   * @param offset[IN] the number of tuples to drop
+   * @param limit[IN] the maximum number of tuples to write; -1 for no limit
+   */
+  void setLimit(int offset, int limit);
+
+  /**
+   * @return true if the limit has been reached, so the query can stop
+   */
+  bool full() const { return limit == 0; }
+
+  /**
+   * @return the number of tuples that are still to be dropped
+   */
+  int toSkip() const { return offset; }
+
+  /**
+   * record that the caller skipped count tuples of the offset itself.
+   * @param count[IN] the number of tuples skipped
+   */
+  void skipped(int count) { offset -= count; }
+
+  /**
+   * emit one matching tuple.
+   * @param attr[IN] attribute in the SELECT clause (1: key, 2: value, 3: *)
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple (need not be null-terminated)
+   * @param len[IN] the length of value
+   * @return error code. 0 if no error
+   */
+  RC emit(int attr, int key, const char* value, int len);
+
+  /**
+   * emit one row of a join: the key and the values of the two tables.
+   * @param attr[IN] 1: key, 2: the two values, 3: all three
+   * @param key[IN] the key of the row
+   * @param left[IN] the value of the left table (need not be null-terminated)
+   * @param leftLen[IN] the length of left
+   * @param right[IN] the value of the right table
+   * @param rightLen[IN] the length of right
+   * @return error code. 0 if no error
+   */
+  RC emitJoin(int attr, int key, const char* left, int leftLen, const char* right, int rightLen);
+
+  /**
+   * emit the result of "SELECT count(*)".
+   * @param count[IN] the number of matching tuples
+   * @return error code. 0 if no error
+   */
+  RC emitCount(int count);
+
+  /**
+   * write output that is already formatted, e.g., a cached result.
+   * @param data[IN] the output
+   * @param len[IN] the length of data
+   * @return error code. 0 if no error
+   */
+  RC write(const char* data, int len) { return put(data, len); }
+
+  /**
+   * keep a copy of all output from now on in copy, as long as the copy
+   * stays within max bytes.
+   * @param copy[IN] the string to append the output to
+   * @param max[IN] the largest copy worth keeping
+   */
+  void capture(std::string* copy, size_t max);
+
+  /**
+   * @return true if copy holds all output since capture()
+   */
+  bool isCaptured() const { return copy != NULL; }
+
+  /**
+   * @return the number of tuples written
+   */
+  int getRowCount() const { return rows; }
+
+  /**
+   * write all buffered output to the file descriptor.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * @return the output format of this sink
+   */
+  Format getFormat() const { return format; }
+
+ private:
+  static const int BUFFER_SIZE = 64 * 1024;
+
+  RC put(const char* data, int len);
+  RC putInt(int v);
+  RC putRaw(int v);
+
+  char   buffer[BUFFER_SIZE];
+  int    used;    /// number of bytes pending in buffer
+  int    fd;
+  Format format;
+  int    offset;  /// number of tuples still to be dropped
+  int    limit;   /// number of tuples still to be written; -1: no limit
+  int    rows;    /// number of tuples written
+  std::string* copy;     /// the copy of the output; NULL if none
+  size_t       copyMax;  /// the largest copy to keep
+};
+
+#endif /* RESULTSINK_H */
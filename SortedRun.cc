@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include "SortedRun.h"
+#include "BTreeKey.h"
+
+using namespace std;
+
+// min() takes the page geometry by reference
+template <class KeyT> const int SortedRunT<KeyT>::PAGE_ENTRIES;
+template <class KeyT> const int SortedRunT<KeyT>::PAGE_FENCES;
+
+template <class KeyT>
+SortedRunT<KeyT>::SortedRunT()
+{
+  count = 0;
+  dataPages = 0;
+  pagePid = 0;
+  pageReads = 0;
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::create(const string& filename)
+{
+  RC rc;
+
+  // a run left behind by an index that was rebuilt is replaced
+  drop(filename);
+  if ((rc = pf.open(filename, 'w')) < 0) return rc;
+  count = 0;
+  dataPages = 0;
+  pagePid = 0;
+  fences.clear();
+
+  // the header is written again by finish()
+  return writeHeader();
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::append(const KeyT& key, const RecordId& rid)
+{
+  int slot = count % PAGE_ENTRIES;
+  RC  rc;
+
+  if (slot == 0) fences.push_back(key);
+  memcpy(page + slot * ENTRY_SIZE, &key, sizeof(KeyT));
+  memcpy(page + slot * ENTRY_SIZE + sizeof(KeyT), &rid, sizeof(RecordId));
+  count++;
+
+  // the file grows one full page at a time
+  if (slot == PAGE_ENTRIES - 1) {
+    if ((rc = pf.write(count / PAGE_ENTRIES, page)) < 0) return rc;
+  }
+  return 0;
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::finish()
+{
+  char buf[PageFile::PAGE_SIZE];
+  RC   rc;
+
+  dataPages = (count + PAGE_ENTRIES - 1) / PAGE_ENTRIES;
+  if (count % PAGE_ENTRIES != 0) {
+    if ((rc = pf.write(dataPages, page)) < 0) return rc;
+  }
+
+  for (int i = 0; i < dataPages; i += PAGE_FENCES) {
+    int n = min(PAGE_FENCES, dataPages - i);
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &fences[i], n * sizeof(KeyT));
+    if ((rc = pf.write(1 + dataPages + i / PAGE_FENCES, buf)) < 0) return rc;
+  }
+  pagePid = 0;
+  return writeHeader();
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::writeHeader()
+{
+  char buf[PageFile::PAGE_SIZE];
+  int  header[4] = { RUN_MAGIC, KeyTraits<KeyT>::TYPE_ID, count, dataPages };
+
+  memset(buf, 0, sizeof(buf));
+  memcpy(buf, header, sizeof(header));
+  return pf.write(0, buf);
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::open(const string& filename)
+{
+  char buf[PageFile::PAGE_SIZE];
+  int  header[4];
+  RC   rc;
+
+  if ((rc = pf.open(filename, 'r')) < 0) return rc;
+  if ((rc = pf.read(0, buf)) < 0) {
+    pf.close();
+    return rc;
+  }
+  memcpy(header, buf, sizeof(header));
+  count = header[2];
+  dataPages = header[3];
+  if (header[0] != RUN_MAGIC || header[1] != KeyTraits<KeyT>::TYPE_ID || count < 0 ||
+      dataPages != (count + PAGE_ENTRIES - 1) / PAGE_ENTRIES) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  fences.resize(dataPages);
+  for (int i = 0; i < dataPages; i += PAGE_FENCES) {
+    if ((rc = pf.read(1 + dataPages + i / PAGE_FENCES, buf)) < 0) {
+      pf.close();
+      return rc;
+    }
+    memcpy(&fences[i], buf, min(PAGE_FENCES, dataPages - i) * sizeof(KeyT));
+  }
+  pagePid = 0;
+  return 0;
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::close()
+{
+  count = 0;
+  dataPages = 0;
+  pagePid = 0;
+  fences.clear();
+  return pf.close();
+}
+
+template <class KeyT>
+void SortedRunT<KeyT>::drop(const string& filename)
+{
+  unlink(filename.c_str());
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::readPage(PageId pid)
+{
+  RC rc;
+
+  if (pid == pagePid) return 0;
+  pageReads++;
+  if ((rc = pf.read(pid, page)) < 0) {
+    pagePid = 0;
+    return rc;
+  }
+  pagePid = pid;
+  return 0;
+}
+
+template <class KeyT>
+RC SortedRunT<KeyT>::read(int pos, KeyT& key, RecordId& rid)
+{
+  RC rc;
+
+  if (pos < 0 || pos >= count) return RC_INVALID_CURSOR;
+  if ((rc = readPage(1 + pos / PAGE_ENTRIES)) < 0) return rc;
+
+  const char* entry = page + (pos % PAGE_ENTRIES) * ENTRY_SIZE;
+  memcpy(&key, entry, sizeof(KeyT));
+  memcpy(&rid, entry + sizeof(KeyT), sizeof(RecordId));
+  return 0;
+}
+
+template <class KeyT>
+int SortedRunT<KeyT>::findPosition(const KeyT& searchKey, bool last)
+{
+  // the position is in the last page whose fence is passed, or at the
+  // start of the page after it
+  int lo = 0, hi = dataPages;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (fences[mid] < searchKey || (last && fences[mid] == searchKey))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0) return 0;
+
+  int p = lo - 1;
+  RC  rc;
+  if ((rc = readPage(1 + p)) < 0) return rc;
+
+  KeyT key;
+  lo = 0;
+  hi = min(PAGE_ENTRIES, count - p * PAGE_ENTRIES);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    memcpy(&key, page + mid * ENTRY_SIZE, sizeof(KeyT));
+    if (key < searchKey || (last && key == searchKey))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return p * PAGE_ENTRIES + lo;
+}
+
+template class SortedRunT<int>;
+template class SortedRunT<int64_t>;
+template class SortedRunT<StringKey>;
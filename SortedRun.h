@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef SORTEDRUN_H
+#define SORTEDRUN_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/// the largest number of sorted runs in front of a BTreeIndexT
+const int MAX_INDEX_RUNS = 8;
+
+/**
+ * SortedRunT: an immutable file of (key, RecordId) entries in key order,
+ * written sequentially in one pass by create(), append() and finish().
+ *
+ * Page 0 holds the header; the entries fill the data pages behind it,
+ * PAGE_ENTRIES to a page, and the first key of every data page (its
+ * fence) is stored in the pages behind the data. The fences are kept in
+ * memory while the run is open, so finding a key reads one data page.
+ * Entries with equal keys keep the order in which they were appended.
+ */
+template <class KeyT>
+class SortedRunT {
+ public:
+  SortedRunT();
+
+  /**
+   * create the run file, replacing any file of that name.
+   * @param filename[IN] the name of the run file
+   * @return error code. 0 if no error
+   */
+  RC create(const std::string& filename);
+
+  /**
+   * add an entry behind the entries appended so far.
+   * @param key[IN] the key; not smaller than the key of the last entry
+   * @param rid[IN] the RecordId
+   * @return error code. 0 if no error
+   */
+  RC append(const KeyT& key, const RecordId& rid);
+
+  /**
+   * write the last data page, the fences and the header. The run can be
+   * read from then on.
+   * @return error code. 0 if no error
+   */
+  RC finish();
+
+  /**
+   * open a run file written before, for reading.
+   * @param filename[IN] the name of the run file
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * close the run file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * delete a run file.
+   * @param filename[IN] the name of the run file
+   */
+  static void drop(const std::string& filename);
+
+  /**
+   * @return the number of entries
+   */
+  int size() const { return count; }
+
+  /**
+   * read an entry.
+   * @param pos[IN] the position of the entry, from 0 to size() - 1
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId
+   * @return error code. 0 if no error
+   */
+  RC read(int pos, KeyT& key, RecordId& rid);
+
+  /**
+   * @return the position of the first entry with a key >= searchKey
+   *         (> searchKey if last); size() if there is none. An error
+   *         code if the data page cannot be read
+   */
+  int findPosition(const KeyT& searchKey, bool last);
+
+  /**
+   * @return the data pages read by read() and findPosition() since the
+   *         object was constructed, over all the runs it held
+   */
+  long getPageReads() const { return pageReads; }
+
+ private:
+  static const int RUN_MAGIC = 0x42525531;
+  static const int ENTRY_SIZE = sizeof(KeyT) + sizeof(RecordId);
+  static const int PAGE_ENTRIES = PageFile::PAGE_SIZE / ENTRY_SIZE;
+  static const int PAGE_FENCES = PageFile::PAGE_SIZE / sizeof(KeyT);
+
+  RC readPage(PageId pid);
+  RC writeHeader();
+
+  PageFile pf;
+  int      count;        /// the number of entries
+  int      dataPages;    /// the number of data pages, from page 1 on
+  std::vector<KeyT> fences;  /// the first key of every data page
+  char     page[PageFile::PAGE_SIZE];  /// the data page last read or being filled
+  PageId   pagePid;      /// the PageId of page; 0 if none
+  long     pageReads;    /// data pages read
+};
+
+#endif /* SORTEDRUN_H */
@@ -10,13 +10,26 @@
 #include <cstdio>
 #include <cstring>
 #include <string>
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "HashIndex.h"
+#include "ResultSink.h"
+#include "ResultCache.h"
+#include "Catalog.h"
+#include "QueryStats.h"
+#include "RecordAppender.h"
+#include "ZoneMap.h"
 #include <climits>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -37,40 +50,827 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
-RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
+/*
+ * compute the range [lowKey, highKey] of the keys that can satisfy
+ * the conditions on the key column.
+ * @return true if there is any such condition
+ */
+static bool getKeyRange(const vector<SelCond>& cond, int& lowKey, int& highKey)
+{
+  bool found = false;
+
+  lowKey = INT_MIN;
+  highKey = INT_MAX;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) continue;
+
+    int v = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (v > lowKey) lowKey = v;
+      if (v < highKey) highKey = v;
+      break;
+    case SelCond::GT:
+      if (v == INT_MAX) { lowKey = INT_MAX; highKey = INT_MIN; }
+      else if (v + 1 > lowKey) lowKey = v + 1;
+      break;
+    case SelCond::GE:
+      if (v > lowKey) lowKey = v;
+      break;
+    case SelCond::LT:
+      if (v == INT_MIN) { lowKey = INT_MAX; highKey = INT_MIN; }
+      else if (v - 1 < highKey) highKey = v - 1;
+      break;
+    case SelCond::LE:
+      if (v < highKey) highKey = v;
+      break;
+    case SelCond::NE:
+      continue;
+    }
+    found = true;
+  }
+  return found;
+}
+
+/*
+ * compute the range [lowValue, highValue] of the value index keys that
+ * can satisfy the conditions on the value column. the index keys are
+ * value prefixes, so strict bounds are kept inclusive. a prefix
+ * predicate is a range, e.g., value >= 'abc' AND value < 'abd'.
+ * @param equality[OUT] true if there is an equality condition
+ * @return true if there is any such condition
+ */
+static bool getValueRange(const vector<SelCond>& cond, StringKey& lowValue, StringKey& highValue, bool& equality)
 {
-  RecordFile rf;   // RecordFile containing the table
-  RecordId   rid;  // record cursor for table scanning
+  bool found = false;
+
+  lowValue = KeyTraits<StringKey>::minValue();
+  memset(highValue.data, 0xff, StringKey::LENGTH);
+  equality = false;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 2) continue;
+
+    StringKey v(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      equality = true;
+      if (v > lowValue) lowValue = v;
+      if (v < highValue) highValue = v;
+      break;
+    case SelCond::GT:
+    case SelCond::GE:
+      if (v > lowValue) lowValue = v;
+      break;
+    case SelCond::LT:
+    case SelCond::LE:
+      if (v < highValue) highValue = v;
+      break;
+    case SelCond::NE:
+      continue;
+    }
+    found = true;
+  }
+  return found;
+}
+
+/*
+ * read the tuple at rid from the table file for a select.
+ */
+static RC fetch(RecordFile& rf, const RecordId& rid, int& key, string& value, QueryStats& qs)
+{
+  RC rc;
+
+  qs.heapFetches++;
+  if (!qs.timed) return rf.read(rid, key, value);
+
+  double t0 = QueryStats::now();
+  rc = rf.read(rid, key, value);
+  qs.fetchTime += QueryStats::now() - t0;
+  return rc;
+}
+
+/*
+ * read the tuples of up to RecordFetcher::MAX_BATCH RecordIds, through
+ * the RecordFetcher of the table if it is open.
+ */
+static RC fetchBatch(TableHandles& h, const RecordId* rids, int n, int* keys, string* values,
+                     QueryStats& qs)
+{
+  RC rc = 0;
+
+  qs.heapFetches += n;
+  double t0 = qs.timed ? QueryStats::now() : 0;
+  if (h.heap.isOpen()) {
+    rc = h.heap.fetch(rids, n, keys, values);
+  } else {
+    for (int i = 0; i < n && rc == 0; i++) rc = h.rf.read(rids[i], keys[i], values[i]);
+  }
+  if (qs.timed) qs.fetchTime += QueryStats::now() - t0;
+  return rc;
+}
+
+/*
+ * HeapBatch: the tuples of the RecordIds an index returns, read from the
+ * table file a batch at a time through the RecordFetcher of the table,
+ * so that the table pages of a batch are read at once, and checked
+ * against the conditions in index order. A batch grows from one up to
+ * RecordFetcher::MAX_BATCH RecordIds, so that a lookup of a few tuples or
+ * a LIMIT reads hardly more tuples than it returns.
+ */
+class HeapBatch {
+ public:
+  HeapBatch(TableHandles& h, int attr, const vector<SelCond>& cond, ResultSink& sink, QueryStats& qs)
+    : h(h), attr(attr), cond(cond), sink(sink), qs(qs), n(0), size(1), count(0) {}
+
+  /**
+   * add a RecordId; a full batch is read and checked.
+   * @return error code. 0 if no error
+   */
+  RC add(const RecordId& rid)
+  {
+    rids[n++] = rid;
+    return n == size ? flush() : 0;
+  }
+
+  /**
+   * read and check the tuples of the batch.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * @return the number of tuples that matched
+   */
+  int getCount() const { return count; }
+
+ private:
+  TableHandles&           h;
+  int                     attr;
+  const vector<SelCond>&  cond;
+  ResultSink&             sink;
+  QueryStats&             qs;
+  RecordId rids[RecordFetcher::MAX_BATCH];
+  int      keys[RecordFetcher::MAX_BATCH];
+  string   values[RecordFetcher::MAX_BATCH];
+  int      n;      // RecordIds in the batch
+  int      size;   // the size of the next batch
+  int      count;
+};
+
+RC HeapBatch::flush()
+{
+  RC rc = 0;
+
+  if (n == 0) return 0;
+  if ((rc = fetchBatch(h, rids, n, keys, values, qs)) < 0) return rc;
+
+  for (int i = 0; i < n && !sink.full(); i++) {
+    if (checkOnTuple(attr, keys[i], values[i], cond, sink)) count++;
+  }
+  n = 0;
+  if (size < RecordFetcher::MAX_BATCH) size *= 2;
+  return 0;
+}
+
+/*
+ * answer a select from the value index: every entry in
+ * [lowValue, highValue] is a candidate, and its tuple is checked
+ * against all conditions since the index holds only a value prefix.
+ */
+static RC selectByValue(int attr, TableHandles& h, const StringKey& lowValue, const StringKey& highValue,
+                        const vector<SelCond>& cond, ResultSink& sink, QueryStats& qs)
+{
+  BTreeIndexT<StringKey>& tree = h.valueTree;
+  HeapBatch   batch(h, attr, cond, sink, qs);
+  IndexCursor cursor;
+  StringKey   prefix;
+  RecordId    rid;
+  RC          rc;
+
+  tree.locate(lowValue, cursor);
+  while (!sink.full() && tree.readForward(cursor, prefix, rid) == 0) {
+    if (prefix > highValue) break;
+    if ((rc = batch.add(rid)) < 0) return rc;
+  }
+  if ((rc = batch.flush()) < 0) return rc;
+
+  if (attr == 4) {
+    sink.emitCount(batch.getCount());
+  }
+  return 0;
+}
+
+/*
+ * answer a select with a key equality condition from the hash index.
+ */
+static RC selectByHash(int attr, TableHandles& h, int searchKey,
+                       const vector<SelCond>& cond, ResultSink& sink, QueryStats& qs)
+{
+  HashIndex&  hash = h.hash;
+  HeapBatch   batch(h, attr, cond, sink, qs);
+  IndexCursor cursor;
+  RecordId    rid;
+  RC          rc;
+  int         key;
+
+  if (hash.locate(searchKey, cursor) == 0) {
+    while (!sink.full() && hash.readForward(cursor, key, rid) == 0) {
+      if ((rc = batch.add(rid)) < 0) return rc;
+    }
+    if ((rc = batch.flush()) < 0) return rc;
+  }
+
+  if (attr == 4) {
+    sink.emitCount(batch.getCount());
+  }
+  return 0;
+}
+
+/*
+ * true if the tuples in the key range of cond match all of cond, so that
+ * an OFFSET can be skipped in the index without reading the tuples.
+ */
+static bool isKeyRangeOnly(const vector<SelCond>& cond)
+{
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1 || cond[i].comp == SelCond::NE) return false;
+  }
+  return true;
+}
+
+/*
+ * skip the OFFSET of sink in the index when no tuple needs to be checked.
+ */
+template <class KeyT>
+static void skipOffset(int attr, BTreeIndexT<KeyT>& tree, IndexCursor& cursor,
+                       const vector<SelCond>& cond, ResultSink& sink, bool backward = false)
+{
+  int skipped;
+
+  if (attr == 4 || sink.toSkip() == 0 || !isKeyRangeOnly(cond)) return;
+  if (tree.skip(cursor, sink.toSkip(), skipped, backward) == 0) sink.skipped(skipped);
+}
+
+/*
+ * answer a select in descending key order by reading the index
+ * backward from the largest key in [lowKey, highKey].
+ */
+static RC selectBackward(int attr, TableHandles& h, int lowKey, int highKey,
+                         const vector<SelCond>& cond, ResultSink& sink, QueryStats& qs)
+{
+  BTreeIndex& tree = h.tree;
+  HeapBatch   batch(h, attr, cond, sink, qs);
+  IndexCursor cursor;
+  RecordId    rid;
+  RC          rc;
+  int         indexKey;
+
+  if (lowKey <= highKey) {
+    tree.locateLast(highKey, cursor);
+    skipOffset(attr, tree, cursor, cond, sink, true);
+    while (!sink.full() && tree.readBackward(cursor, indexKey, rid) == 0 && indexKey >= lowKey) {
+      if ((rc = batch.add(rid)) < 0) return rc;
+    }
+    if ((rc = batch.flush()) < 0) return rc;
+  }
+
+  if (attr == 4) {
+    sink.emitCount(batch.getCount());
+  }
+  return 0;
+}
+
+/*
+ * answer a select of the tuples whose key is in keys (sorted, without
+ * duplicates): the keys are located in the key index in one batch, so
+ * that the descents overlap, or looked up in the hash index, or matched
+ * by a scan of the table.
+ */
+static RC selectKeys(int attr, TableHandles& h, const vector<int>& keys,
+                     const vector<SelCond>& cond, ResultSink& sink, QueryStats& qs)
+{
+  HeapBatch batch(h, attr, cond, sink, qs);
+  RecordId  rid;
+  RC        rc;
+  int       key;
+  string    value;
+  int       count = 0;
+
+  if (h.hasTree && !keys.empty()) {
+    qs.plan = "key index IN";
+    vector<IndexCursor> cursors(keys.size());
+    vector<RC>          results(keys.size());
+    if ((rc = h.tree.locateBatch(&keys[0], keys.size(), &cursors[0], &results[0])) < 0) return rc;
+    for (unsigned i = 0; i < keys.size() && !sink.full(); i++) {
+      if (results[i] != 0) continue;
+      while (!sink.full() && h.tree.readForward(cursors[i], key, rid) == 0 && key == keys[i]) {
+        if ((rc = batch.add(rid)) < 0) return rc;
+      }
+    }
+    if ((rc = batch.flush()) < 0) return rc;
+  } else if (h.hasHash) {
+    qs.plan = "hash index IN";
+    IndexCursor cursor;
+    for (unsigned i = 0; i < keys.size() && !sink.full(); i++) {
+      if (h.hash.locate(keys[i], cursor) != 0) continue;
+      while (!sink.full() && h.hash.readForward(cursor, key, rid) == 0) {
+        if ((rc = batch.add(rid)) < 0) return rc;
+      }
+    }
+    if ((rc = batch.flush()) < 0) return rc;
+  } else if (!keys.empty()) {
+    qs.plan = "scan IN";
+    for (rid.pid = rid.sid = 0; rid < h.rf.endRid() && !sink.full(); rid++) {
+      if ((rc = fetch(h.rf, rid, key, value, qs)) < 0) return rc;
+      if (binary_search(keys.begin(), keys.end(), key) &&
+          checkOnTuple(attr, key, value, cond, sink)) count++;
+    }
+  }
+
+  if (attr == 4) {
+    sink.emitCount(count + batch.getCount());
+  }
+  return 0;
+}
+
+/*
+ * a tuple of one side of a join: its key and RecordId, and its value
+ * once it is read
+ */
+struct JoinTuple {
+  int      key;
+  RecordId rid;
+  string   value;
+};
+
+static bool joinKeyLess(const JoinTuple& a, const JoinTuple& b)
+{
+  return a.key < b.key;
+}
+
+/*
+ * JoinContext: the two tables of a join and where its rows go
+ */
+struct JoinContext {
+  JoinContext(int attr, TableHandles& left, TableHandles& right, const vector<SelCond>& cond,
+              ResultSink& sink, QueryStats& qs)
+    : attr(attr), left(left), right(right), cond(cond), sink(sink), qs(qs), count(0)
+  {
+    needValues = (attr == 2 || attr == 3);
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].attr != 1) needValues = true;
+    }
+  }
+
+  int                     attr;
+  TableHandles&           left;
+  TableHandles&           right;
+  const vector<SelCond>&  cond;
+  ResultSink&             sink;
+  QueryStats&             qs;
+  bool                    needValues;  // the values are selected or checked
+  int                     count;       // the rows that matched
+};
+
+/*
+ * check the conditions of a join on a row: attr 1 is the key, 2 the
+ * value of the left and 3 the value of the right table.
+ */
+static bool checkJoin(int key, const string& left, const string& right, const vector<SelCond>& cond)
+{
+  for (unsigned i = 0; i < cond.size(); i++) {
+    int diff = 0;
+    switch (cond[i].attr) {
+    case 1: diff = key - atoi(cond[i].value); break;
+    case 2: diff = strcmp(left.c_str(), cond[i].value); break;
+    case 3: diff = strcmp(right.c_str(), cond[i].value); break;
+    }
+
+    switch (cond[i].comp) {
+    case SelCond::EQ: if (diff != 0) return false; break;
+    case SelCond::NE: if (diff == 0) return false; break;
+    case SelCond::GT: if (diff <= 0) return false; break;
+    case SelCond::LT: if (diff >= 0) return false; break;
+    case SelCond::GE: if (diff < 0) return false; break;
+    case SelCond::LE: if (diff > 0) return false; break;
+    }
+  }
+  return true;
+}
+
+/*
+ * read the values of tuples[from, to) from the table.
+ */
+static RC fetchValues(TableHandles& h, vector<JoinTuple>& tuples, int from, int to, QueryStats& qs)
+{
+  RecordId rids[RecordFetcher::MAX_BATCH];
+  int      keys[RecordFetcher::MAX_BATCH];
+  string   values[RecordFetcher::MAX_BATCH];
+  RC       rc;
+
+  for (int i = from; i < to; i += RecordFetcher::MAX_BATCH) {
+    int n = min(RecordFetcher::MAX_BATCH, to - i);
+    for (int k = 0; k < n; k++) rids[k] = tuples[i + k].rid;
+    if ((rc = fetchBatch(h, rids, n, keys, values, qs)) < 0) return rc;
+    for (int k = 0; k < n; k++) tuples[i + k].value.swap(values[k]);
+  }
+  return 0;
+}
+
+/*
+ * emit the rows of the tuples of both tables with one key: left[lfrom,
+ * lto) paired with right[rfrom, rto). the values of a side are read
+ * first unless it has them (e.g., a side that was scanned).
+ */
+static RC joinGroups(JoinContext& jc, vector<JoinTuple>& left, int lfrom, int lto, bool leftRead,
+                     vector<JoinTuple>& right, int rfrom, int rto, bool rightRead)
+{
+  RC rc;
+
+  if (jc.needValues) {
+    if (!leftRead && (rc = fetchValues(jc.left, left, lfrom, lto, jc.qs)) < 0) return rc;
+    if (!rightRead && (rc = fetchValues(jc.right, right, rfrom, rto, jc.qs)) < 0) return rc;
+  }
+  for (int i = lfrom; i < lto; i++) {
+    for (int j = rfrom; j < rto; j++) {
+      if (jc.sink.full()) return 0;
+      if (!checkJoin(left[i].key, left[i].value, right[j].value, jc.cond)) continue;
+      jc.count++;
+      if (jc.attr != 4) {
+        jc.sink.emitJoin(jc.attr, left[i].key, left[i].value.data(), left[i].value.size(),
+                         right[j].value.data(), right[j].value.size());
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * read the next index entry with a key <= highKey into t.
+ * @return true if there is one
+ */
+static bool nextEntry(BTreeIndex& tree, IndexCursor& cursor, int highKey, JoinTuple& t)
+{
+  return tree.readForward(cursor, t.key, t.rid) == 0 && t.key <= highKey;
+}
+
+/*
+ * sort-merge join of two tables with key indexes: both leaf chains are
+ * read forward from lowKey and the runs of equal keys are paired.
+ */
+static RC mergeJoin(JoinContext& jc, int lowKey, int highKey)
+{
+  BTreeIndex&       lt = jc.left.tree;
+  BTreeIndex&       rt = jc.right.tree;
+  IndexCursor       lcursor, rcursor;
+  JoinTuple         l, r;
+  vector<JoinTuple> lg, rg;
+  RC                rc;
+
+  lt.locate(lowKey, lcursor);
+  rt.locate(lowKey, rcursor);
+  bool lok = nextEntry(lt, lcursor, highKey, l);
+  bool rok = nextEntry(rt, rcursor, highKey, r);
+  while (lok && rok && !jc.sink.full()) {
+    if (l.key < r.key) {
+      lok = nextEntry(lt, lcursor, highKey, l);
+    } else if (r.key < l.key) {
+      rok = nextEntry(rt, rcursor, highKey, r);
+    } else {
+      int key = l.key;
+      lg.clear();
+      rg.clear();
+      for (; lok && l.key == key; lok = nextEntry(lt, lcursor, highKey, l)) lg.push_back(l);
+      for (; rok && r.key == key; rok = nextEntry(rt, rcursor, highKey, r)) rg.push_back(r);
+      if ((rc = joinGroups(jc, lg, 0, lg.size(), false, rg, 0, rg.size(), false)) < 0) return rc;
+    }
+  }
+  return 0;
+}
+
+/*
+ * read the tuples of a table with a key in [lowKey, highKey] by a scan,
+ * in key order.
+ */
+static RC scanSorted(TableHandles& h, int lowKey, int highKey, vector<JoinTuple>& tuples, QueryStats& qs)
+{
+  JoinTuple t;
+  RC        rc;
+
+  t.rid.pid = t.rid.sid = 0;
+  while (t.rid < h.rf.endRid()) {
+    // pages whose zone cannot match the key range are skipped
+    if (h.hasZones && t.rid.sid == 0 && !h.zones.mayContain(t.rid.pid, lowKey, highKey)) {
+      qs.zoneSkips++;
+      t.rid.pid++;
+      continue;
+    }
+    if ((rc = fetch(h.rf, t.rid, t.key, t.value, qs)) < 0) return rc;
+    if (t.key >= lowKey && t.key <= highKey) tuples.push_back(t);
+    t.rid++;
+  }
+  stable_sort(tuples.begin(), tuples.end(), joinKeyLess);
+  return 0;
+}
+
+/*
+ * sort-merge join of two tables that are not both indexed: both are
+ * scanned and sorted in memory.
+ */
+static RC sortJoin(JoinContext& jc, int lowKey, int highKey)
+{
+  vector<JoinTuple> left, right;
+  RC                rc;
+
+  if ((rc = scanSorted(jc.left, lowKey, highKey, left, jc.qs)) < 0) return rc;
+  if ((rc = scanSorted(jc.right, lowKey, highKey, right, jc.qs)) < 0) return rc;
+
+  unsigned i = 0, j = 0;
+  while (i < left.size() && j < right.size() && !jc.sink.full()) {
+    if (left[i].key < right[j].key) {
+      i++;
+    } else if (right[j].key < left[i].key) {
+      j++;
+    } else {
+      unsigned iend = i, jend = j;
+      while (iend < left.size() && left[iend].key == left[i].key) iend++;
+      while (jend < right.size() && right[jend].key == right[j].key) jend++;
+      if ((rc = joinGroups(jc, left, i, iend, true, right, j, jend, true)) < 0) return rc;
+      i = iend;
+      j = jend;
+    }
+  }
+  return 0;
+}
+
+/// the outer tuples of an index nested-loop join probed together
+static const int PROBE_BATCH = 256;
+
+/*
+ * look up the keys of outer[0, n), which is in key order, in the key
+ * index of inner and emit the rows.
+ */
+static RC probeInner(JoinContext& jc, bool outerLeft, vector<JoinTuple>& outer, bool outerRead)
+{
+  TableHandles&       inner = outerLeft ? jc.right : jc.left;
+  vector<int>         keys;
+  vector<IndexCursor> cursors;
+  vector<RC>          results;
+  vector<JoinTuple>   group;
+  JoinTuple           t;
+  RC                  rc;
+
+  for (unsigned i = 0; i < outer.size(); i++) {
+    if (keys.empty() || keys.back() != outer[i].key) keys.push_back(outer[i].key);
+  }
+  if (keys.empty()) return 0;
+  if (inner.hasTree) {
+    cursors.resize(keys.size());
+    results.resize(keys.size());
+    if ((rc = inner.tree.locateBatch(&keys[0], keys.size(), &cursors[0], &results[0])) < 0) return rc;
+  }
+
+  unsigned from = 0;
+  for (unsigned k = 0; k < keys.size() && !jc.sink.full(); k++) {
+    unsigned to = from;
+    while (to < outer.size() && outer[to].key == keys[k]) to++;
+
+    group.clear();
+    if (inner.hasTree) {
+      if (results[k] == 0) {
+        while (nextEntry(inner.tree, cursors[k], keys[k], t) && t.key == keys[k]) group.push_back(t);
+      }
+    } else {
+      IndexCursor cursor;
+      if (inner.hash.locate(keys[k], cursor) == 0) {
+        while (inner.hash.readForward(cursor, t.key, t.rid) == 0) group.push_back(t);
+      }
+    }
+    if (!group.empty()) {
+      rc = outerLeft ? joinGroups(jc, outer, from, to, outerRead, group, 0, group.size(), false)
+                     : joinGroups(jc, group, 0, group.size(), false, outer, from, to, outerRead);
+      if (rc < 0) return rc;
+    }
+    from = to;
+  }
+  return 0;
+}
+
+/*
+ * index nested-loop join: the outer table is read by its key index, or
+ * scanned, PROBE_BATCH tuples at a time, and their keys are looked up
+ * in the key index of the inner table.
+ */
+static RC indexJoin(JoinContext& jc, bool outerLeft, int lowKey, int highKey)
+{
+  TableHandles&     outer = outerLeft ? jc.left : jc.right;
+  vector<JoinTuple> chunk;
+  JoinTuple         t;
+  RC                rc;
+
+  if (outer.hasTree) {
+    IndexCursor cursor;
+    outer.tree.locate(lowKey, cursor);
+    bool more = nextEntry(outer.tree, cursor, highKey, t);
+    while (more && !jc.sink.full()) {
+      chunk.clear();
+      for (; more && (int)chunk.size() < PROBE_BATCH; more = nextEntry(outer.tree, cursor, highKey, t)) {
+        chunk.push_back(t);
+      }
+      if ((rc = probeInner(jc, outerLeft, chunk, false)) < 0) return rc;
+    }
+    return 0;
+  }
+
+  // a scanned outer table has its values, and is sorted by chunks
+  for (t.rid.pid = t.rid.sid = 0; t.rid < outer.rf.endRid() && !jc.sink.full(); t.rid++) {
+    if ((rc = fetch(outer.rf, t.rid, t.key, t.value, jc.qs)) < 0) return rc;
+    if (t.key < lowKey || t.key > highKey) continue;
+    chunk.push_back(t);
+    if ((int)chunk.size() == PROBE_BATCH) {
+      stable_sort(chunk.begin(), chunk.end(), joinKeyLess);
+      if ((rc = probeInner(jc, outerLeft, chunk, true)) < 0) return rc;
+      chunk.clear();
+    }
+  }
+  stable_sort(chunk.begin(), chunk.end(), joinKeyLess);
+  return probeInner(jc, outerLeft, chunk, true);
+}
+
+/*
+ * the estimated cost of reading the tuples of a table with a key in
+ * [lowKey, highKey], in pages: the tuples and the leaves holding them,
+ * or the table pages of a scan.
+ */
+struct JoinSideCost {
+  double tuples;    // the tuples in the key range
+  double leaves;    // the leaves of the key index holding them
+  double scan;      // the pages of the table
+};
+
+static JoinSideCost joinSideCost(TableHandles& h, int lowKey, int highKey)
+{
+  JoinSideCost c;
+  RecordId     end = h.rf.endRid();
+
+  c.scan = end.pid + 1;
+  c.tuples = (double)end.pid * RecordFile::RECORDS_PER_PAGE + end.sid;
+  c.leaves = c.scan;
+  if (!h.hasTree) return c;
+
+  const IndexStats& stats = h.tree.getStats();
+  int count = stats.keyCount;
+  if (count > 0 && (lowKey != INT_MIN || highKey != INT_MAX)) {
+    int est = h.tree.estimateCount(lowKey, highKey);
+    if (est >= 0) c.tuples = c.tuples * est / count;
+  }
+
+  // a leaf is assumed half full when the statistics do not tell
+  double perLeaf = BTLeafNode::capacity(PageFile::PAGE_SIZE) / 2.0;
+  if (stats.nodeCount[0] > 0 && stats.entryCount[0] > 0) {
+    perLeaf = (double)stats.entryCount[0] / stats.nodeCount[0];
+  }
+  c.leaves = c.tuples / perLeaf;
+  return c;
+}
+
+/*
+ * run a join, writing its rows to sink.
+ */
+static RC runJoin(int attr, TableHandles& lh, TableHandles& rh, const vector<SelCond>& cond,
+                  int limit, int offset, int method, ResultSink& sink, QueryStats& qs)
+{
+  int lowKey, highKey;
+
+  if (attr != 4) sink.setLimit(offset, limit);
+  getKeyRange(cond, lowKey, highKey);
+
+  JoinContext jc(attr, lh, rh, cond, sink, qs);
+  JoinSideCost l = joinSideCost(lh, lowKey, highKey);
+  JoinSideCost r = joinSideCost(rh, lowKey, highKey);
+
+  // an index nested-loop join reads the outer table and about a page
+  // per outer tuple of the inner index (its upper levels are cached);
+  // a merge join reads both leaf chains, or scans both tables
+  double mergeCost = (lh.hasTree && rh.hasTree) ? l.leaves + r.leaves : l.scan + r.scan;
+  double leftOuter = -1, rightOuter = -1;
+  if (rh.hasTree || rh.hasHash) leftOuter = (lh.hasTree ? l.leaves : l.scan) + l.tuples;
+  if (lh.hasTree || lh.hasHash) rightOuter = (rh.hasTree ? r.leaves : r.scan) + r.tuples;
+
+  if (method == SqlEngine::AUTO_JOIN) {
+    method = SqlEngine::MERGE_JOIN;
+    if (leftOuter >= 0 && leftOuter < mergeCost) method = SqlEngine::INDEX_JOIN;
+    if (rightOuter >= 0 && rightOuter < mergeCost) method = SqlEngine::INDEX_JOIN;
+  }
+
+  RC rc = 0;
+  if (lowKey > highKey) {
+    qs.plan = "empty join";
+  } else if (method == SqlEngine::INDEX_JOIN) {
+    if (leftOuter < 0 && rightOuter < 0) return RC_INVALID_ATTRIBUTE;
+    bool outerLeft = rightOuter < 0 || (leftOuter >= 0 && leftOuter <= rightOuter);
+    qs.plan = "index nested-loop join";
+    rc = indexJoin(jc, outerLeft, lowKey, highKey);
+  } else if (lh.hasTree && rh.hasTree) {
+    qs.plan = "index merge join";
+    rc = mergeJoin(jc, lowKey, highKey);
+  } else {
+    qs.plan = "scan sort-merge join";
+    rc = sortJoin(jc, lowKey, highKey);
+  }
+  if (rc < 0) return rc;
+
+  if (attr == 4) {
+    sink.emitCount(jc.count);
+  }
+  return 0;
+}
+
+/*
+ * order tuples by descending key; tuples with equal keys keep their order
+ */
+static bool keyGreater(const pair<int, string>& a, const pair<int, string>& b)
+{
+  return a.first > b.first;
+}
+
+/*
+ * run a select, writing the matching tuples to sink.
+ */
+static RC runSelect(int attr, const string& table, const vector<SelCond>& cond,
+                    bool descending, int limit, int offset, TableHandles& h,
+                    ResultSink& sink, QueryStats& qs)
+{
+  RecordFile& rf = h.rf;  // RecordFile containing the table
+  RecordId    rid;        // record cursor for table scanning
 
   RC     rc;
   int    key;     
   string value;
   int    count;
   int    diff;
+  vector<pair<int, string> > sorted; // matching tuples of a scan to sort
 
-  // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-    return rc;
-  }
-  
-  BTreeIndex tree;
+  // a count has no order, and is a single row
+  if (attr == 4) descending = false;
+  else sink.setLimit(offset, limit);
+
+  BTreeIndex& tree = h.tree;
 
   //check if any condition on key
   int length = cond.size();
   bool isOnKey = false;
+  bool isKeyEquality = false;
 	for(int i = 0; i < length; i++){
 	  //on key  
 	  if(cond[i].attr == 1 && cond[i].comp != SelCond::NE){
 	    isOnKey = true;
-	    break;
+	    if(cond[i].comp == SelCond::EQ)
+	      isKeyEquality = true;
 	  }
 	}
 
+  //key equality: a hash index answers it in about one page read
+  int lowKey, highKey;
+  if(isKeyEquality && getKeyRange(cond, lowKey, highKey) && lowKey == highKey && h.hasHash){
+    qs.plan = "hash index";
+    if((rc = selectByHash(attr, h, lowKey, cond, sink, qs)) < 0)
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+  }
+
+  bool hasKeyIndex = (isOnKey || descending) && h.hasTree;
+
+  //descending order streams backward through the leaves. indexes from
+  //before the backward links leave it to the scan and a sort
+  if(hasKeyIndex && descending && !tree.hasBackLinks())
+    hasKeyIndex = false;
+
+  //use the value index for value conditions unless the key index is
+  //expected to do better: value equality beats anything but key equality
+  StringKey lowValue, highValue;
+  bool isValueEquality;
+  bool isOnValue = getValueRange(cond, lowValue, highValue, isValueEquality);
+  if(isOnValue && !descending && (!hasKeyIndex || (isValueEquality && !isKeyEquality)) &&
+     h.hasValueTree){
+    qs.plan = "value index";
+    if((rc = selectByValue(attr, h, lowValue, highValue, cond, sink, qs)) < 0)
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+  }
+
+  if(hasKeyIndex && descending){
+    qs.plan = "key index backward";
+    getKeyRange(cond, lowKey, highKey);
+    if((rc = selectBackward(attr, h, lowKey, highKey, cond, sink, qs)) < 0)
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+  }
+
   //if condition on key and index exists, use index
-  if(isOnKey && tree.open(table + ".idx", 'r') == 0){
+  if(hasKeyIndex){
     //"combine" range
-    int lowerBound = 0;
+    int lowerBound = INT_MIN;
     int upperBound = INT_MAX;
     int equalityVal;
     bool hasEquality = false;
@@ -104,94 +904,93 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 		  }
 		}
 
-		//if lowerBound > upperBound, return
+		//if lowerBound > upperBound, no tuple matches
 		if(lowerBound > upperBound){
-			tree.close();
-  		rf.close();
+			if (attr == 4) sink.emitCount(0);
 			return 0;
 		}
 
 		//check if equlity is within range
 		if(hasEquality && (equalityVal < lowerBound || equalityVal > upperBound)){
-			tree.close();
-  		rf.close();
+			if (attr == 4) sink.emitCount(0);
 			return 0;
 		}
 
 		//conditions make sense, so start query
 		if(hasEquality){
-      //cout << "checking eq cond" << endl;
+      qs.plan = "key index equality";
 			IndexCursor cursor;
 			if(tree.locate(equalityVal, cursor) == RC_NO_SUCH_RECORD){
-				tree.close();
-  			rf.close();
+				if (attr == 4) sink.emitCount(0);
 				return 0;
 			}
 
-			int count1 = 0;
-			//retrieve record from rf using rid
-			int key1 = 0;
+			//retrieve every record with the key from rf using rid, a batch
+			//of them at a time
+			HeapBatch batch(h, attr, cond, sink, qs);
+			int currentKey;
 			RecordId rid;
-			tree.readForward(cursor, key1, rid);
-			string stringValue;
-			if(rf.read(rid, key1, stringValue)){
-        cout << "read error\n";
-        tree.close();
-        rf.close();
-        return 0;
-      }
-
-			//check condition on this tuple
-      //cout << checkOnTuple(attr, key1, stringValue, cond) << endl;
-			if(checkOnTuple(attr, key1, stringValue, cond))
-				count1++;
+			skipOffset(attr, tree, cursor, cond, sink);
+			rc = 0;
+			while(rc == 0 && !sink.full() && tree.readForward(cursor, currentKey, rid) == 0 && currentKey == equalityVal)
+				rc = batch.add(rid);
+			if(rc < 0 || (rc = batch.flush()) < 0){
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				return rc;
+			}
 
 			if (attr == 4) {
-	      fprintf(stdout, "%d\n", count1);
+	      sink.emitCount(batch.getCount());
 	    }
 		}
 
 		else if(hasRange){
+			qs.plan = "key index range";
 			IndexCursor cursor;
 			tree.locate(lowerBound, cursor);
+			skipOffset(attr, tree, cursor, cond, sink);
 
+			HeapBatch batch(h, attr, cond, sink, qs);
 			int currentKey;
 			RecordId currentRid;
-			string stringValue;
-			int count2 = 0;
-			int key2 = 0;
-			while(tree.readForward(cursor, currentKey, currentRid) != RC_INVALID_CURSOR){
-				if(currentKey > upperBound)
+			rc = 0;
+			while(rc == 0 && tree.readForward(cursor, currentKey, currentRid) != RC_INVALID_CURSOR){
+				if(currentKey > upperBound || sink.full())
 					break;
-        if(rf.read(currentRid, key2, stringValue)){
-          cout << "read error\n";
-          tree.close();
-          rf.close();
-          return 0;
-        }
-				//rf.read(rid, key2, stringValue);
-				if(checkOnTuple(attr, key2, stringValue, cond)){
-					count2++;
-				}
+				rc = batch.add(currentRid);
+			}
+			if(rc < 0 || (rc = batch.flush()) < 0){
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				return rc;
 			}
 
 			if (attr == 4) {
-	      fprintf(stdout, "%d\n", count2);
+	      sink.emitCount(batch.getCount());
 	    }
 		}
 
-  	tree.close();
-  	rf.close();
   	return 0;
 	}
 
   else{ 
+    qs.plan = descending ? "scan and sort" : "scan";
+
+    // pages whose zone cannot match the key conditions are skipped
+    ZoneMap& zones = h.zones;
+    bool     useZones = getKeyRange(cond, lowKey, highKey) && h.hasZones;
+
     // scan the table file from the beginning
     rid.pid = rid.sid = 0;
     count = 0;
-    while (rid < rf.endRid()) {
+    while (rid < rf.endRid() && !sink.full()) {
+      if (useZones && rid.sid == 0 && !zones.mayContain(rid.pid, lowKey, highKey)) {
+        qs.zoneSkips++;
+        rid.pid++;
+        continue;
+      }
+
       // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
+      if ((rc = fetch(rf, rid, key, value, qs)) < 0) {
         fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
         goto exit_select;
       }
@@ -235,131 +1034,812 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
       // increase matching tuple counter
       count++;
 
-      // print the tuple 
-      switch (attr) {
-      case 1:  // SELECT key
-        fprintf(stdout, "%d\n", key);
-        break;
-      case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
-        break;
-      case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
-        break;
-      }
+      // print the tuple, or keep it for sorting
+      if (descending) sorted.push_back(make_pair(key, value));
+      else sink.emit(attr, key, value.data(), value.size());
 
       // move to the next tuple
       next_tuple:
       ++rid;
     }
 
+    if (descending) {
+      stable_sort(sorted.begin(), sorted.end(), keyGreater);
+      for (unsigned i = 0; i < sorted.size() && !sink.full(); i++) {
+        sink.emit(attr, sorted[i].first, sorted[i].second.data(), sorted[i].second.size());
+      }
+    }
+
     // print matching tuple count if "select count(*)"
     if (attr == 4) {
-      fprintf(stdout, "%d\n", count);
+      sink.emitCount(count);
     }
     rc = 0;
   }
 
-  // close the table file and return
   exit_select:
-  rf.close();
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+// the results of recent selects
+static ResultCache resultCache(SqlEngine::DEFAULT_CACHE_SIZE);
+
+/*
+ * describe a select so that selects with the same result get the same
+ * key: the key conditions become their interval and the other conditions
+ * are sorted. the key also holds the identity of the table file, so
+ * that a table reloaded by another process is not served from the cache.
+ * @return false if the table file does not exist
+ */
+static bool getCacheKey(int attr, const string& table, const vector<SelCond>& cond,
+                        bool descending, int limit, int offset,
+                        ResultSink::Format format, string& cacheKey)
+{
+  struct stat    st;
+  int            lowKey, highKey;
+  vector<string> others;
+  char           buf[160];
+
+  if (stat((table + ".tbl").c_str(), &st) < 0) return false;
+
+  if (attr == 4) {
+    descending = false;
+    limit = -1;
+    offset = 0;
+  }
+  getKeyRange(cond, lowKey, highKey);
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1 && cond[i].comp != SelCond::NE) continue;
+    snprintf(buf, sizeof(buf), "%d %d ", cond[i].attr, (int)cond[i].comp);
+    others.push_back(buf + string(cond[i].value));
+  }
+  sort(others.begin(), others.end());
+
+  snprintf(buf, sizeof(buf), "%lu %ld %ld.%09ld|%d %d %d %d %d|%d %d",
+           (unsigned long)st.st_ino, (long)st.st_size, (long)st.st_mtim.tv_sec,
+           (long)st.st_mtim.tv_nsec, attr, (int)descending, limit, offset,
+           (int)format, lowKey, highKey);
+  cacheKey = table;
+  cacheKey += '\0';
+  cacheKey += buf;
+  for (unsigned i = 0; i < others.size(); i++) {
+    cacheKey += '\0';
+    cacheKey += others[i];
+  }
+  return true;
+}
+
+/*
+ * run a select through the result cache, writing the result to sink.
+ */
+static RC cachedSelect(int attr, const string& table, const vector<SelCond>& cond,
+                       bool descending, int limit, int offset, ResultSink& sink,
+                       QueryStats& qs)
+{
+  string     cacheKey;
+  string     result;
+  unsigned   version = 0;
+  bool       cached = resultCache.getBudget() > 0 &&
+                      getCacheKey(attr, table, cond, descending, limit, offset,
+                                  sink.getFormat(), cacheKey);
+  RC         rc;
+
+  if (cached) {
+    version = resultCache.getVersion(table);
+    if (resultCache.lookup(cacheKey, result)) {
+      qs.plan = "result cache";
+      qs.cacheHit = true;
+      return sink.write(result.data(), result.size());
+    }
+    sink.capture(&result, resultCache.getBudget() / 4);
+  }
+
+  TableHandles* h;
+  double t0 = QueryStats::now();
+  if ((rc = Catalog::acquire(table, h)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    sink.capture(NULL, 0);
+    return rc;
+  }
+  qs.openTime = QueryStats::now() - t0;
+
+  IndexCounters keyCounters = h->tree.getCounters();
+  IndexCounters valueCounters = h->valueTree.getCounters();
+  t0 = QueryStats::now();
+  rc = runSelect(attr, table, cond, descending, limit, offset, *h, sink, qs);
+  qs.accessTime = QueryStats::now() - t0 - qs.fetchTime;
+  qs.addIndex(keyCounters, h->tree.getCounters());
+  qs.addIndex(valueCounters, h->valueTree.getCounters());
+  Catalog::release(h);
+
+  if (cached && rc == 0 && sink.isCaptured()) {
+    resultCache.store(table, version, cacheKey, result);
+  }
+  sink.capture(NULL, 0);
+  return rc;
+}
+
+/*
+ * run a select and add it to the cumulative statistics. a profiled
+ * select is timed in detail and followed by its profile.
+ */
+static RC profiledSelect(int attr, const string& table, const vector<SelCond>& cond,
+                         bool descending, int limit, int offset, bool profile,
+                         ResultSink& sink)
+{
+  QueryStats qs;
+  long       reads = PageFile::getPageReadCount() + PageIO::getPageReadCount();
+  long       writes = PageFile::getPageWriteCount() + PageIO::getPageWriteCount();
+  double     t0 = QueryStats::now();
+  RC         rc, flushed;
+
+  qs.timed = profile;
+  rc = cachedSelect(attr, table, cond, descending, limit, offset, sink, qs);
+
+  double t1 = QueryStats::now();
+  flushed = sink.flush();
+  qs.outputTime = QueryStats::now() - t1;
+  qs.totalTime = QueryStats::now() - t0;
+  qs.pageReads = PageFile::getPageReadCount() + PageIO::getPageReadCount() - reads;
+  qs.pageWrites = PageFile::getPageWriteCount() + PageIO::getPageWriteCount() - writes;
+  qs.rows = sink.getRowCount();
+  QueryStats::record(qs);
+
+  if (profile) {
+    char buf[1024];
+    int  len = qs.format(buf, sizeof(buf));
+    if ((flushed = sink.write(buf, len)) == 0) flushed = sink.flush();
+  }
+  return (rc < 0) ? rc : flushed;
+}
+
+// the statements recorded by the parser calls of a thread; see defer()
+static pthread_key_t  deferKey;
+static pthread_once_t deferOnce = PTHREAD_ONCE_INIT;
+
+static void createDeferKey()
+{
+  pthread_key_create(&deferKey, NULL);
+}
+
+static vector<Statement>* getDeferred()
+{
+  pthread_once(&deferOnce, createDeferKey);
+  return (vector<Statement>*)pthread_getspecific(deferKey);
+}
+
+void SqlEngine::defer(vector<Statement>* statements)
+{
+  pthread_once(&deferOnce, createDeferKey);
+  pthread_setspecific(deferKey, statements);
+}
+
+RC SqlEngine::execute(const Statement& st, int fd, ResultSink::Format format)
+{
+  switch (st.type) {
+  case Statement::SELECT: {
+    vector<SelCond> cond(st.conds);
+    for (unsigned i = 0; i < cond.size(); i++) {
+      cond[i].value = (char*)st.values[i].c_str();
+    }
+    ResultSink sink(fd, format);
+    return profiledSelect(st.attr, st.table, cond, st.descending, st.limit, st.offset,
+                          st.profile, sink);
+  }
+  case Statement::LOAD:
+    return load(st.table, st.loadfile, st.index, st.valueIndex);
+  case Statement::CREATE_INDEX:
+    return createIndex(st.table, st.attr);
+  }
+  return 0;
+}
+
+/*
+ * record a select instead of running it if the thread defers statements.
+ * @return true if the select was recorded
+ */
+static bool deferSelect(int attr, const string& table, const vector<SelCond>& cond,
+                        bool descending, int limit, int offset, bool profile)
+{
+  vector<Statement>* deferred = getDeferred();
+  if (deferred == NULL) return false;
+
+  Statement st;
+  st.type = Statement::SELECT;
+  st.table = table;
+  st.attr = attr;
+  st.conds = cond;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    st.conds[i].value = NULL;
+    st.values.push_back(cond[i].value);
+  }
+  st.descending = descending;
+  st.limit = limit;
+  st.offset = offset;
+  st.profile = profile;
+  deferred->push_back(st);
+  return true;
+}
+
+RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond,
+                     bool descending, int limit, int offset)
+{
+  if (deferSelect(attr, table, cond, descending, limit, offset, false)) return 0;
+
+  ResultSink sink;  // buffered output for the matching tuples
+  return profiledSelect(attr, table, cond, descending, limit, offset, false, sink);
+}
+
+RC SqlEngine::profile(int attr, const string& table, const vector<SelCond>& cond,
+                      bool descending, int limit, int offset)
+{
+  if (deferSelect(attr, table, cond, descending, limit, offset, true)) return 0;
+
+  ResultSink sink;
+  return profiledSelect(attr, table, cond, descending, limit, offset, true, sink);
+}
+
+RC SqlEngine::selectIn(int attr, const string& table, const vector<int>& keys,
+                       const vector<SelCond>& cond)
+{
+  ResultSink    sink;
+  QueryStats    qs;
+  TableHandles* h;
+  vector<int>   sorted(keys);
+  long          reads = PageFile::getPageReadCount() + PageIO::getPageReadCount();
+  long          writes = PageFile::getPageWriteCount() + PageIO::getPageWriteCount();
+  double        t0 = QueryStats::now();
+  RC            rc, flushed;
+
+  // the keys are looked up in key order, each once
+  sort(sorted.begin(), sorted.end());
+  sorted.erase(unique(sorted.begin(), sorted.end()), sorted.end());
+
+  if ((rc = Catalog::acquire(table, h)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+  qs.openTime = QueryStats::now() - t0;
+
+  IndexCounters keyCounters = h->tree.getCounters();
+  double t1 = QueryStats::now();
+  if ((rc = selectKeys(attr, *h, sorted, cond, sink, qs)) < 0) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+  }
+  qs.accessTime = QueryStats::now() - t1 - qs.fetchTime;
+  qs.addIndex(keyCounters, h->tree.getCounters());
+  Catalog::release(h);
+
+  t1 = QueryStats::now();
+  flushed = sink.flush();
+  qs.outputTime = QueryStats::now() - t1;
+  qs.totalTime = QueryStats::now() - t0;
+  qs.pageReads = PageFile::getPageReadCount() + PageIO::getPageReadCount() - reads;
+  qs.pageWrites = PageFile::getPageWriteCount() + PageIO::getPageWriteCount() - writes;
+  qs.rows = sink.getRowCount();
+  QueryStats::record(qs);
+  return (rc < 0) ? rc : flushed;
+}
+
+RC SqlEngine::join(int attr, const string& left, const string& right,
+                   const vector<SelCond>& cond, int limit, int offset, int method)
+{
+  ResultSink    sink;
+  QueryStats    qs;
+  TableHandles* lh;
+  TableHandles* rh;
+  long          reads = PageFile::getPageReadCount() + PageIO::getPageReadCount();
+  long          writes = PageFile::getPageWriteCount() + PageIO::getPageWriteCount();
+  double        t0 = QueryStats::now();
+  RC            rc, flushed;
+
+  if ((rc = Catalog::acquire(left, lh)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", left.c_str());
+    return rc;
+  }
+  if ((rc = Catalog::acquire(right, rh)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", right.c_str());
+    Catalog::release(lh);
+    return rc;
+  }
+  qs.openTime = QueryStats::now() - t0;
+
+  IndexCounters leftCounters = lh->tree.getCounters();
+  IndexCounters rightCounters = rh->tree.getCounters();
+  double t1 = QueryStats::now();
+  if ((rc = runJoin(attr, *lh, *rh, cond, limit, offset, method, sink, qs)) == RC_INVALID_ATTRIBUTE) {
+    fprintf(stderr, "Error: neither %s nor %s has a key index\n", left.c_str(), right.c_str());
+  } else if (rc < 0) {
+    fprintf(stderr, "Error: while joining tables %s and %s\n", left.c_str(), right.c_str());
+  }
+  qs.accessTime = QueryStats::now() - t1 - qs.fetchTime;
+  qs.addIndex(leftCounters, lh->tree.getCounters());
+  qs.addIndex(rightCounters, rh->tree.getCounters());
+  Catalog::release(rh);
+  Catalog::release(lh);
+
+  t1 = QueryStats::now();
+  flushed = sink.flush();
+  qs.outputTime = QueryStats::now() - t1;
+  qs.totalTime = QueryStats::now() - t0;
+  qs.pageReads = PageFile::getPageReadCount() + PageIO::getPageReadCount() - reads;
+  qs.pageWrites = PageFile::getPageWriteCount() + PageIO::getPageWriteCount() - writes;
+  qs.rows = sink.getRowCount();
+  QueryStats::record(qs);
+  return (rc < 0) ? rc : flushed;
+}
+
+void SqlEngine::dumpStats(FILE* out)
+{
+  QueryStats::dump(out);
+}
+
+void SqlEngine::setCacheSize(size_t bytes)
+{
+  resultCache.setBudget(bytes);
+}
+
+// the leaf format of the B+tree indexes created from now on
+static bool compressLeaves = false;
+
+void SqlEngine::setLeafCompression(bool compress)
+{
+  compressLeaves = compress;
+}
+
+/*
+ * a (key, value) pair parsed from the load file. value points into the
+ * memory-mapped load file and is not null-terminated.
+ */
+struct LoadTuple {
+  int         key;
+  const char* value;
+  int         len;
+};
+
+/*
+ * a newline-aligned piece of the load file parsed by one thread.
+ */
+struct LoadChunk {
+  const char*       begin;
+  const char*       end;
+  vector<LoadTuple> tuples;
+};
+
+// bytes of the load file parsed by each thread per round
+static const size_t LOAD_CHUNK_SIZE = 4 * 1024 * 1024;
+static const int    MAX_LOAD_THREADS = 8;
+
+/*
+ * thread body: split the chunk into lines and parse each of them.
+ * lines that cannot be parsed are skipped.
+ */
+static void* parseLoadChunk(void* arg)
+{
+  LoadChunk*  chunk = (LoadChunk*)arg;
+  const char* s = chunk->begin;
+  LoadTuple   t;
+
+  while (s < chunk->end) {
+    const char* eol = (const char*)memchr(s, '\n', chunk->end - s);
+    if (eol == NULL) eol = chunk->end;
+    if (SqlEngine::parseLoadLine(s, eol, t.key, t.value, t.len) == 0) {
+      chunk->tuples.push_back(t);
+    }
+    s = eol + 1;
+  }
+  return NULL;
+}
+
+/*
+ * the files a LOAD appends to.
+ */
+struct LoadTarget {
+  RecordAppender          record;
+  ZoneMap                 zones;
+  BTreeIndex*             tree;        // NULL if the table is loaded without index
+  HashIndex*              hash;        // NULL if the key column is not hashed
+  BTreeIndexT<StringKey>* valueTree;   // NULL if the value column is not indexed
+};
+
+/*
+ * append a tuple to the table, its zone map and the index.
+ */
+static RC appendTuple(LoadTarget& target, int key, const char* value, int len)
+{
+  RC       rc;
+  RecordId rid;
+
+  if ((rc = target.record.append(key, value, len, rid)) < 0) return rc;
+  if ((rc = target.zones.add(rid, key)) < 0) return rc;
+  if (target.tree != NULL && (rc = target.tree->insert(key, rid)) < 0) return rc;
+  if (target.hash != NULL && (rc = target.hash->insert(key, rid)) < 0) return rc;
+  if (target.valueTree != NULL) return target.valueTree->insert(StringKey(value, len), rid);
+  return 0;
+}
+
+/*
+ * load a regular file: the file is memory-mapped and parsed in
+ * newline-aligned chunks by several threads at a time. the parsed tuples
+ * are appended in file order after each round.
+ */
+static RC loadMapped(int fd, size_t size, LoadTarget& target)
+{
+  const char* data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) return RC_FILE_READ_FAILED;
+  madvise((void*)data, size, MADV_SEQUENTIAL);
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int  nthreads = (ncpu < 1) ? 1 : (ncpu > MAX_LOAD_THREADS ? MAX_LOAD_THREADS : ncpu);
+
+  vector<LoadChunk> chunks(nthreads);
+  pthread_t         threads[MAX_LOAD_THREADS];
+  const char*       s = data;
+  const char*       eof = data + size;
+  RC                rc = 0;
+
+  while (s < eof && rc == 0) {
+    // cut the next round into newline-aligned chunks
+    int n;
+    for (n = 0; n < nthreads && s < eof; n++) {
+      const char* e = (eof - s > (ptrdiff_t)LOAD_CHUNK_SIZE) ? s + LOAD_CHUNK_SIZE : eof;
+      const char* eol = (const char*)memchr(e - 1, '\n', eof - e + 1);
+      e = (eol == NULL) ? eof : eol + 1;
+
+      chunks[n].begin = s;
+      chunks[n].end = e;
+      chunks[n].tuples.clear();
+      s = e;
+    }
+
+    // parse them in parallel; the first chunk is parsed by this thread
+    int started = 1;
+    for (int i = 1; i < n; i++, started++) {
+      if (pthread_create(&threads[i], NULL, parseLoadChunk, &chunks[i]) != 0) break;
+    }
+    parseLoadChunk(&chunks[0]);
+    for (int i = started; i < n; i++) parseLoadChunk(&chunks[i]);
+    for (int i = 1; i < started; i++) pthread_join(threads[i], NULL);
+
+    // append the tuples in file order
+    for (int i = 0; i < n && rc == 0; i++) {
+      for (size_t j = 0; j < chunks[i].tuples.size(); j++) {
+        const LoadTuple& t = chunks[i].tuples[j];
+        if ((rc = appendTuple(target, t.key, t.value, t.len)) < 0) break;
+      }
+    }
+  }
+
+  munmap((void*)data, size);
+  return rc;
+}
+
+RC SqlEngine::load(const string& table, const string& loadfile, int index, bool valueIndex)
 {
-  /* your code here */
-  //cout << table << " " << loadfile << endl;
-  
+  vector<Statement>* deferred = getDeferred();
+  if(deferred != NULL){
+    Statement st;
+    st.type = Statement::LOAD;
+    st.table = table;
+    st.loadfile = loadfile;
+    st.index = index;
+    st.valueIndex = valueIndex;
+    deferred->push_back(st);
+    return 0;
+  }
+
+  QueryStats qs;
+  long       reads = PageFile::getPageReadCount() + PageIO::getPageReadCount();
+  long       writes = PageFile::getPageWriteCount() + PageIO::getPageWriteCount();
+  double     t0 = QueryStats::now();
+
   //open loadfile
-  ifstream fsLoad;
-  fsLoad.open(loadfile.c_str());
-  if(!fsLoad.is_open()){
-    cout << "Error opening file.\n";
-    return 1;
+  int fd = ::open(loadfile.c_str(), O_RDONLY);
+  if(fd < 0){
+    fprintf(stderr, "Error: cannot open load file %s\n", loadfile.c_str());
+    return RC_FILE_OPEN_FAILED;
   }
 
-  //open or create table
-  RecordFile record;
+  // besides the index the LOAD asks for, every index the table has
+  // takes the new tuples, so that none of them goes stale
+  bool hasTree = access((table + ".idx").c_str(), F_OK) == 0;
+  bool hasHash = access((table + ".hsh").c_str(), F_OK) == 0;
+  bool hasValueTree = access((table + ".vidx").c_str(), F_OK) == 0;
+
+  LoadTarget target;
+  RC rc = 0;
+  BTreeIndex tree;
+  HashIndex hash;
+  BTreeIndexT<StringKey> valueTree;
+  target.tree = NULL;
+  target.hash = NULL;
+  target.valueTree = NULL;
+  // the indexes take the tuples in batches, in key order, and write each
+  // batch to a sorted run; the runs are merged into the tree in one pass
+  // once there are MAX_INDEX_RUNS of them and at the end of the load
+  // (indexes written without statistics have no run list and take the
+  // batches directly)
+  if(index == BTREE_INDEX || hasTree){
+    if((rc = tree.open(table + ".idx", 'w')) == 0){
+      if(!hasTree) tree.setLeafCompression(compressLeaves);
+      tree.setInsertBuffer(BTreeIndex::DEFAULT_INSERT_BUFFER);
+      tree.setInsertRuns(true);
+      target.tree = &tree;
+    }
+  }
+  if(rc == 0 && (index == HASH_INDEX || hasHash)){
+    if((rc = hash.open(table + ".hsh", 'w')) == 0)
+      target.hash = &hash;
+  }
+  if(rc == 0 && (valueIndex || hasValueTree)){
+    if((rc = valueTree.open(table + ".vidx", 'w')) == 0){
+      if(!hasValueTree) valueTree.setLeafCompression(compressLeaves);
+      valueTree.setInsertBuffer(BTreeIndexT<StringKey>::DEFAULT_INSERT_BUFFER);
+      valueTree.setInsertRuns(true);
+      target.valueTree = &valueTree;
+    }
+  }
+
+  //open or create table, once its indexes are open; pages are filled in
+  //memory and written in batches
   string tableName = table + ".tbl";
-  if(record.open(tableName, 'w')){
-    cout << "Error opening file" << endl;
-    return 1;
+  if(rc < 0)
+    fprintf(stderr, "Error: cannot open the indexes of table %s\n", table.c_str());
+  else if((rc = target.record.open(tableName)) < 0 ||
+          (rc = target.zones.open(table + ".zmp", 'w')) < 0){
+    fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+    target.record.close();
+  }
+  if(rc < 0){
+    //the indexes this LOAD created would miss the tuples of the table
+    if(target.tree != NULL && tree.close() == 0 && !hasTree)
+      unlink((table + ".idx").c_str());
+    if(target.hash != NULL && hash.close() == 0 && !hasHash){
+      unlink((table + ".hsh").c_str());
+      unlink((table + ".hsh.ovf").c_str());
+    }
+    if(target.valueTree != NULL && valueTree.close() == 0 && !hasValueTree)
+      unlink((table + ".vidx").c_str());
+    ::close(fd);
+    return rc;
   }
 
-  //read loadfile lines
-  BTreeIndex tree;
-  if(index){
-    tree.open(table + ".idx", 'w');
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+    if(st.st_size > 0)
+      rc = loadMapped(fd, st.st_size, target);
+  }
+  else{
+    //not mappable (e.g., a pipe), so read it line by line
+    FILE*   fp = fdopen(fd, "r");
+    char*   line = NULL;
+    size_t  size = 0;
+    ssize_t len;
+    int     key;
+    const char* value;
+    int     vlen;
+    while(rc == 0 && (len = getline(&line, &size, fp)) > 0){
+      if(parseLoadLine(line, line + len, key, value, vlen) == 0)
+        rc = appendTuple(target, key, value, vlen);
+    }
+    free(line);
+    fclose(fp);
+    fd = -1;
+  }
+
+  if(rc < 0)
+    fprintf(stderr, "Error: while loading table %s\n", table.c_str());
+
+  // the last batch and the runs go into the tree, which an empty index
+  // builds bottom-up, so that the loaded table is read from the tree
+  if(target.tree != NULL){
+    RC mrc = tree.mergeRuns();
+    if((tree.close() < 0 || mrc < 0) && rc == 0)
+      rc = RC_FILE_WRITE_FAILED;
   }
-  string line;
-  while(getline(fsLoad, line, '\n')){
-    int key;
-    string value;
-    parseLoadLine(line, key, value);
-    //cout << key << " " << value << endl;
+  if(target.hash != NULL)
+    hash.close();
+  if(target.valueTree != NULL){
+    RC mrc = valueTree.mergeRuns();
+    if((valueTree.close() < 0 || mrc < 0) && rc == 0)
+      rc = RC_FILE_WRITE_FAILED;
+  }
+  if(fd >= 0)
+    ::close(fd);
+  if(target.zones.close() < 0 && rc == 0)
+    rc = RC_FILE_WRITE_FAILED;
+  if(target.record.close() < 0 && rc == 0)
+    rc = RC_FILE_WRITE_FAILED;
+
+  //cached results and open handles of the table are stale now
+  resultCache.bump(table);
+  Catalog::invalidate(table);
+
+  qs.plan = "load";
+  qs.addIndex(IndexCounters(), tree.getCounters());
+  qs.addIndex(IndexCounters(), valueTree.getCounters());
+  qs.pageReads = PageFile::getPageReadCount() + PageIO::getPageReadCount() - reads;
+  qs.pageWrites = PageFile::getPageWriteCount() + PageIO::getPageWriteCount() - writes;
+  qs.totalTime = QueryStats::now() - t0;
+  QueryStats::record(qs);
+  return rc;
+}
+
+RC SqlEngine::createIndex(const string& table, int attr)
+{
+  RecordFile rf;
+  RecordId   rid;
+  RC         rc;
+  int        key;
+  string     value;
+
+  if (attr != 1 && attr != 2) return RC_INVALID_ATTRIBUTE;
 
-    //insert into record file
-    RecordId rid = record.endRid();
-    record.append(key, value, rid);
+  vector<Statement>* deferred = getDeferred();
+  if (deferred != NULL) {
+    Statement st;
+    st.type = Statement::CREATE_INDEX;
+    st.table = table;
+    st.attr = attr;
+    deferred->push_back(st);
+    return 0;
+  }
+
+  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
 
-    //insert into index
-    if(index){
-      tree.insert(key, rid);
+  // an existing index is rebuilt from scratch
+  string indexName = table + (attr == 1 ? ".idx" : ".vidx");
+  BTreeIndex             keyTree;
+  BTreeIndexT<StringKey> valueTree;
+  unlink(indexName.c_str());
+  BTreeIndex::dropRuns(indexName);
+  rc = (attr == 1) ? keyTree.open(indexName, 'w') : valueTree.open(indexName, 'w');
+  if (rc < 0) {
+    fprintf(stderr, "Error: cannot create index %s\n", indexName.c_str());
+    rf.close();
+    return rc;
+  }
+  keyTree.setInsertBuffer(BTreeIndex::DEFAULT_INSERT_BUFFER);
+  valueTree.setInsertBuffer(BTreeIndexT<StringKey>::DEFAULT_INSERT_BUFFER);
+  keyTree.setLeafCompression(compressLeaves);
+  valueTree.setLeafCompression(compressLeaves);
+
+  // a hash index on the key is rebuilt along with the key index, so that
+  // one left behind by an older LOAD is complete again
+  string    hashName = table + ".hsh";
+  HashIndex hash;
+  bool      rehash = attr == 1 && access(hashName.c_str(), F_OK) == 0;
+  if (rehash) {
+    unlink(hashName.c_str());
+    unlink((hashName + ".ovf").c_str());
+    if ((rc = hash.open(hashName, 'w')) < 0) {
+      fprintf(stderr, "Error: cannot create index %s\n", hashName.c_str());
+      keyTree.close();
+      rf.close();
+      return rc;
     }
   }
 
-  if(index)
-    tree.close();
-  fsLoad.close();
-  record.close();
-  return 0;
+  for (rid.pid = rid.sid = 0; rid < rf.endRid(); ++rid) {
+    if ((rc = rf.read(rid, key, value)) < 0) break;
+    if (attr == 1) rc = keyTree.insert(key, rid);
+    else rc = valueTree.insert(StringKey(value.c_str()), rid);
+    if (rc == 0 && rehash) rc = hash.insert(key, rid);
+    if (rc < 0) break;
+  }
+  if (rc < 0) fprintf(stderr, "Error: while indexing table %s\n", table.c_str());
+
+  RC crc = (attr == 1) ? keyTree.close() : valueTree.close();
+  if (crc < 0 && rc == 0) rc = crc;
+  if (rehash && (crc = hash.close()) < 0 && rc == 0) rc = crc;
+  rf.close();
+
+  // open handles of the table do not have the new index, and cached
+  // results may be in the order of the access path it replaces
+  resultCache.bump(table);
+  Catalog::invalidate(table);
+  return rc;
+}
+
+RC SqlEngine::analyzeIndex(const string& table, int attr)
+{
+  IndexReport report;
+  RC          rc;
+
+  if (attr != 1 && attr != 2) return RC_INVALID_ATTRIBUTE;
+
+  string indexName = table + (attr == 1 ? ".idx" : ".vidx");
+  BTreeIndex             keyTree;
+  BTreeIndexT<StringKey> valueTree;
+  rc = (attr == 1) ? keyTree.open(indexName, 'r') : valueTree.open(indexName, 'r');
+  if (rc < 0) {
+    fprintf(stderr, "Error: index %s does not exist\n", indexName.c_str());
+    return rc;
+  }
+
+  rc = (attr == 1) ? keyTree.analyze(report) : valueTree.analyze(report);
+  if (attr == 1) keyTree.close();
+  else valueTree.close();
+  if (rc < 0) return rc;
+
+  printf("index %s:\n", indexName.c_str());
+  report.print(stdout);
+  return (report.problemCount > 0) ? RC_INVALID_FILE_FORMAT : 0;
+}
+
+/*
+ * parse an integer the way atoi() does, but stop at end.
+ */
+static int parseKey(const char* s, const char* end)
+{
+  bool neg = false;
+  int  v = 0;
+
+  while (s < end && (*s == ' ' || *s == '\t')) s++;
+  if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+  while (s < end && *s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+  return neg ? -v : v;
 }
 
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
+{
+    const char* v;
+    int         len;
+    RC          rc;
+
+    rc = parseLoadLine(line.data(), line.data() + line.size(), key, v, len);
+    if (rc == 0) value.assign(v, len);
+    return rc;
+}
+
+RC SqlEngine::parseLoadLine(const char* line, const char* end, int& key, const char*& value, int& len)
 {
     const char *s;
+    const char *e;
     char        c;
-    string::size_type loc;
-    
-    // ignore beginning white spaces
-    c = *(s = line.c_str());
-    while (c == ' ' || c == '\t') { c = *++s; }
+
+    // ignore a trailing newline
+    if (end > line && end[-1] == '\n') end--;
+    if (end > line && end[-1] == '\r') end--;
 
     // get the integer key value
-    key = atoi(s);
+    key = parseKey(line, end);
 
     // look for comma
-    s = strchr(s, ',');
+    s = (const char*)memchr(line, ',', end - line);
     if (s == NULL) { return RC_INVALID_FILE_FORMAT; }
 
     // ignore white spaces
-    do { c = *++s; } while (c == ' ' || c == '\t');
+    do { ++s; } while (s < end && (*s == ' ' || *s == '\t'));
     
     // if there is nothing left, set the value to empty string
-    if (c == 0) { 
-        value.erase();
+    if (s == end) { 
+        value = s;
+        len = 0;
         return 0;
     }
 
     // is the value field delimited by ' or "?
+    c = *s;
     if (c == '\'' || c == '"') {
         s++;
+        e = (const char*)memchr(s, c, end - s);
+        if (e == NULL) e = end;
     } else {
-        c = '\n';
+        e = end;
     }
 
-    // get the value string
-    value.assign(s);
-    loc = value.find(c, 0);
-    if (loc != string::npos) { value.erase(loc); }
-
+    // the value string is everything up to the delimiter
+    value = s;
+    len = e - s;
     return 0;
 }
 
-bool checkOnTuple(int selectAttr, int key, const string& stringValue, const vector<SelCond>& cond){
+bool checkOnTuple(int selectAttr, int key, const string& stringValue, const vector<SelCond>& cond, ResultSink& sink){
 	int diff;
-	string value;
 
 	// check the conditions on the tuple
   for (unsigned i = 0; i < cond.size(); i++) {
@@ -367,65 +1847,36 @@ bool checkOnTuple(int selectAttr, int key, const string& stringValue, const vect
     switch (cond[i].attr) {
     case 1:
     	diff = key - atoi(cond[i].value);
-      cout << key << " " << atoi(cond[i].value) << " " << diff << endl;
     	break;
     case 2:
-    	diff = strcmp(value.c_str(), cond[i].value);
+    	diff = strcmp(stringValue.c_str(), cond[i].value);
     	break;
     }
 
     // skip the tuple if any condition is not met
     switch (cond[i].comp) {
     case SelCond::EQ:
-    	if (diff != 0){ 
-        cout << "returning false in EQ\n"; 
-        return false;
-      }
+    	if (diff != 0) return false;
+    	break;
     case SelCond::NE:
-    	if (diff == 0){ 
-        cout << "returning false in NE\n"; 
-        return false;
-      }
+    	if (diff == 0) return false;
+    	break;
     case SelCond::GT:
-    	if (diff <= 0){
-        cout << "returning false in GT\n"; 
-        return false;
-      }
+    	if (diff <= 0) return false;
+    	break;
     case SelCond::LT:
-    	if (diff >= 0){
-       cout << "returning false in LT\n"; 
-       return false;
-      }
+    	if (diff >= 0) return false;
+    	break;
     case SelCond::GE:
-    	if (diff < 0) {
-        cout << "returning false in GE\n"; 
-        return false;
-      }
+    	if (diff < 0) return false;
+    	break;
     case SelCond::LE:
-    	if (diff > 0) {
-        cout << "returning false in LE\n"; 
-        return false;
-      }
+    	if (diff > 0) return false;
+    	break;
     }
   }
-  //fprintf(stdout, "fprintf works!\n");
-  // print the tuple 
-  switch (selectAttr) {
-  case 1:  // SELECT key
-    fprintf(stdout, "%d\n", key);
-    //cout << key << endl;
-    break;
-  case 2:  // SELECT value
-    fprintf(stdout, "%s\n", stringValue.c_str());
-    //cout << stringValue << endl;
-    break;
-  case 3:  // SELECT *
-    cout << "in * case" << endl;
-    fprintf(stdout, "%d '%s'\n", key, stringValue.c_str());
-    //cout << key << "'" << stringValue << "'\n";
-    break;
-  }
 
+  // print the tuple 
+  sink.emit(selectAttr, key, stringValue.data(), stringValue.size());
   return true;
 }
-
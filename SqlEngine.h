@@ -10,24 +10,56 @@
 #ifndef SQLENGINE_H
 #define SQLENGINE_H
 
+#include <cstdio>
+#include <string>
 #include <vector>
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "ResultSink.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
  */
 struct SelCond {
   int attr;     // attribute: 1 - key column,  2 - value column
+                // (in a join, 2 - value of the left, 3 - value of the right table)
   enum Comparator { EQ, NE, LT, GT, LE, GE } comp;
   char* value;  // the value to compare
 };
 
+/**
+ * a statement taken from the parser to be executed later; see
+ * SqlEngine::defer(). It owns copies of all its arguments.
+ */
+struct Statement {
+  enum Type { SELECT, LOAD, CREATE_INDEX } type;
+  std::string table;
+  int  attr;                        // SELECT: the attribute; CREATE INDEX: the column
+  std::vector<SelCond> conds;       // SELECT: the conditions, with value set to NULL
+  std::vector<std::string> values;  // SELECT: the values of conds
+  bool descending;                  // SELECT
+  bool profile;                     // SELECT: PROFILE SELECT
+  int  limit;                       // SELECT
+  int  offset;                      // SELECT
+  std::string loadfile;             // LOAD
+  int  index;                       // LOAD
+  bool valueIndex;                  // LOAD
+};
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
 class SqlEngine {
  public:
+  /// the access methods for the key column chosen by load()
+  static const int NO_INDEX    = 0;
+  static const int BTREE_INDEX = 1;  // "WITH INDEX": table.idx
+  static const int HASH_INDEX  = 2;  // key equality only: table.hsh
+
+  /// the join methods of join()
+  static const int AUTO_JOIN   = 0;  // chosen by the planner
+  static const int INDEX_JOIN  = 1;  // index nested-loop join
+  static const int MERGE_JOIN  = 2;  // sort-merge join
     
   /**
    * takes the user commands from commandline and executes them.
@@ -46,18 +78,145 @@ class SqlEngine {
    * (1: key, 2: value, 3: *, 4: count(*))
    * @param table[IN] the table name in the FROM clause
    * @param conds[IN] list of conditions in the WHERE clause
+   * @param descending[IN] true for ORDER BY key DESC
+   * @param limit[IN] the maximum number of tuples to print; -1 for no LIMIT
+   * @param offset[IN] the number of matching tuples to skip first (OFFSET)
    * @return error code. 0 if no error
    */
-  static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds);
+  static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds,
+                   bool descending = false, int limit = -1, int offset = 0);
+
+  /**
+   * executes a PROFILE SELECT: the SELECT, followed by "-- " lines with
+   * the access path and the time and work of each step.
+   * the parameters are those of select().
+   * @return error code. 0 if no error
+   */
+  static RC profile(int attr, const std::string& table, const std::vector<SelCond>& conds,
+                    bool descending = false, int limit = -1, int offset = 0);
+
+  /**
+   * executes SELECT ... WHERE key IN (keys) AND conds: the tuples whose
+   * key is one of keys, in key order. the keys are looked up in the key
+   * index together (see BTreeIndexT::locateBatch()), or in the hash
+   * index, or found by a scan of the table.
+   * the result is printed on screen.
+   * @param attr[IN] attribute in the SELECT clause, as for select()
+   * @param table[IN] the table name in the FROM clause
+   * @param keys[IN] the keys in the IN list
+   * @param conds[IN] the other conditions in the WHERE clause
+   * @return error code. 0 if no error
+   */
+  static RC selectIn(int attr, const std::string& table, const std::vector<int>& keys,
+                     const std::vector<SelCond>& conds);
+
+  /**
+   * executes an equi-join of two tables on the key column:
+   * SELECT ... FROM left, right WHERE left.key = right.key AND conds.
+   * an index nested-loop join reads one table (the outer) by its key
+   * index or by a scan and looks up its keys in the key index of the
+   * other in batches (see BTreeIndexT::locateBatch()). a sort-merge
+   * join reads both tables in key order, by zipping their B+tree
+   * indexes, or by scanning and sorting them if either has none. the
+   * planner picks the method that reads fewer pages, estimated from the
+   * sizes of the tables and the key conditions.
+   * the rows are in key order except for an index nested-loop join with
+   * a scanned outer table. the result is printed on screen.
+   * @param attr[IN] attribute in the SELECT clause (1: key, 2: the values
+   *                 of both tables, 3: *, 4: count(*))
+   * @param left[IN] the left table
+   * @param right[IN] the right table
+   * @param conds[IN] the other conditions in the WHERE clause
+   * @param limit[IN] the maximum number of rows to print; -1 for no LIMIT
+   * @param offset[IN] the number of rows to skip first (OFFSET)
+   * @param method[IN] AUTO_JOIN, or the method to use. INDEX_JOIN
+   *                   requires a key index on either table
+   * @return error code. 0 if no error
+   */
+  static RC join(int attr, const std::string& left, const std::string& right,
+                 const std::vector<SelCond>& conds, int limit = -1, int offset = 0,
+                 int method = AUTO_JOIN);
+
+  /**
+   * print the statistics of all statements since the process started,
+   * e.g., for a monitoring scraper.
+   * @param out[IN] where to print
+   */
+  static void dumpStats(FILE* out);
+
+  /// the default memory budget of the select result cache
+  static const size_t DEFAULT_CACHE_SIZE = 16 * 1024 * 1024;
+
+  /**
+   * set the memory budget of the select result cache. selects whose
+   * result is cached are answered without reading the table.
+   * @param bytes[IN] the budget in bytes; 0 disables the cache
+   */
+  static void setCacheSize(size_t bytes);
+
+  /**
+   * store the leaves of the B+tree indexes that load() and createIndex()
+   * create from now on in the compressed format (see
+   * BTreeIndexT::setLeafCompression()). an index keeps the format it
+   * was created with.
+   * @param compress[IN] true to compress the leaves
+   */
+  static void setLeafCompression(bool compress);
+
+  /**
+   * make select(), load() and createIndex() of the calling thread append
+   * their statement to statements instead of executing it, so that a
+   * statement can be parsed under a lock and executed outside of it.
+   * @param statements[IN] where to record statements; NULL to execute them again
+   */
+  static void defer(std::vector<Statement>* statements);
+
+  /**
+   * execute a statement recorded while defer() was in effect.
+   * @param st[IN] the statement
+   * @param fd[IN] the file descriptor to write the result of a SELECT to
+   * @param format[IN] the format of the result of a SELECT
+   * @return error code. 0 if no error
+   */
+  static RC execute(const Statement& st, int fd,
+                    ResultSink::Format format = ResultSink::TEXT);
 
   /**
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
-   * @param index[IN] true if "WITH INDEX" option was specified
+   * @param index[IN] the index to maintain on the key column:
+   *                  NO_INDEX, BTREE_INDEX (if "WITH INDEX" option was
+   *                  specified) or HASH_INDEX; the indexes the table
+   *                  has already are maintained as well
+   * @param valueIndex[IN] true to maintain an index on the value column
+   * @return error code. 0 if no error
+   */
+  static RC load(const std::string& table, const std::string& loadfile, int index,
+                 bool valueIndex = false);
+
+  /**
+   * build an index on a column of an existing table (CREATE INDEX).
+   * the key column is indexed in table.idx, the value column in
+   * table.vidx; an existing index on the column is rebuilt, and so is
+   * a hash index on the key (table.hsh).
+   * the value index maps the first StringKey::LENGTH bytes of a value
+   * to its RecordId, so its matches are re-checked against the tuple.
+   * @param table[IN] the table name
+   * @param attr[IN] the column to index: 1 - key, 2 - value
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC createIndex(const std::string& table, int attr);
+
+  /**
+   * check the structure of an index and print its statistics (ANALYZE):
+   * the nodes and fill per level, leaf contiguity, posting lists, wasted
+   * space and any violated invariant.
+   * @param table[IN] the table name
+   * @param attr[IN] the indexed column: 1 - key, 2 - value
+   * @return error code. RC_INVALID_FILE_FORMAT if the index is corrupt
+   */
+  static RC analyzeIndex(const std::string& table, int attr);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -68,6 +227,18 @@ class SqlEngine {
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
 
+  /**
+   * parse a line from the load file into the (key, value) pair
+   * without copying the value.
+   * @param line[IN] the beginning of a line from a load file
+   * @param end[IN] the end of the line (a trailing newline is ignored)
+   * @param key[OUT] the key field of the tuple in the line
+   * @param value[OUT] points to the value field inside the line
+   * @param len[OUT] the length of the value field
+   * @return error code. 0 if no error
+   */
+  static RC parseLoadLine(const char* line, const char* end, int& key, const char*& value, int& len);
+
   //RC indexSearch(int attr, const vector<SelCond>& cond, RecordFile& rf);
 
   //RC linearSearch(int attr, const vector<SelCond>& cond, RecordFile& rf);
@@ -75,6 +246,11 @@ class SqlEngine {
 
 };
 
-bool checkOnTuple(int selectAttr, int key, const std::string& stringValue, const std::vector<SelCond>& cond);
+/**
+ * check the conditions in cond on the tuple (key, stringValue) and,
+ * if all of them are met, emit the tuple to sink.
+ * @return true if the tuple matches all conditions
+ */
+bool checkOnTuple(int selectAttr, int key, const std::string& stringValue, const std::vector<SelCond>& cond, ResultSink& sink);
 
 #endif /* SQLENGINE_H */
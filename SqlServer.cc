@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "SqlServer.h"
+#include "SqlEngine.h"
+
+using namespace std;
+
+// external functions and variables for sql command parsing
+extern FILE* sqlin;
+int sqlparse(void);
+
+// the accepted connections waiting for a worker
+static deque<int>      connections;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queueCond = PTHREAD_COND_INITIALIZER;
+
+// the parser has global state: one command is parsed at a time
+static pthread_mutex_t parseMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// SELECTs share the tables, LOAD and CREATE INDEX change them
+static pthread_rwlock_t tableLock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * write the whole buffer to fd.
+ */
+static RC writeAll(int fd, const char* data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return RC_FILE_WRITE_FAILED;
+    }
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * parse one command line into statements without executing them.
+ * @return false on a syntax error
+ */
+static bool parse(char* line, size_t len, vector<Statement>& statements)
+{
+  FILE* in = fmemopen(line, len, "r");
+  int   failed;
+
+  if (in == NULL) return false;
+
+  pthread_mutex_lock(&parseMutex);
+  SqlEngine::defer(&statements);
+  sqlin = in;
+  failed = sqlparse();
+  SqlEngine::defer(NULL);
+  pthread_mutex_unlock(&parseMutex);
+
+  fclose(in);
+  return failed == 0;
+}
+
+/*
+ * @return true if line (without surrounding blanks) is word, ignoring case
+ */
+static bool isCommand(const char* line, const char* word)
+{
+  size_t n = strlen(word);
+
+  while (*line == ' ' || *line == '\t') line++;
+  if (strncasecmp(line, word, n) != 0) return false;
+  for (line += n; *line != '\0'; line++) {
+    if (*line != ' ' && *line != '\t' && *line != '\r' && *line != '\n' && *line != ';') return false;
+  }
+  return true;
+}
+
+/*
+ * serve the commands of one client until it disconnects.
+ */
+static void serve(int fd)
+{
+  FILE*   in = fdopen(dup(fd), "r");
+  char*   line = NULL;
+  size_t  size = 0;
+  ssize_t len;
+  ResultSink::Format format = ResultSink::TEXT;
+
+  if (in == NULL) return;
+
+  while ((len = getline(&line, &size, in)) > 0) {
+    vector<Statement> statements;
+    char   status[32];
+    RC     rc = 0;
+
+    if (isCommand(line, "")) continue;
+    if (isCommand(line, "quit") || isCommand(line, "exit")) break;
+    bool binary = isCommand(line, "format binary");
+    if (binary || isCommand(line, "format text")) {
+      format = binary ? ResultSink::BINARY : ResultSink::TEXT;
+      if (writeAll(fd, "\0OK\n", 4) < 0) break;
+      continue;
+    }
+
+    if (!parse(line, len, statements)) {
+      if (writeAll(fd, "\0ERROR syntax\n", 14) < 0) break;
+      continue;
+    }
+
+    for (unsigned i = 0; i < statements.size() && rc == 0; i++) {
+      if (statements[i].type == Statement::SELECT) pthread_rwlock_rdlock(&tableLock);
+      else pthread_rwlock_wrlock(&tableLock);
+      rc = SqlEngine::execute(statements[i], fd, format);
+      pthread_rwlock_unlock(&tableLock);
+    }
+
+    if (rc == 0) strcpy(status + 1, "OK\n");
+    else snprintf(status + 1, sizeof(status) - 1, "ERROR %d\n", rc);
+    status[0] = '\0';
+    if (writeAll(fd, status, strlen(status + 1) + 1) < 0) break;
+  }
+
+  free(line);
+  fclose(in);
+}
+
+static void* worker(void*)
+{
+  for (;;) {
+    pthread_mutex_lock(&queueMutex);
+    while (connections.empty()) pthread_cond_wait(&queueCond, &queueMutex);
+    int fd = connections.front();
+    connections.pop_front();
+    pthread_mutex_unlock(&queueMutex);
+
+    serve(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+RC SqlServer::run(const string& socketPath, int workers)
+{
+  struct sockaddr_un addr;
+  int                listener;
+
+  if (socketPath.size() >= sizeof(addr.sun_path)) return RC_FILE_OPEN_FAILED;
+
+  // a client that disconnects early must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
+  if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return RC_FILE_OPEN_FAILED;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketPath.c_str());
+  unlink(socketPath.c_str());
+  if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, SOMAXCONN) < 0) {
+    fprintf(stderr, "Error: cannot listen on %s\n", socketPath.c_str());
+    close(listener);
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  for (int i = 0; i < workers; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, NULL) != 0) {
+      if (i == 0) {
+        close(listener);
+        return RC_FILE_OPEN_FAILED;
+      }
+      break;
+    }
+    pthread_detach(thread);
+  }
+
+  for (;;) {
+    int fd = accept(listener, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      close(listener);
+      return RC_FILE_OPEN_FAILED;
+    }
+    pthread_mutex_lock(&queueMutex);
+    connections.push_back(fd);
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+  }
+}
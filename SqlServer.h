@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef SQLSERVER_H
+#define SQLSERVER_H
+
+#include <string>
+#include "Bruinbase.h"
+
+/**
+ * SqlServer: serves Bruinbase commands to many clients over a Unix
+ * domain socket.
+ * A client sends one command per line. The results of a command are
+ * written back in the format of ResultSink and followed by a status
+ * line that starts with a NUL byte, so it cannot be mistaken for a
+ * result: "\0OK\n", "\0ERROR <error code>\n" or "\0ERROR syntax\n".
+ * "format binary" and "format text" choose the ResultSink format of the
+ * SELECT results of the connection from then on (text by default).
+ * "quit" or "exit" closes the connection.
+ *
+ * A fixed pool of worker threads serves the connections, each worker one
+ * connection at a time. The parser is not reentrant, so commands are
+ * parsed one at a time, but they are executed concurrently: SELECTs
+ * run in parallel, a LOAD or CREATE INDEX runs alone.
+ */
+class SqlServer {
+ public:
+  /// the default number of worker threads
+  static const int DEFAULT_WORKERS = 8;
+
+  /**
+   * listen on socketPath and serve clients until an error occurs.
+   * an existing socket file at socketPath is replaced.
+   * @param socketPath[IN] the path of the Unix domain socket
+   * @param workers[IN] the number of worker threads
+   * @return error code if the server cannot start or stops
+   */
+  static RC run(const std::string& socketPath, int workers = DEFAULT_WORKERS);
+};
+
+#endif /* SQLSERVER_H */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <climits>
+#include "ZoneMap.h"
+
+/*
+ * mark every zone on the page as "may contain any key"
+ */
+static void clearZones(int* zones, int count)
+{
+  for (int i = 0; i < count; i++) {
+    zones[2 * i] = INT_MIN;
+    zones[2 * i + 1] = INT_MAX;
+  }
+}
+
+ZoneMap::ZoneMap()
+{
+  mode = 'r';
+  zonePid = -1;
+  dirty = false;
+}
+
+RC ZoneMap::open(const std::string& filename, char mode)
+{
+  RC rc;
+
+  if ((rc = pf.open(filename, mode)) < 0) return rc;
+  this->mode = mode;
+  zonePid = -1;
+  dirty = false;
+  return 0;
+}
+
+RC ZoneMap::close()
+{
+  RC rc = 0;
+
+  if (dirty) rc = pf.write(zonePid, zones);
+  zonePid = -1;
+  dirty = false;
+  if (pf.close() < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+  return rc;
+}
+
+RC ZoneMap::loadPage(PageId zpid)
+{
+  RC rc;
+
+  if (zpid == zonePid) return 0;
+
+  if (dirty) {
+    if ((rc = pf.write(zonePid, zones)) < 0) return rc;
+    dirty = false;
+  }
+
+  if (zpid < pf.endPid()) {
+    if ((rc = pf.read(zpid, zones)) < 0) return rc;
+  } else {
+    clearZones(zones, ZONES_PER_PAGE);
+    // never leave a hole of zero-filled (i.e., wrong) zones behind
+    if (mode == 'w') {
+      for (PageId p = pf.endPid(); p < zpid; p++) {
+        if ((rc = pf.write(p, zones)) < 0) return rc;
+      }
+    }
+  }
+  zonePid = zpid;
+
+  return 0;
+}
+
+RC ZoneMap::add(const RecordId& rid, int key)
+{
+  RC rc;
+
+  if ((rc = loadPage(rid.pid / ZONES_PER_PAGE)) < 0) return rc;
+
+  int* zone = zones + 2 * (rid.pid % ZONES_PER_PAGE);
+  if (rid.sid == 0) {
+    zone[0] = zone[1] = key;
+  } else {
+    if (key < zone[0]) zone[0] = key;
+    if (key > zone[1]) zone[1] = key;
+  }
+  dirty = true;
+
+  return 0;
+}
+
+bool ZoneMap::mayContain(PageId pid, int lowKey, int highKey)
+{
+  if (loadPage(pid / ZONES_PER_PAGE) < 0) return true;
+
+  const int* zone = zones + 2 * (pid % ZONES_PER_PAGE);
+  return zone[0] <= highKey && zone[1] >= lowKey;
+}
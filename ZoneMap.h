@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <string>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+
+/**
+ * ZoneMap: the smallest and the largest key stored in every page of a
+ * table file. It is kept next to the table (table.zmp) and lets the
+ * sequential scan skip pages that cannot contain a key in the range
+ * of the query.
+ * A page with no zone entry, e.g., one appended before the zone map
+ * existed, may contain any key.
+ */
+class ZoneMap {
+ public:
+  ZoneMap();
+
+  /**
+   * open the zone map file in read or write mode.
+   * @param filename[IN] the name of the zone map file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode);
+
+  /**
+   * write the cached zone page and close the zone map file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * record that a tuple with key was stored at rid. the first tuple of
+   * a table page (rid.sid == 0) resets the zone of that page.
+   * @param rid[IN] the RecordId of the tuple
+   * @param key[IN] the key of the tuple
+   * @return error code. 0 if no error
+   */
+  RC add(const RecordId& rid, int key);
+
+  /**
+   * check whether the table page pid may contain a key in
+   * [lowKey, highKey].
+   * @param pid[IN] the PageId of the table page
+   * @param lowKey[IN] the smallest key of interest
+   * @param highKey[IN] the largest key of interest
+   * @return false if the page certainly has no such key
+   */
+  bool mayContain(PageId pid, int lowKey, int highKey);
+
+ private:
+  /// (min, max) pairs per zone page
+  static const int ZONES_PER_PAGE = PageFile::PAGE_SIZE / (2 * sizeof(int));
+
+  RC loadPage(PageId zpid);
+
+  PageFile pf;
+  char     mode;
+  int      zones[2 * ZONES_PER_PAGE];  /// the cached zone page
+  PageId   zonePid;                    /// PageId of the cached zone page
+  bool     dirty;
+};
+
+#endif /* ZONEMAP_H */
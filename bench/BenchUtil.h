@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Helpers shared by the benchmarks: a clock, latency percentiles, key
+ * generators and the report format.
+ *
+ * Every measurement is reported as one JSON object per line, e.g.
+ *   {"bench":"point_lookup","rows":100000,"dist":"zipf","ops":10000,
+ *    "ops_per_s":81234.5,"p50_us":10.2,"p99_us":35.7,"reads_per_op":3.01}
+ * so that runs can be compared by a script to track regressions.
+ */
+
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <time.h>
+
+/*
+ * @return a monotonic time in seconds
+ */
+static inline double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * the latencies of the operations of one measurement
+ */
+class Latencies {
+ public:
+  Latencies() : sorted(false) {}
+
+  void add(double seconds) { samples.push_back(seconds); sorted = false; }
+  int  count() const { return samples.size(); }
+
+  /*
+   * @return the p-th percentile (0 <= p <= 100) in seconds
+   */
+  double percentile(double p)
+  {
+    if (samples.empty()) return 0;
+    if (!sorted) {
+      std::sort(samples.begin(), samples.end());
+      sorted = true;
+    }
+    size_t i = (size_t)(p / 100 * (samples.size() - 1) + 0.5);
+    return samples[i];
+  }
+
+ private:
+  std::vector<double> samples;
+  bool sorted;
+};
+
+/*
+ * generates keys in [0, n) with one of the key distributions
+ */
+class KeyGen {
+ public:
+  enum Dist { UNIFORM, SEQUENTIAL, ZIPF };
+
+  /*
+   * @param dist[IN] the distribution
+   * @param n[IN] the number of distinct keys
+   * @param seed[IN] the seed of the random numbers
+   */
+  KeyGen(Dist dist, int n, unsigned seed)
+    : dist(dist), n(n), state(seed | 1), seq(0), theta(0.99), zetan(0), alpha(0), eta(0)
+  {
+    if (dist != ZIPF) return;
+
+    // the Zipfian generator of Gray et al., "Quickly generating
+    // billion-record synthetic databases", with theta = 0.99
+    for (int i = 1; i <= n; i++) zetan += 1 / pow((double)i, theta);
+    double zeta2 = 1 + 1 / pow(2.0, theta);
+    alpha = 1 / (1 - theta);
+    eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+  }
+
+  int next()
+  {
+    switch (dist) {
+    case SEQUENTIAL:
+      if (seq == n) seq = 0;
+      return seq++;
+    case UNIFORM:
+      return random() % n;
+    case ZIPF: {
+      double u = random() / 4294967296.0;
+      double uz = u * zetan;
+      long   rank;
+      if (uz < 1) rank = 0;
+      else if (uz < 1 + pow(0.5, theta)) rank = 1;
+      else rank = (long)(n * pow(eta * u - eta + 1, alpha));
+      // spread the popular keys over the key range
+      return (int)((rank * 2654435761UL) % n);
+    }
+    }
+    return 0;
+  }
+
+  static const char* name(Dist dist)
+  {
+    return dist == UNIFORM ? "uniform" : dist == SEQUENTIAL ? "sequential" : "zipf";
+  }
+
+  /*
+   * @return false if s names no distribution
+   */
+  static bool parse(const char* s, Dist& dist)
+  {
+    if (strcmp(s, "uniform") == 0) dist = UNIFORM;
+    else if (strcmp(s, "sequential") == 0) dist = SEQUENTIAL;
+    else if (strcmp(s, "zipf") == 0) dist = ZIPF;
+    else return false;
+    return true;
+  }
+
+ private:
+  /// 32 random bits (xorshift)
+  unsigned random()
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  Dist     dist;
+  int      n;
+  unsigned state;
+  int      seq;
+  double   theta, zetan, alpha, eta;
+};
+
+/*
+ * print one measurement as a JSON line.
+ * @param out[IN] where to print
+ * @param bench[IN] the name of the measurement
+ * @param params[IN] more "name":value pairs describing it, e.g. "\"rows\":1000"
+ * @param seconds[IN] the total time of the operations
+ * @param lat[IN] the latencies of the operations, or of batches of batch operations
+ * @param batch[IN] the number of operations per latency sample
+ * @param reads[IN] the pages read by the operations; -1 if not applicable
+ */
+static inline void report(FILE* out, const char* bench, const std::string& params, int ops,
+                          double seconds, Latencies& lat, int batch, long reads)
+{
+  fprintf(out, "{\"bench\":\"%s\"%s%s,\"ops\":%d,\"ops_per_s\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f",
+          bench, params.empty() ? "" : ",", params.c_str(), ops,
+          seconds > 0 ? ops / seconds : 0.0,
+          lat.percentile(50) * 1e6 / batch, lat.percentile(99) * 1e6 / batch);
+  if (reads >= 0) fprintf(out, ",\"reads_per_op\":%.3f", ops > 0 ? (double)reads / ops : 0.0);
+  fprintf(out, "}\n");
+  fflush(out);
+}
+
+#endif /* BENCHUTIL_H */
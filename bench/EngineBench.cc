@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Macrobenchmarks of SqlEngine over synthetic tables: bulk load, point
+ * lookup, range scans of varying selectivity and a full scan. The keys
+ * of a table of n rows are in [0, n) and follow the uniform, sequential
+ * or Zipfian distribution; the lookups draw keys from the same one.
+ * Query results go to /dev/null; the measurements are printed as JSON
+ * lines (see BenchUtil.h). The result cache is disabled, so every query
+ * reads the index and the table.
+ * usage: EngineBench [-d directory] [-r rows]... [-k uniform|sequential|zipf]...
+ *                    [-n number of lookups] [-m] [-z]
+ * -m finds leaves with the learned leaf model (BTreeIndexT::setLeafModel()).
+ * -z stores the index leaves compressed (SqlEngine::setLeafCompression()).
+ * default: 10000, 100000 and 1000000 rows with all three distributions
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SqlEngine.h"
+#include "PageFile.h"
+#include "PageIO.h"
+#include "BTreeIndex.h"
+#include "BenchUtil.h"
+
+using namespace std;
+
+static FILE* out;  // the report; stdout receives the query results
+
+static string describe(int rows, KeyGen::Dist dist)
+{
+  ostringstream s;
+  s << "\"rows\":" << rows << ",\"dist\":\"" << KeyGen::name(dist) << "\"";
+  return s.str();
+}
+
+static void removeTable(const string& table)
+{
+  const char* suffixes[] = { ".tbl", ".idx", ".zmp", ".del" };
+  for (unsigned i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+    unlink((table + suffixes[i]).c_str());
+  }
+  // a load that fails may leave its index inserts in sorted runs
+  BTreeIndex::dropRuns(table + ".idx");
+}
+
+/*
+ * @return the pages read so far, through PageFile and PageIO
+ */
+static long pageReads()
+{
+  return PageFile::getPageReadCount() + PageIO::getPageReadCount();
+}
+
+static RC benchLoad(const string& table, int rows, KeyGen::Dist dist)
+{
+  KeyGen    keys(dist, rows, 1);
+  Latencies lat;
+  string    loadfile = table + ".del";
+  FILE*     f = fopen(loadfile.c_str(), "w");
+  RC        rc;
+
+  if (f == NULL) return RC_FILE_OPEN_FAILED;
+  for (int i = 0; i < rows; i++) fprintf(f, "%d,\"value %d\"\n", keys.next(), i);
+  fclose(f);
+
+  long   reads = pageReads();
+  double t0 = now();
+  rc = SqlEngine::load(table, loadfile, SqlEngine::BTREE_INDEX);
+  double seconds = now() - t0;
+  lat.add(seconds);
+  report(out, "bulk_load", describe(rows, dist), rows, seconds, lat, rows,
+         pageReads() - reads);
+  unlink(loadfile.c_str());
+  return rc;
+}
+
+/*
+ * run the queries and report them.
+ * @param lows[IN] the lowest key of every query
+ * @param width[IN] the number of keys every query covers; 1 for a point lookup
+ * @param attr[IN] the SELECT attribute
+ */
+static void benchQueries(const char* bench, const string& params, const string& table,
+                         const vector<int>& lows, int width, int attr)
+{
+  Latencies lat;
+  char      low[16], high[16];
+
+  vector<SelCond> cond(width == 1 ? 1 : 2);
+  cond[0].attr = 1;
+  cond[0].value = low;
+  if (width == 1) {
+    cond[0].comp = SelCond::EQ;
+  } else {
+    cond[0].comp = SelCond::GE;
+    cond[1].attr = 1;
+    cond[1].comp = SelCond::LT;
+    cond[1].value = high;
+  }
+
+  long   reads = pageReads();
+  double t0 = now();
+  for (unsigned i = 0; i < lows.size(); i++) {
+    snprintf(low, sizeof(low), "%d", lows[i]);
+    snprintf(high, sizeof(high), "%d", lows[i] + width);
+    double t1 = now();
+    SqlEngine::select(attr, table, cond);
+    lat.add(now() - t1);
+  }
+  double seconds = now() - t0;
+  report(out, bench, params, lows.size(), seconds, lat, 1, pageReads() - reads);
+}
+
+static void benchTable(const string& dir, int rows, KeyGen::Dist dist, int lookups)
+{
+  ostringstream name;
+  name << dir << "/bench_" << KeyGen::name(dist) << "_" << rows;
+  string table = name.str();
+
+  removeTable(table);
+  if (benchLoad(table, rows, dist) < 0) {
+    fprintf(stderr, "Error: cannot load %s\n", table.c_str());
+    removeTable(table);
+    return;
+  }
+
+  // point lookups
+  KeyGen      keys(dist, rows, 2);
+  vector<int> lows;
+  for (int i = 0; i < lookups; i++) lows.push_back(keys.next());
+  benchQueries("point_lookup", describe(rows, dist), table, lows, 1, 3);
+
+  // range scans of 0.01% to 10% of the key range
+  double selectivities[] = { 0.0001, 0.001, 0.01, 0.1 };
+  for (unsigned s = 0; s < sizeof(selectivities) / sizeof(selectivities[0]); s++) {
+    int width = (int)(rows * selectivities[s]);
+    if (width < 2) continue;
+
+    KeyGen starts(KeyGen::UNIFORM, rows - width + 1, 3);
+    int    queries = (int)(100 * 0.001 / selectivities[s]);
+    lows.clear();
+    for (int i = 0; i < queries || i < 5; i++) lows.push_back(starts.next());
+
+    ostringstream params;
+    params << describe(rows, dist) << ",\"selectivity\":" << selectivities[s];
+    benchQueries("range_scan", params.str(), table, lows, width, 3);
+  }
+
+  // full scans
+  Latencies lat;
+  long      reads = pageReads();
+  double    t0 = now();
+  for (int i = 0; i < 3; i++) {
+    double t1 = now();
+    SqlEngine::select(4, table, vector<SelCond>());
+    lat.add(now() - t1);
+  }
+  double seconds = now() - t0;
+  report(out, "full_scan", describe(rows, dist), 3, seconds, lat, 1,
+         pageReads() - reads);
+
+  removeTable(table);
+}
+
+int main(int argc, char** argv)
+{
+  string               dir = ".";
+  vector<int>          rows;
+  vector<KeyGen::Dist> dists;
+  int                  lookups = 10000;
+  int                  opt;
+
+  while ((opt = getopt(argc, argv, "d:r:k:n:mz")) != -1) {
+    KeyGen::Dist dist;
+    switch (opt) {
+    case 'd': dir = optarg; break;
+    case 'r': rows.push_back(atoi(optarg)); break;
+    case 'n': lookups = atoi(optarg); break;
+    case 'm': BTreeIndex::setLeafModel(true); break;
+    case 'z': SqlEngine::setLeafCompression(true); break;
+    case 'k':
+      if (KeyGen::parse(optarg, dist)) {
+        dists.push_back(dist);
+        break;
+      }
+      // fall through
+    default:
+      fprintf(stderr, "usage: %s [-d directory] [-r rows]... "
+              "[-k uniform|sequential|zipf]... [-n lookups] [-m] [-z]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (rows.empty()) {
+    rows.push_back(10000);
+    rows.push_back(100000);
+    rows.push_back(1000000);
+  }
+  if (dists.empty()) {
+    dists.push_back(KeyGen::UNIFORM);
+    dists.push_back(KeyGen::SEQUENTIAL);
+    dists.push_back(KeyGen::ZIPF);
+  }
+
+  // the report keeps stdout; the query results go to /dev/null
+  out = fdopen(dup(1), "w");
+  int devnull = open("/dev/null", O_WRONLY);
+  if (out == NULL || devnull < 0 || dup2(devnull, 1) < 0) {
+    fprintf(stderr, "Error: cannot redirect the query results\n");
+    return 1;
+  }
+  close(devnull);
+  SqlEngine::setCacheSize(0);
+
+  for (unsigned r = 0; r < rows.size(); r++) {
+    for (unsigned d = 0; d < dists.size(); d++) {
+      benchTable(dir, rows[r], dists[d], lookups);
+    }
+  }
+  fclose(out);
+  return 0;
+}
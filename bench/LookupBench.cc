@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Batched point lookups on a B+tree index: locate() key by key against
+ * BTreeIndexT::locateBatch() with 1 to MAX_INTERLEAVE descents in flight.
+ * An index of n keys holds random even keys below 2n, so the lookups,
+ * drawn from [0, 2n) with the chosen distribution, hit and miss. Latencies
+ * are per batch and reported per lookup, as JSON lines (see BenchUtil.h).
+ * Every measurement reopens the index, so the non-leaf levels are read
+ * from the index file until they are built in memory again.
+ * usage: LookupBench [-d directory] [-r keys]... [-k uniform|sequential|zipf]
+ *                    [-n number of lookups] [-b batch size] [-c]
+ * -c drops the index file from the OS page cache before every
+ * measurement, so that the node reads go to the device.
+ * default: 100000 and 1000000 keys, uniform, 20000 lookups in batches of 64
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "BTreeIndex.h"
+#include "PageFile.h"
+#include "PageIO.h"
+#include "BenchUtil.h"
+
+using namespace std;
+
+/*
+ * @return the pages read so far, through PageFile and PageIO
+ */
+static long pageReads()
+{
+  return PageFile::getPageReadCount() + PageIO::getPageReadCount();
+}
+
+/*
+ * evict a file from the OS page cache.
+ */
+static void dropCache(const string& filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+/*
+ * look up keys in batches of batch keys and report them.
+ * @param width[IN] the descents locateBatch() interleaves; 0 to call
+ *                  locate() for every key
+ */
+static void benchLookups(const string& indexname, const string& params, const vector<int>& keys,
+                         int batch, int width, bool cold)
+{
+  BTreeIndex          index;
+  vector<IndexCursor> cursors(batch);
+  vector<RC>          results(batch);
+  Latencies           lat;
+  int                 found = 0;
+
+  if (cold) dropCache(indexname);
+  if (index.open(indexname, 'r') < 0) {
+    fprintf(stderr, "Error: cannot open %s\n", indexname.c_str());
+    return;
+  }
+
+  long   reads = pageReads();
+  double t0 = now();
+  for (unsigned i = 0; i < keys.size(); i += batch) {
+    int    n = min(batch, (int)(keys.size() - i));
+    double t1 = now();
+    if (width == 0) {
+      for (int k = 0; k < n; k++) results[k] = index.locate(keys[i + k], cursors[k]);
+    } else {
+      index.locateBatch(&keys[i], n, &cursors[0], &results[0], width);
+    }
+    lat.add(now() - t1);
+    for (int k = 0; k < n; k++) found += (results[k] == 0);
+  }
+  double seconds = now() - t0;
+  reads = pageReads() - reads;
+  index.close();
+
+  ostringstream s;
+  s << params << ",\"batch\":" << batch << ",\"width\":" << width
+    << ",\"cold\":" << (cold ? "true" : "false") << ",\"hits\":" << found;
+  report(stdout, width == 0 ? "locate" : "locate_batch", s.str(), keys.size(), seconds,
+         lat, batch, reads);
+}
+
+static void benchIndex(const string& dir, int rows, KeyGen::Dist dist, int lookups,
+                       int batch, bool cold)
+{
+  ostringstream name;
+  name << dir << "/lookup_bench_" << rows << ".idx";
+  string indexname = name.str();
+
+  // random even keys below 2 * rows
+  BTreeIndex index;
+  KeyGen     order(KeyGen::UNIFORM, rows, 1);
+  RecordId   rid;
+  unlink(indexname.c_str());
+  if (index.open(indexname, 'w') < 0) {
+    fprintf(stderr, "Error: cannot create %s\n", indexname.c_str());
+    return;
+  }
+  index.setInsertBuffer(BTreeIndex::DEFAULT_INSERT_BUFFER);
+  for (int i = 0; i < rows; i++) {
+    rid.pid = i / RecordFile::RECORDS_PER_PAGE;
+    rid.sid = i % RecordFile::RECORDS_PER_PAGE;
+    index.insert(2 * order.next(), rid);
+  }
+  index.close();
+
+  KeyGen      gen(dist, 2 * rows, 2);
+  vector<int> keys;
+  for (int i = 0; i < lookups; i++) keys.push_back(gen.next());
+
+  ostringstream params;
+  params << "\"rows\":" << rows << ",\"dist\":\"" << KeyGen::name(dist) << "\"";
+  benchLookups(indexname, params.str(), keys, batch, 0, cold);
+  for (int width = 1; width <= BTreeIndex::MAX_INTERLEAVE; width *= 2) {
+    benchLookups(indexname, params.str(), keys, batch, width, cold);
+  }
+  unlink(indexname.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  string       dir = ".";
+  vector<int>  rows;
+  KeyGen::Dist dist = KeyGen::UNIFORM;
+  int          lookups = 20000;
+  int          batch = 64;
+  bool         cold = false;
+  int          opt;
+
+  while ((opt = getopt(argc, argv, "d:r:k:n:b:c")) != -1) {
+    switch (opt) {
+    case 'd': dir = optarg; break;
+    case 'r': rows.push_back(atoi(optarg)); break;
+    case 'n': lookups = atoi(optarg); break;
+    case 'b': batch = atoi(optarg); break;
+    case 'c': cold = true; break;
+    case 'k':
+      if (KeyGen::parse(optarg, dist)) break;
+      // fall through
+    default:
+      fprintf(stderr, "usage: %s [-d directory] [-r keys]... "
+              "[-k uniform|sequential|zipf] [-n lookups] [-b batch size] [-c]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (batch < 1) batch = 1;
+  if (rows.empty()) {
+    rows.push_back(100000);
+    rows.push_back(1000000);
+  }
+
+  for (unsigned r = 0; r < rows.size(); r++) {
+    benchIndex(dir, rows[r], dist, lookups, batch, cold);
+  }
+  return 0;
+}
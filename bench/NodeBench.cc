@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Microbenchmarks of the B+tree nodes in memory: leaf search, non-leaf
+ * search, leaf insert and leaf split. Latencies are measured over
+ * batches of operations and reported per operation, as JSON lines (see
+ * BenchUtil.h).
+ * usage: NodeBench [node size in bytes] [number of operations]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "BTreeNode.h"
+#include "BenchUtil.h"
+
+using namespace std;
+
+static const int BATCH = 1000;
+
+/*
+ * fill leaf with the keys 0, 2, 4, ... up to its capacity
+ * @return the number of keys
+ */
+static int fillLeaf(BTLeafNode& leaf)
+{
+  RecordId rid;
+  int      n = 0;
+
+  rid.pid = rid.sid = 0;
+  while (leaf.insert(2 * n, rid) == 0) n++;
+  return n;
+}
+
+static void benchLeafLocate(int nodeSize, int ops, const string& params)
+{
+  BTLeafNode leaf(nodeSize);
+  Latencies  lat;
+  KeyGen     keys(KeyGen::UNIFORM, 2 * fillLeaf(leaf), 1);
+  int        eid, sum = 0;
+
+  double t0 = now();
+  for (int done = 0; done < ops; done += BATCH) {
+    double t1 = now();
+    for (int i = 0; i < BATCH; i++) {
+      leaf.locate(keys.next(), eid);
+      sum += eid;
+    }
+    lat.add(now() - t1);
+  }
+  double seconds = now() - t0;
+  if (sum == -1) printf("\n");  // keep the loop
+  report(stdout, "leaf_locate", params, lat.count() * BATCH, seconds, lat, BATCH, -1);
+}
+
+static void benchNonLeafLocate(int nodeSize, int ops, const string& params)
+{
+  BTNonLeafNode node(nodeSize);
+  Latencies     lat;
+  RecordId      rid;
+  int           n = 1;
+
+  rid.pid = 1;
+  rid.sid = 0;
+  node.initializeRoot(rid, 0, rid);
+  while (node.insert(2 * n, rid) == 0) n++;
+
+  KeyGen keys(KeyGen::UNIFORM, 2 * n, 1);
+  double t0 = now();
+  for (int done = 0; done < ops; done += BATCH) {
+    double t1 = now();
+    for (int i = 0; i < BATCH; i++) node.locateChildPtr(keys.next(), rid);
+    lat.add(now() - t1);
+  }
+  double seconds = now() - t0;
+  report(stdout, "nonleaf_locate", params, lat.count() * BATCH, seconds, lat, BATCH, -1);
+}
+
+static void benchLeafInsert(int nodeSize, int ops, const string& params)
+{
+  Latencies lat;
+  KeyGen    keys(KeyGen::UNIFORM, 1 << 30, 1);
+  RecordId  rid;
+  int       done = 0;
+  double    seconds = 0;
+
+  rid.pid = rid.sid = 0;
+  // fill empty leaves in random key order; one leaf is one batch
+  while (done < ops) {
+    BTLeafNode leaf(nodeSize);
+    int        n = 0;
+    double     t1 = now();
+    while (leaf.insert(keys.next(), rid) == 0) n++;
+    double t = now() - t1;
+    lat.add(t / n);
+    seconds += t;
+    done += n;
+  }
+  report(stdout, "leaf_insert", params, done, seconds, lat, 1, -1);
+}
+
+static void benchLeafSplit(int nodeSize, int ops, const string& params)
+{
+  Latencies lat;
+  RecordId  rid;
+  double    seconds = 0;
+  int       key;
+
+  rid.pid = rid.sid = 0;
+  ops /= 100;
+  if (ops < 1) ops = 1;
+  for (int i = 0; i < ops; i++) {
+    BTLeafNode leaf(nodeSize), sibling(nodeSize);
+    int n = fillLeaf(leaf);
+
+    double t1 = now();
+    leaf.insertAndSplit(n, rid, sibling, key);
+    double t = now() - t1;
+    lat.add(t);
+    seconds += t;
+  }
+  report(stdout, "leaf_split", params, ops, seconds, lat, 1, -1);
+}
+
+int main(int argc, char** argv)
+{
+  int nodeSize = (argc > 1) ? atoi(argv[1]) : PageFile::PAGE_SIZE;
+  int ops = (argc > 2) ? atoi(argv[2]) : 1000000;
+
+  ostringstream params;
+  params << "\"node_size\":" << nodeSize;
+
+  benchLeafLocate(nodeSize, ops, params.str());
+  benchNonLeafLocate(nodeSize, ops, params.str());
+  benchLeafInsert(nodeSize, ops, params.str());
+  benchLeafSplit(nodeSize, ops, params.str());
+  return 0;
+}
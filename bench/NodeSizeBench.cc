@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Sweep the B+tree node size and measure point lookup and full scan
+ * latency for each size.
+ * usage: NodeSizeBench [number of keys] [number of lookups]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <string>
+#include <unistd.h>
+#include <sys/time.h>
+#include "BTreeIndex.h"
+
+using namespace std;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+  int nkeys = (argc > 1) ? atoi(argv[1]) : 100000;
+  int nlookups = (argc > 2) ? atoi(argv[2]) : 10000;
+  int sizes[] = { 1, 4, 8, 16 };
+  string indexname = "nodesize_bench.idx";
+
+  printf("%-9s %8s %10s %10s %12s %10s\n",
+         "nodesize", "height", "insert_s", "lookup_us", "lookup_reads", "scan_ms");
+
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    BTreeIndex  index;
+    IndexCursor cursor;
+    RecordId    rid;
+    int         key;
+
+    unlink(indexname.c_str());
+    index.open(indexname, 'w');
+    if (index.setNodeSize(sizes[i] * PageFile::PAGE_SIZE) < 0) {
+      fprintf(stderr, "Error: node size %d KB not supported\n", sizes[i]);
+      continue;
+    }
+
+    srand(1);
+    double t0 = now();
+    for (int k = 0; k < nkeys; k++) {
+      rid.pid = k / RecordFile::RECORDS_PER_PAGE;
+      rid.sid = k % RecordFile::RECORDS_PER_PAGE;
+      index.insert(rand(), rid);
+    }
+    double tInsert = now() - t0;
+    index.close();
+    index.open(indexname, 'r');
+
+    // point lookups of random (mostly absent) keys
+    int reads = PageFile::getPageReadCount();
+    t0 = now();
+    for (int k = 0; k < nlookups; k++) {
+      index.locate(rand(), cursor);
+      index.readForward(cursor, key, rid);
+    }
+    double tLookup = now() - t0;
+    reads = PageFile::getPageReadCount() - reads;
+
+    // full scan of the leaf level
+    t0 = now();
+    index.locate(INT_MIN, cursor);
+    while (index.readForward(cursor, key, rid) == 0);
+    double tScan = now() - t0;
+
+    printf("%-9d %8d %10.3f %10.2f %12.2f %10.2f\n",
+           sizes[i] * PageFile::PAGE_SIZE, index.getTreeHeight(),
+           tInsert, tLookup * 1e6 / nlookups, (double)reads / nlookups, tScan * 1e3);
+    index.close();
+  }
+
+  unlink(indexname.c_str());
+  return 0;
+}